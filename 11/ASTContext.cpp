@@ -0,0 +1,26 @@
+//
+// Created by 董宏昌 on 2017/2/22.
+//
+
+#include "ASTContext.h"
+#include <cstring>
+
+
+llvm::StringRef ASTContext::copyString(llvm::StringRef string) {
+    if (string.empty()) {
+        return llvm::StringRef();
+    }
+
+    char *buffer = m_allocator.Allocate<char>(string.size());
+    memcpy(buffer, string.data(), string.size());
+
+    return llvm::StringRef(buffer, string.size());
+}
+
+size_t ASTContext::getBytesAllocated() const {
+    return m_allocator.getBytesAllocated();
+}
+
+void ASTContext::reset() {
+    m_allocator.Reset();
+}
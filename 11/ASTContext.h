@@ -0,0 +1,75 @@
+//
+// Created by 董宏昌 on 2017/2/22.
+//
+
+#ifndef PROJECT_ASTCONTEXT_H
+#define PROJECT_ASTCONTEXT_H
+
+
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Allocator.h"
+
+
+/*
+ * 一次解析（一个翻译单元）中所有 AST 节点共用的内存池
+ * 节点、节点的子节点数组和名字都连续地分配在这里，
+ * ASTContext 释放时整块内存一次性归还，不会逐个调用节点的析构函数
+ * 所以放进来的类型必须是可平凡析构的，不能持有 std::string、std::vector 这类成员
+ */
+class ASTContext {
+private:
+    llvm::BumpPtrAllocator m_allocator;
+
+public:
+    ASTContext() = default;
+    ASTContext(const ASTContext &) = delete;
+    ASTContext &operator=(const ASTContext &) = delete;
+
+    /*
+     * 在内存池中创建一个节点
+     */
+    template <typename T, typename... Args>
+    T *create(Args &&... args) {
+        static_assert(std::is_trivially_destructible<T>::value, "AST nodes are never destroyed");
+
+        return new (m_allocator.Allocate<T>()) T(std::forward<Args>(args)...);
+    }
+
+    /*
+     * 把数组拷贝到内存池中，返回的 ArrayRef 与 ASTContext 同生命周期
+     */
+    template <typename T>
+    llvm::ArrayRef<T> copyArray(llvm::ArrayRef<T> array) {
+        static_assert(std::is_trivially_destructible<T>::value, "AST nodes are never destroyed");
+
+        if (array.empty()) {
+            return llvm::ArrayRef<T>();
+        }
+
+        T *buffer = m_allocator.Allocate<T>(array.size());
+        std::uninitialized_copy(array.begin(), array.end(), buffer);
+
+        return llvm::ArrayRef<T>(buffer, array.size());
+    }
+
+    /*
+     * 把字符串拷贝到内存池中，比如把输入缓冲区里的标识符保存下来
+     */
+    llvm::StringRef copyString(llvm::StringRef string);
+
+    /// 内存池已经分配出去的字节数
+    size_t getBytesAllocated() const;
+
+    /*
+     * 丢掉所有节点，只保留第一块内存留给下一个翻译单元使用，调用前不能再有地方引用这些节点
+     */
+    void reset();
+};
+
+
+#endif //PROJECT_ASTCONTEXT_H
@@ -0,0 +1,234 @@
+//
+// Created by 董宏昌 on 2017/2/28.
+//
+
+#include "BinaryAST.h"
+#include <cstdio>
+#include <cstring>
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "IdentifierTable.h"
+
+
+static const char kBinaryASTMagic[4] = {'K', 'S', 'B', '\0'};
+/// 按本机字节序写出，读入时不一致说明文件来自字节序不同的机器
+static const uint32_t kByteOrderMark = 0x01020304;
+
+
+/*
+ * .ksb 的文件头，之后依次是
+ * m_numberCount 个 double，m_integerCount 个 int64_t，m_nodeCount 个 FlatNode 和 SourceLocation，m_listCount 个 uint32_t，
+ * m_functionCount 个 FlatFunction，m_stringCount + 1 个标识符在字符区中的偏移，最后是 m_stringBytes 字节的字符区
+ */
+struct BinaryASTHeader {
+    char m_magic[4];
+    uint32_t m_version;
+    uint32_t m_byteOrder;
+    /// 各个结构体的大小，编译器的布局不同时拒绝读入
+    uint32_t m_recordSizes;
+    uint32_t m_numberCount;
+    uint32_t m_integerCount;
+    uint32_t m_nodeCount;
+    uint32_t m_listCount;
+    uint32_t m_functionCount;
+    uint32_t m_stringCount;
+    uint32_t m_stringBytes;
+    /// ascii 字符作为二元运算符的优先级，0 表示不是二元运算符
+    uint8_t m_binaryPrecedence[128];
+};
+
+
+static uint32_t getRecordSizes() {
+    return (uint32_t)(sizeof(FlatNode) | sizeof(SourceLocation) << 8 | sizeof(FlatFunction) << 16);
+}
+
+template <typename T>
+static void writeArray(llvm::raw_ostream &out, const std::vector<T> &array) {
+    out.write(reinterpret_cast<const char *>(array.data()), array.size() * sizeof(T));
+}
+
+/*
+ * 从 ptr 拷贝 count 个元素到 array，返回数组之后的位置
+ * 输入不一定按 T 对齐，所以用 memcpy 而不是直接转换指针
+ */
+template <typename T>
+static const char *readArray(const char *ptr, uint32_t count, std::vector<T> &array) {
+    array.resize(count);
+    if (count) {
+        memcpy(array.data(), ptr, count * sizeof(T));
+    }
+
+    return ptr + count * sizeof(T);
+}
+
+
+void BinaryAST::write(const FlatAST &ast, const OperatorTable &operatorTable, llvm::raw_ostream &out) {
+    // AST 中的 Symbol 就是 kIdentifierTable 的编号，所以直接写出整个标识符表
+    unsigned stringCount = kIdentifierTable.size();
+    std::vector<uint32_t> stringOffsets;
+    stringOffsets.reserve(stringCount + 1);
+    uint32_t stringBytes = 0;
+    for (unsigned i = 0; i < stringCount; ++i) {
+        stringOffsets.push_back(stringBytes);
+        stringBytes += (uint32_t)kIdentifierTable.getString(i).size();
+    }
+    stringOffsets.push_back(stringBytes);
+
+    BinaryASTHeader header = BinaryASTHeader();
+    memcpy(header.m_magic, kBinaryASTMagic, sizeof(header.m_magic));
+    header.m_version = kBinaryASTVersion;
+    header.m_byteOrder = kByteOrderMark;
+    header.m_recordSizes = getRecordSizes();
+    header.m_numberCount = (uint32_t)ast.m_numbers.size();
+    header.m_integerCount = (uint32_t)ast.m_integers.size();
+    header.m_nodeCount = (uint32_t)ast.m_nodes.size();
+    header.m_listCount = (uint32_t)ast.m_lists.size();
+    header.m_functionCount = (uint32_t)ast.m_functions.size();
+    header.m_stringCount = stringCount;
+    header.m_stringBytes = stringBytes;
+    for (int c = 0; c < 128; ++c) {
+        int precedence = operatorTable.getBinaryPrecedence(c);
+        header.m_binaryPrecedence[c] = (uint8_t)(precedence > 0 ? precedence : 0);
+    }
+
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    writeArray(out, ast.m_numbers);
+    writeArray(out, ast.m_integers);
+    writeArray(out, ast.m_nodes);
+    writeArray(out, ast.m_locations);
+    writeArray(out, ast.m_lists);
+    writeArray(out, ast.m_functions);
+    writeArray(out, stringOffsets);
+    for (unsigned i = 0; i < stringCount; ++i) {
+        out << kIdentifierTable.getString(i);
+    }
+}
+
+bool BinaryAST::read(llvm::StringRef data, FlatAST &ast, OperatorTable &operatorTable) {
+    BinaryASTHeader header;
+    if (data.size() < sizeof(header)) {
+        fprintf(stderr, "Not a ksb file\n");
+        return false;
+    }
+    memcpy(&header, data.data(), sizeof(header));
+
+    if (memcmp(header.m_magic, kBinaryASTMagic, sizeof(header.m_magic)) != 0) {
+        fprintf(stderr, "Not a ksb file\n");
+        return false;
+    }
+    if (header.m_version != kBinaryASTVersion) {
+        fprintf(stderr, "Unsupported ksb version %u, expected %u\n", header.m_version, kBinaryASTVersion);
+        return false;
+    }
+    if (header.m_byteOrder != kByteOrderMark || header.m_recordSizes != getRecordSizes()) {
+        fprintf(stderr, "The ksb file was written by an incompatible build\n");
+        return false;
+    }
+
+    uint64_t expectedSize = sizeof(header) +
+                            (uint64_t)header.m_numberCount * sizeof(double) +
+                            (uint64_t)header.m_integerCount * sizeof(int64_t) +
+                            (uint64_t)header.m_nodeCount * (sizeof(FlatNode) + sizeof(SourceLocation)) +
+                            (uint64_t)header.m_listCount * sizeof(uint32_t) +
+                            (uint64_t)header.m_functionCount * sizeof(FlatFunction) +
+                            ((uint64_t)header.m_stringCount + 1) * sizeof(uint32_t) +
+                            header.m_stringBytes;
+    if (data.size() != expectedSize) {
+        fprintf(stderr, "Truncated ksb file\n");
+        return false;
+    }
+
+    // 每个数组整块拷贝一次，节点的内容由 write 写出，这里不逐个检查
+    ast.clear();
+    const char *ptr = data.data() + sizeof(header);
+    ptr = readArray(ptr, header.m_numberCount, ast.m_numbers);
+    ptr = readArray(ptr, header.m_integerCount, ast.m_integers);
+    ptr = readArray(ptr, header.m_nodeCount, ast.m_nodes);
+    ptr = readArray(ptr, header.m_nodeCount, ast.m_locations);
+    ptr = readArray(ptr, header.m_listCount, ast.m_lists);
+    ptr = readArray(ptr, header.m_functionCount, ast.m_functions);
+
+    std::vector<uint32_t> stringOffsets;
+    const char *strings = readArray(ptr, header.m_stringCount + 1, stringOffsets);
+
+    // 文件中的标识符依次 intern，每个标识符一次，与 AST 的大小无关
+    std::vector<Symbol> symbols(header.m_stringCount);
+    bool sameSymbols = true;
+    for (uint32_t i = 0; i < header.m_stringCount; ++i) {
+        uint32_t begin = stringOffsets[i];
+        uint32_t end = stringOffsets[i + 1];
+        if (begin > end || end > header.m_stringBytes) {
+            fprintf(stderr, "Malformed ksb string table\n");
+            ast.clear();
+            return false;
+        }
+
+        symbols[i] = kIdentifierTable.intern(llvm::StringRef(strings + begin, end - begin));
+        sameSymbols = sameSymbols && symbols[i] == i;
+    }
+    if (!sameSymbols) {
+        BinaryAST::remapSymbols(ast, symbols);
+    }
+
+    for (int c = 0; c < 128; ++c) {
+        if (header.m_binaryPrecedence[c]) {
+            operatorTable.setBinaryPrecedence((char)c, header.m_binaryPrecedence[c]);
+        }
+    }
+
+    return true;
+}
+
+void BinaryAST::remapSymbols(FlatAST &ast, const std::vector<Symbol> &symbols) {
+    for (auto &node : ast.m_nodes) {
+        switch (node.m_kind) {
+            case ast_variable:
+            case ast_call:
+            case ast_for: {
+                node.m_operands[0] = symbols[node.m_operands[0]];
+            } break;
+
+            case ast_var: {
+                for (uint32_t i = 0; i < node.m_operands[1]; ++i) {
+                    uint32_t &varName = ast.m_lists[node.m_operands[0] + i * 3];
+                    varName = symbols[varName];
+                }
+            } break;
+
+            default:
+                break;
+        }
+    }
+
+    for (auto &function : ast.m_functions) {
+        function.m_name = symbols[function.m_name];
+        for (uint32_t i = 0; i < function.m_argCount; ++i) {
+            uint32_t &argName = ast.m_lists[function.m_firstArg + i];
+            argName = symbols[argName];
+        }
+    }
+}
+
+bool BinaryAST::save(const FlatAST &ast, const OperatorTable &operatorTable, const std::string &fileName) {
+    std::error_code errorCode;
+    llvm::raw_fd_ostream out(fileName, errorCode, llvm::sys::fs::F_None);
+    if (errorCode) {
+        fprintf(stderr, "Could not open file %s: %s\n", fileName.c_str(), errorCode.message().c_str());
+        return false;
+    }
+
+    BinaryAST::write(ast, operatorTable, out);
+
+    return true;
+}
+
+bool BinaryAST::load(const std::string &fileName, FlatAST &ast, OperatorTable &operatorTable) {
+    // 足够大的文件 MemoryBuffer 会直接 mmap，各个数组从映射的内存直接拷贝到 ast
+    auto fileOrError = llvm::MemoryBuffer::getFile(fileName, -1, false);
+    if (!fileOrError) {
+        fprintf(stderr, "Could not open file %s: %s\n", fileName.c_str(), fileOrError.getError().message().c_str());
+        return false;
+    }
+
+    return BinaryAST::read(fileOrError.get()->getBuffer(), ast, operatorTable);
+}
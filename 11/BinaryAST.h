@@ -0,0 +1,60 @@
+//
+// Created by 董宏昌 on 2017/2/28.
+//
+
+#ifndef PROJECT_BINARYAST_H
+#define PROJECT_BINARYAST_H
+
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/raw_ostream.h"
+#include "FlatAST.h"
+#include "OperatorTable.h"
+
+
+/// .ksb 文件格式的版本，布局有任何变化都要加一
+static const uint32_t kBinaryASTVersion = 4;
+
+
+/*
+ * .ksb 文件：FlatAST 的二进制形式
+ * 文件头之后依次是 FlatAST 的各个数组和标识符表，数组按本机的字节序和结构体布局整块写出，
+ * 读入时每个数组只做一次拷贝，不需要词法分析和语法分析
+ * 文件头中还记录了写出时所有二元运算符的优先级，读入后登记到调用方给出的运算符表，
+ * 之后解析的文本代码可以直接使用库中定义的运算符
+ * Symbol 编号只在一个进程内有意义，所以文件中的编号是文件自己的标识符表的下标，
+ * 读入时重新 intern，编号和当前进程一致时（比如启动后先读入库）不需要改写节点
+ */
+class BinaryAST {
+private:
+    /*
+     * 把 ast 中文件里的标识符编号换成当前进程中的编号，symbols[i] 是文件中第 i 个标识符的新编号
+     */
+    static void remapSymbols(FlatAST &ast, const std::vector<Symbol> &symbols);
+
+public:
+    /*
+     * 把 ast 中的所有函数和 operatorTable 中的二元运算符优先级写成 .ksb 格式
+     */
+    static void write(const FlatAST &ast, const OperatorTable &operatorTable, llvm::raw_ostream &out);
+    /*
+     * 从 data 中读入 .ksb 格式的函数，ast 原有的内容会被清空，运算符优先级登记到 operatorTable
+     * 文件格式、版本或者字节序不对时打印错误并返回 false
+     */
+    static bool read(llvm::StringRef data, FlatAST &ast, OperatorTable &operatorTable);
+
+    /*
+     * 写入 .ksb 文件，文件打不开时返回 false
+     */
+    static bool save(const FlatAST &ast, const OperatorTable &operatorTable, const std::string &fileName);
+    /*
+     * 将 .ksb 文件映射进内存后读入，文件打不开或者格式不对时返回 false
+     */
+    static bool load(const std::string &fileName, FlatAST &ast, OperatorTable &operatorTable);
+};
+
+
+#endif //PROJECT_BINARYAST_H
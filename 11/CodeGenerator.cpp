@@ -0,0 +1,1441 @@
+//
+// Created by 董宏昌 on 2017/2/26.
+//
+
+#include <MacTypes.h>
+#include <algorithm>
+#include <atomic>
+#include "CodeGenerator.h"
+#include "CodegenContext.h"
+#include "Token.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/IR/Intrinsics.h"
+#include "llvm/IR/Value.h"
+#include "llvm/IR/Verifier.h"
+
+
+Symbol getOperatorSymbol(bool isBinary, char op) {
+    // 多个线程同时生成代码时可能同时填写同一项，intern 得到的编号相同，所以只需要保证读写是原子的
+    static std::atomic<Symbol> kUnarySymbols[256];
+    static std::atomic<Symbol> kBinarySymbols[256];
+
+    std::atomic<Symbol> &cached = (isBinary ? kBinarySymbols : kUnarySymbols)[(unsigned char)op];
+    // 运算符函数名不会是空字符串，所以 kEmptySymbol 表示还没有查找过
+    Symbol symbol = cached.load(std::memory_order_relaxed);
+    if (symbol == kEmptySymbol) {
+        std::string functionName = std::string(isBinary ? "binary" : "unary") + op;
+        symbol = kIdentifierTable.intern(functionName);
+        cached.store(symbol, std::memory_order_relaxed);
+    }
+
+    return symbol;
+}
+
+BuiltinFunction getBuiltinFunction(Symbol name) {
+    return llvm::StringSwitch<BuiltinFunction>(kIdentifierTable.getString(name))
+            .Case("vec2", builtin_vec2)
+            .Case("vec4", builtin_vec4)
+            .Case("lane", builtin_lane)
+            .Case("setlane", builtin_setlane)
+            .Case("hsum", builtin_hsum)
+            .Case("hmin", builtin_hmin)
+            .Case("hmax", builtin_hmax)
+            .Default(builtin_none);
+}
+
+/*
+ * 可以换成 llvm 内建函数的 C 库数学函数
+ */
+struct MathIntrinsic {
+    const char *m_name;
+    llvm::Intrinsic::ID m_id;
+    unsigned m_argCount;
+};
+
+static const MathIntrinsic kMathIntrinsics[] = {
+        {"sqrt", llvm::Intrinsic::sqrt, 1},
+        {"sin", llvm::Intrinsic::sin, 1},
+        {"cos", llvm::Intrinsic::cos, 1},
+        {"exp", llvm::Intrinsic::exp, 1},
+        {"exp2", llvm::Intrinsic::exp2, 1},
+        {"log", llvm::Intrinsic::log, 1},
+        {"log2", llvm::Intrinsic::log2, 1},
+        {"log10", llvm::Intrinsic::log10, 1},
+        {"fabs", llvm::Intrinsic::fabs, 1},
+        {"floor", llvm::Intrinsic::floor, 1},
+        {"ceil", llvm::Intrinsic::ceil, 1},
+        {"trunc", llvm::Intrinsic::trunc, 1},
+        {"round", llvm::Intrinsic::round, 1},
+        {"rint", llvm::Intrinsic::rint, 1},
+        {"nearbyint", llvm::Intrinsic::nearbyint, 1},
+        {"pow", llvm::Intrinsic::pow, 2},
+        {"copysign", llvm::Intrinsic::copysign, 2},
+        {"fmin", llvm::Intrinsic::minnum, 2},
+        {"fmax", llvm::Intrinsic::maxnum, 2},
+        {"fma", llvm::Intrinsic::fma, 3},
+};
+
+/*
+ * 内建函数的参数个数
+ */
+static unsigned getBuiltinArgCount(BuiltinFunction builtin) {
+    switch (builtin) {
+        case builtin_vec2:
+        case builtin_lane: return 2;
+        case builtin_vec4: return 4;
+        case builtin_setlane: return 3;
+        default: return 1;
+    }
+}
+
+
+/// 为内联生成的函数体最多的指令数，超过时只留下声明，运算符不受限制
+static const unsigned kMaxInlineBodySize = 64;
+
+static unsigned getInstructionCount(const llvm::Function &function) {
+    unsigned count = 0;
+    for (auto &block : function) {
+        count += (unsigned)block.size();
+    }
+
+    return count;
+}
+
+void codegenInlineBodies(CodegenContext &context) {
+    // 只处理现在已有的声明，生成函数体时新声明的函数不再展开，每个模块最多多生成一层调用
+    std::vector<llvm::Function *> declarations;
+    for (auto &function : *context.getModule()) {
+        if (function.isDeclaration() && !function.isIntrinsic()) {
+            declarations.push_back(&function);
+        }
+    }
+
+    for (llvm::Function *function : declarations) {
+        const FlatAST *ast;
+        FunctionIndex index;
+        if (!context.findExternalFunction(kIdentifierTable.intern(function->getName()), ast, index) ||
+            ast->getFunction(index).m_body == kNoNode) {
+            continue;
+        }
+
+        // 函数体有错误时 codegenFunction 会把它恢复成声明，调用仍然通过 JIT 解析到另外编译的实现
+        if (!CodeGenerator(context, *ast).codegenFunction(index)) {
+            continue;
+        }
+
+        // available_externally 的函数体只给优化器内联用，不会输出代码，没有内联的调用仍然解析到原来的实现
+        if (!ast->getFunction(index).m_isOperator && getInstructionCount(*function) > kMaxInlineBodySize) {
+            function->deleteBody();
+        } else {
+            function->setLinkage(llvm::GlobalValue::AvailableExternallyLinkage);
+        }
+    }
+}
+
+
+std::unique_ptr<llvm::Module>
+irgenAndTakeOwnership(CodegenContext &context, const FlatAST &flatAST, FunctionIndex function,
+                      llvm::StringRef Suffix) {
+    if (auto *F = CodeGenerator(context, flatAST).codegenFunction(function)) {
+        F->setName(F->getName() + Suffix);
+        codegenInlineBodies(context);
+        return context.takeModule();
+    } else {
+        llvm::report_fatal_error("Couldn't compile lazily JIT'd function");
+    }
+}
+
+std::unique_ptr<llvm::Module>
+irgenAndTakeOwnership(CodegenContext &context, FunctionAST &FnAST, llvm::StringRef Suffix) {
+    FlatAST flatAST;
+    FunctionIndex function = flatAST.addFunction(&FnAST);
+    return irgenAndTakeOwnership(context, flatAST, function, Suffix);
+}
+
+
+llvm::Value *logErrorV(const char *str) {
+    fprintf(stderr, "LogErrorV: %s\n", str);
+
+    return nullptr;
+}
+
+
+CodeGenerator::CodeGenerator(CodegenContext &context, const FlatAST &ast)
+        : m_context(context), m_ast(ast), m_typeInference(ast), m_floatMode(float_default),
+          m_conditionNode(kNoNode) {
+
+}
+
+llvm::Value* CodeGenerator::codegen(NodeIndex root) {
+    // 不使用递归，还没有生成完的节点放在 m_frames 上
+    // 节点分几步生成，需要子节点的值时先把子节点交出来，子节点生成完后带着它的值回到这个节点的下一步
+    size_t frameBase = m_frames.size();
+    NodeIndex node = root;
+    llvm::Value *value = nullptr;
+
+    while (1) {
+        if (node != kNoNode) {
+            // 当前支配域中已经生成过的共享节点直接使用原来的值
+            // 叶子节点直接生成，其余的节点入栈，从第一步开始
+            if (llvm::Value *sharedValue = this->findSharedValue(node)) {
+                value = sharedValue;
+            } else {
+                switch (m_ast.getKind(node)) {
+                    case ast_number: {
+                        value = this->codegenNumber(node);
+                        this->rememberSharedValue(node, value);
+                    } break;
+
+                    case ast_variable: {
+                        value = this->codegenVariable(node);
+                        this->rememberSharedValue(node, value);
+                    } break;
+
+                    default: {
+                        m_frames.push_back(CodegenFrame(node));
+                        m_frames.back().m_asCondition = node == m_conditionNode;
+                    } break;
+                }
+            }
+            node = kNoNode;
+            m_conditionNode = kNoNode;
+        }
+
+        if (m_frames.size() == frameBase) {
+            return value;
+        }
+
+        // 栈顶节点走下一步，value 是它上一步交出的子节点的值
+        CodegenFrame &frame = m_frames.back();
+        bool finished = true;
+        switch (m_ast.getKind(frame.m_node)) {
+            case ast_unary: {
+                finished = this->codegenUnary(frame, value, node);
+            } break;
+
+            case ast_binary: {
+                finished = this->codegenBinary(frame, value, node);
+            } break;
+
+            case ast_call: {
+                finished = this->codegenCall(frame, value, node);
+            } break;
+
+            case ast_if: {
+                finished = this->codegenIf(frame, value, node);
+            } break;
+
+            case ast_for: {
+                finished = this->codegenFor(frame, value, node);
+            } break;
+
+            case ast_var: {
+                finished = this->codegenVar(frame, value, node);
+            } break;
+
+            default: {
+                value = logErrorV("Unknown expression kind");
+            } break;
+        }
+
+        if (finished) {
+            this->rememberSharedValue(frame.m_node, value);
+            m_frames.pop_back();
+        }
+    }
+}
+
+void CodeGenerator::pushSharedScope() {
+    m_sharedScopes.push_back(m_sharedOrder.size());
+}
+
+void CodeGenerator::popSharedScope() {
+    size_t scopeBegin = m_sharedScopes.back();
+    m_sharedScopes.pop_back();
+
+    while (m_sharedOrder.size() > scopeBegin) {
+        m_sharedValues.erase(m_sharedOrder.back());
+        m_sharedOrder.pop_back();
+    }
+}
+
+void CodeGenerator::invalidateSharedValues() {
+    if (m_sharedOrder.empty()) {
+        return;
+    }
+
+    m_sharedValues.clear();
+    m_sharedOrder.clear();
+    std::fill(m_sharedScopes.begin(), m_sharedScopes.end(), 0);
+}
+
+llvm::Value *CodeGenerator::findSharedValue(NodeIndex node) {
+    if (!m_ast.isShared(node)) {
+        return nullptr;
+    }
+
+    auto found = m_sharedValues.find(node);
+    return found != m_sharedValues.end() ? found->second : nullptr;
+}
+
+void CodeGenerator::rememberSharedValue(NodeIndex node, llvm::Value *value) {
+    // 作为条件生成的 i1 不能给其他地方当作值使用
+    if (value && m_ast.isShared(node) && !value->getType()->isIntegerTy(1)) {
+        m_sharedValues[node] = value;
+        m_sharedOrder.push_back(node);
+    }
+}
+
+void CodeGenerator::collectTailCalls(NodeIndex body) {
+    m_tailCalls.clear();
+
+    // 不使用递归，if 的两个分支都放进 pending 继续看
+    llvm::SmallVector<NodeIndex, 8> pending;
+    pending.push_back(body);
+    while (!pending.empty()) {
+        NodeIndex node = pending.pop_back_val();
+        switch (m_ast.getKind(node)) {
+            case ast_call: {
+                m_tailCalls.push_back(node);
+            } break;
+            case ast_if: {
+                pending.push_back(m_ast.getSecondChild(node));
+                pending.push_back(m_ast.getThirdChild(node));
+            } break;
+            case ast_var: {
+                pending.push_back(m_ast.getThirdChild(node));
+            } break;
+            default: break;
+        }
+    }
+}
+
+llvm::Type *CodeGenerator::getType(ValueType type) {
+    return m_context.getType(type, m_floatMode);
+}
+
+llvm::Value *CodeGenerator::convertValue(llvm::Value *value, llvm::Type *type) {
+    llvm::Type *valueType = value->getType();
+    if (valueType == type) {
+        return value;
+    }
+
+    if (type->isVectorTy()) {
+        if (!valueType->isVectorTy()) {
+            llvm::Value *element = this->convertValue(value, type->getVectorElementType());
+            return m_context.m_builder.CreateVectorSplat(type->getVectorNumElements(), element, "splattmp");
+        }
+        if (valueType->getVectorNumElements() != type->getVectorNumElements()) {
+            return logErrorV("Vector width mismatch");
+        }
+
+        // float 和 double 的向量之间
+        return m_context.m_builder.CreateFPCast(value, type, "convtmp");
+    }
+    if (valueType->isVectorTy()) {
+        return logErrorV("Vector value used where a scalar is expected");
+    }
+
+    // 常量的转换会被 IRBuilder 直接折叠成新的常量
+    if (type->isIntegerTy()) {
+        return m_context.m_builder.CreateFPToSI(value, type, "convtmp");
+    }
+    if (value->getType()->isIntegerTy()) {
+        return m_context.m_builder.CreateSIToFP(value, type, "convtmp");
+    }
+
+    // float 和 double 之间
+    return m_context.m_builder.CreateFPCast(value, type, "convtmp");
+}
+
+llvm::Value *CodeGenerator::convertCallResult(llvm::Value *value) {
+    if (value->getType()->isIntegerTy()) {
+        return value;
+    }
+
+    llvm::Type *floatType = this->getType(type_double);
+    if (value->getType()->isVectorTy()) {
+        return this->convertValue(value, llvm::VectorType::get(floatType, value->getType()->getVectorNumElements()));
+    }
+    return this->convertValue(value, floatType);
+}
+
+llvm::Value *CodeGenerator::convertCondition(llvm::Value *value, const llvm::Twine &name) {
+    if (value->getType()->isIntegerTy(1)) {
+        return value;
+    }
+
+    if (value->getType()->isVectorTy()) {
+        return logErrorV("Vector value cannot be used as a condition");
+    }
+
+    if (value->getType()->isIntegerTy()) {
+        return m_context.m_builder.CreateICmpNE(value, llvm::ConstantInt::get(value->getType(), 0), name);
+    }
+
+    return m_context.m_builder.CreateFCmpONE(value, llvm::ConstantFP::get(value->getType(), 0.0), name);
+}
+
+llvm::Value *CodeGenerator::convertBoolean(llvm::Value *condition, llvm::Value *typeSource) {
+    if (typeSource->getType()->isIntegerTy()) {
+        // 整数比较的结果是 i64 的 0/1
+        return m_context.m_builder.CreateZExt(condition, llvm::Type::getInt64Ty(m_context.m_llvmContext), "booltmp");
+    }
+
+    // 这一步将 bool 对象 0/1 转换为浮点数 0.0/1.0
+    return m_context.m_builder.CreateUIToFP(condition, this->getType(type_double), "booltmp");
+}
+
+ValueType CodeGenerator::getReturnType(Symbol name) {
+    llvm::Function *function = this->findFunction(name);
+    if (!function) {
+        return type_auto;
+    }
+
+    llvm::Type *returnType = function->getReturnType();
+    if (returnType->isVectorTy()) {
+        return returnType->getVectorNumElements() == 2 ? type_vec2 : type_vec4;
+    }
+    return returnType->isIntegerTy() ? type_i64 : type_double;
+}
+
+llvm::Function *CodeGenerator::getMathIntrinsic(FunctionIndex function, llvm::FunctionType *functionType) {
+    const FlatFunction &prototype = m_ast.getFunction(function);
+    if (prototype.m_body != kNoNode || prototype.m_isOperator) {
+        return nullptr;
+    }
+
+    // 参数和返回值必须都是同一种浮点数或者浮点数的向量，内建函数按这个类型重载
+    llvm::Type *type = functionType->getReturnType();
+    if (!type->isFPOrFPVectorTy()) {
+        return nullptr;
+    }
+    for (llvm::Type *paramType : functionType->params()) {
+        if (paramType != type) {
+            return nullptr;
+        }
+    }
+
+    llvm::StringRef name = kIdentifierTable.getString(prototype.m_name);
+    for (const auto &intrinsic : kMathIntrinsics) {
+        if (name == intrinsic.m_name && functionType->getNumParams() == intrinsic.m_argCount) {
+            return llvm::Intrinsic::getDeclaration(m_context.getModule(), intrinsic.m_id, type);
+        }
+    }
+
+    return nullptr;
+}
+
+llvm::FunctionType *CodeGenerator::getFunctionType(FunctionIndex function) {
+    const FlatFunction &prototype = m_ast.getFunction(function);
+    llvm::SmallVector<llvm::Type *, 8> argTypes;
+    for (unsigned i = 0; i < prototype.m_argCount; ++i) {
+        argTypes.push_back(m_context.getType(m_ast.getArgType(function, i), prototype.m_floatMode));
+    }
+
+    return llvm::FunctionType::get(m_context.getType(prototype.m_returnType, prototype.m_floatMode), argTypes, false);
+}
+
+llvm::Value *CodeGenerator::codegenNumber(NodeIndex node) {
+    // 记录调试信息
+    m_context.emitLocation(&m_ast.getLocation(node));
+
+    if (m_ast.getNumberType(node) == type_i64) {
+        return llvm::ConstantInt::get(llvm::Type::getInt64Ty(m_context.m_llvmContext), (uint64_t)m_ast.getInteger(node),
+                                      true);
+    }
+    return llvm::ConstantFP::get(this->getType(type_double), m_ast.getNumber(node));
+}
+
+llvm::Value* CodeGenerator::codegenVariable(NodeIndex node) {
+    Symbol name = m_ast.getSymbol(node);
+    llvm::Value *value = m_context.m_namedValues.lookup(name);
+    if (!value) {
+        return logErrorV("Unknown variable name");
+    }
+
+    // 记录调试信息
+    m_context.emitLocation(&m_ast.getLocation(node));
+
+    return m_context.m_builder.CreateLoad(value, kIdentifierTable.getString(name));
+}
+
+bool CodeGenerator::codegenUnary(CodegenFrame &frame, llvm::Value *&value, NodeIndex &child) {
+    NodeIndex node = frame.m_node;
+    char op = m_ast.getOperator(node);
+    if (frame.m_stage == 0) {
+        // 根据一元运算符的名字查找对应的函数，没有定义 unary! 时是内建的 !
+        frame.m_function = this->findFunction(getOperatorSymbol(false, op));
+        frame.m_stage = 1;
+        child = m_ast.getFirstChild(node);
+        if (!frame.m_function && op == '!' && frame.m_asCondition) {
+            m_conditionNode = child;
+        }
+        return false;
+    }
+
+    llvm::Value *operandValue = value;
+    if (!operandValue) {
+        return true;
+    }
+
+    // 记录调试信息
+    m_context.emitLocation(&m_ast.getLocation(node));
+
+    llvm::Function *function = frame.m_function;
+    if (!function && op == '!') {
+        llvm::Value *condition = this->convertCondition(operandValue, "nottmp");
+        if (!condition) {
+            value = nullptr;
+            return true;
+        }
+        llvm::Value *notValue = m_context.m_builder.CreateNot(condition, "nottmp");
+        value = frame.m_asCondition ? notValue : this->convertBoolean(notValue, operandValue);
+        return true;
+    }
+
+    if (!function) {
+        value = logErrorV("Unknown unary operator");
+        return true;
+    }
+
+    if (function->arg_size() == 1) {
+        operandValue = this->convertValue(operandValue, function->getFunctionType()->getParamType(0));
+        if (!operandValue) {
+            value = nullptr;
+            return true;
+        }
+    }
+    value = this->convertCallResult(m_context.m_builder.CreateCall(function, operandValue, "unop"));
+    return true;
+}
+
+bool CodeGenerator::codegenBinary(CodegenFrame &frame, llvm::Value *&value, NodeIndex &child) {
+    NodeIndex node = frame.m_node;
+    NodeIndex lhs = m_ast.getFirstChild(node);
+    char op = m_ast.getOperator(node);
+    // && 和 || 只在需要时才计算右边，单独生成
+    if (op == (char)token_and || op == (char)token_or) {
+        return this->codegenLogical(frame, value, child);
+    }
+
+    switch (frame.m_stage) {
+        case 0: {
+            // 记录调试信息
+            m_context.emitLocation(&m_ast.getLocation(node));
+
+            frame.m_stage = 1;
+            child = lhs;
+        } return false;
+
+        case 1: {
+            // 左值生成失败时也生成右值，和原来的递归版本报出同样的错误
+            frame.m_values[0] = value;
+            frame.m_stage = 2;
+            child = m_ast.getSecondChild(node);
+        } return false;
+
+        default:
+            break;
+    }
+
+    llvm::Value *lhsValue = frame.m_values[0];
+    llvm::Value *rhsValue = value;
+    value = nullptr;
+    if (!lhsValue || !rhsValue) {
+        return true;
+    }
+
+    // 赋值是一个特殊的二元运算符，因其左值是不需要计算的
+    if (op == '=') {
+        // 赋值的左值应该是一个变量，而不是需要计算的表达式
+        if (m_ast.getKind(lhs) != ast_variable) {
+            value = logErrorV("Destination of '=' must be a variable");
+            return true;
+        }
+
+        // 获取左值的那个变量
+        llvm::AllocaInst *variable = m_context.m_namedValues.lookup(m_ast.getSymbol(lhs));
+        if (!variable) {
+            value = logErrorV("Unknown variable name");
+            return true;
+        }
+
+        // 设置左值的变量为右值的计算结果，右值先转换成变量的类型
+        rhsValue = this->convertValue(rhsValue, variable->getAllocatedType());
+        if (!rhsValue) {
+            return true;
+        }
+        m_context.m_builder.CreateStore(rhsValue, variable);
+        this->invalidateSharedValues();
+
+        // 整体运算符的值是右值的结算结果
+        value = rhsValue;
+        return true;
+    }
+
+    // 定义了 binary> 时 > 按重写的运算符调用
+    bool isComparison = op == '<' || op == (char)token_less_equal || op == (char)token_greater_equal ||
+                        op == (char)token_equal || op == (char)token_not_equal ||
+                        (op == '>' && !this->findFunction(getOperatorSymbol(true, '>')));
+
+    // 有一边是向量时按分量运算
+    if (lhsValue->getType()->isVectorTy() || rhsValue->getType()->isVectorTy()) {
+        if (op == '+' || op == '-' || op == '*') {
+            value = this->codegenVectorArithmetic(op, lhsValue, rhsValue);
+            return true;
+        }
+        if (isComparison) {
+            value = logErrorV("Vector values cannot be compared");
+            return true;
+        }
+    }
+
+    // 内建运算符两边都是 i64 时做整数运算，否则 i64 的一边先转换成当前精度的浮点数
+    bool isInteger = lhsValue->getType()->isIntegerTy() && rhsValue->getType()->isIntegerTy();
+    llvm::Type *floatType = this->getType(type_double);
+    if (!isInteger && (op == '+' || op == '-' || op == '*' || isComparison)) {
+        lhsValue = this->convertValue(lhsValue, floatType);
+        rhsValue = this->convertValue(rhsValue, floatType);
+    }
+
+    if (isComparison) {
+        value = this->codegenComparison(op, lhsValue, rhsValue, frame.m_asCondition);
+        return true;
+    }
+
+    switch (op) {
+        case '+': {
+            if (isInteger) {
+                value = m_context.m_builder.CreateAdd(lhsValue, rhsValue, "addtmp");
+            } else {
+                value = m_context.m_builder.CreateFAdd(lhsValue, rhsValue, "addtmp");
+            }
+        } break;
+
+        case '-': {
+            if (isInteger) {
+                value = m_context.m_builder.CreateSub(lhsValue, rhsValue, "subtmp");
+            } else {
+                value = m_context.m_builder.CreateFSub(lhsValue, rhsValue, "subtmp");
+            }
+        } break;
+
+        case '*': {
+            if (isInteger) {
+                value = m_context.m_builder.CreateMul(lhsValue, rhsValue, "multmp");
+            } else {
+                value = m_context.m_builder.CreateFMul(lhsValue, rhsValue, "multmp");
+            }
+        } break;
+
+        default: {
+            // 如果进入这里，说明这很可能是一个重写的二元运算符
+
+            // 运算符函数
+            llvm::Function *function = this->findFunction(getOperatorSymbol(true, op));
+            if (nullptr == function) {
+                value = logErrorV("Binary operator not found!");
+                break;
+            }
+
+            // 创建函数调用 IR 代码，两边转换成运算符函数的参数类型
+            if (function->arg_size() == 2) {
+                lhsValue = this->convertValue(lhsValue, function->getFunctionType()->getParamType(0));
+                rhsValue = this->convertValue(rhsValue, function->getFunctionType()->getParamType(1));
+                if (!lhsValue || !rhsValue) {
+                    break;
+                }
+            }
+            llvm::Value *operators[] = {lhsValue, rhsValue};
+            value = this->convertCallResult(m_context.m_builder.CreateCall(function, llvm::makeArrayRef(operators), "binop"));
+        } break;
+    }
+
+    return true;
+}
+
+llvm::Value *CodeGenerator::codegenVectorArithmetic(char op, llvm::Value *lhsValue, llvm::Value *rhsValue) {
+    // 两边都是向量时宽度必须相同，由 convertValue 检查
+    unsigned width = (lhsValue->getType()->isVectorTy() ? lhsValue : rhsValue)->getType()->getVectorNumElements();
+    llvm::Type *vectorType = llvm::VectorType::get(this->getType(type_double), width);
+    lhsValue = this->convertValue(lhsValue, vectorType);
+    rhsValue = lhsValue ? this->convertValue(rhsValue, vectorType) : nullptr;
+    if (!rhsValue) {
+        return nullptr;
+    }
+
+    switch (op) {
+        case '+': return m_context.m_builder.CreateFAdd(lhsValue, rhsValue, "addtmp");
+        case '-': return m_context.m_builder.CreateFSub(lhsValue, rhsValue, "subtmp");
+        default: return m_context.m_builder.CreateFMul(lhsValue, rhsValue, "multmp");
+    }
+}
+
+llvm::Value *CodeGenerator::codegenComparison(char op, llvm::Value *lhs, llvm::Value *rhs, bool asCondition) {
+    llvm::IRBuilder<> &builder = m_context.m_builder;
+    llvm::Value *condition;
+    if (lhs->getType()->isIntegerTy()) {
+        switch (op) {
+            case '<': condition = builder.CreateICmpSLT(lhs, rhs, "cmptmp"); break;
+            case '>': condition = builder.CreateICmpSGT(lhs, rhs, "cmptmp"); break;
+            case (char)token_less_equal: condition = builder.CreateICmpSLE(lhs, rhs, "cmptmp"); break;
+            case (char)token_greater_equal: condition = builder.CreateICmpSGE(lhs, rhs, "cmptmp"); break;
+            case (char)token_equal: condition = builder.CreateICmpEQ(lhs, rhs, "cmptmp"); break;
+            default: condition = builder.CreateICmpNE(lhs, rhs, "cmptmp"); break;
+        }
+    } else {
+        // 和原来的 < 一样，有 NaN 时 < > <= >= != 为真
+        switch (op) {
+            case '<': condition = builder.CreateFCmpULT(lhs, rhs, "cmptmp"); break;
+            case '>': condition = builder.CreateFCmpUGT(lhs, rhs, "cmptmp"); break;
+            case (char)token_less_equal: condition = builder.CreateFCmpULE(lhs, rhs, "cmptmp"); break;
+            case (char)token_greater_equal: condition = builder.CreateFCmpUGE(lhs, rhs, "cmptmp"); break;
+            case (char)token_equal: condition = builder.CreateFCmpOEQ(lhs, rhs, "cmptmp"); break;
+            default: condition = builder.CreateFCmpUNE(lhs, rhs, "cmptmp"); break;
+        }
+    }
+
+    // 作为 if 和 for 的条件时直接用 i1 跳转，不再转换成数值再和 0 比较
+    return asCondition ? condition : this->convertBoolean(condition, lhs);
+}
+
+/*
+ * 短路求值的 && 和 || 结构如下，左边已经能决定结果时不计算右边
+ *       lhs ->   rhs ->
+ * entry                 logiccont
+ *       ------------>
+ */
+bool CodeGenerator::codegenLogical(CodegenFrame &frame, llvm::Value *&value, NodeIndex &child) {
+    NodeIndex node = frame.m_node;
+    bool isAnd = m_ast.getOperator(node) == (char)token_and;
+    // m_values[0] 是左边的值，m_blocks 中依次是左边结束的代码块、rhs、logiccont 三个代码块
+    switch (frame.m_stage) {
+        case 0: {
+            // 记录调试信息
+            m_context.emitLocation(&m_ast.getLocation(node));
+
+            frame.m_stage = 1;
+            child = m_ast.getFirstChild(node);
+            if (frame.m_asCondition) {
+                m_conditionNode = child;
+            }
+        } return false;
+
+        case 1: {
+            if (!value) {
+                return true;
+            }
+            frame.m_values[0] = value;
+            llvm::Value *condition = this->convertCondition(value, "lhscond");
+            if (!condition) {
+                value = nullptr;
+                return true;
+            }
+
+            frame.m_function = m_context.m_builder.GetInsertBlock()->getParent();
+            frame.m_blocks[0] = m_context.m_builder.GetInsertBlock();
+            frame.m_blocks[1] = llvm::BasicBlock::Create(m_context.m_llvmContext, "rhs", frame.m_function);
+            frame.m_blocks[2] = llvm::BasicBlock::Create(m_context.m_llvmContext, "logiccont");
+
+            // && 左边为假、|| 左边为真时直接得到结果
+            if (isAnd) {
+                m_context.m_builder.CreateCondBr(condition, frame.m_blocks[1], frame.m_blocks[2]);
+            } else {
+                m_context.m_builder.CreateCondBr(condition, frame.m_blocks[2], frame.m_blocks[1]);
+            }
+
+            // 右边不一定执行，它生成的值不能给后面的代码复用
+            m_context.m_builder.SetInsertPoint(frame.m_blocks[1]);
+            this->pushSharedScope();
+            frame.m_stage = 2;
+            child = m_ast.getSecondChild(node);
+            if (frame.m_asCondition) {
+                m_conditionNode = child;
+            }
+        } return false;
+
+        default:
+            break;
+    }
+
+    this->popSharedScope();
+    llvm::Value *rhsValue = value;
+    if (!rhsValue) {
+        return true;
+    }
+
+    llvm::Value *rhsCondition = this->convertCondition(rhsValue, "rhscond");
+    if (!rhsCondition) {
+        value = nullptr;
+        return true;
+    }
+    m_context.m_builder.CreateBr(frame.m_blocks[2]);
+    // 右边的代码块可能已经改变，phi 要用结束时的代码块
+    frame.m_blocks[1] = m_context.m_builder.GetInsertBlock();
+
+    frame.m_function->getBasicBlockList().push_back(frame.m_blocks[2]);
+    m_context.m_builder.SetInsertPoint(frame.m_blocks[2]);
+    llvm::PHINode *phiNode = m_context.m_builder.CreatePHI(llvm::Type::getInt1Ty(m_context.m_llvmContext), 2,
+                                                           "logictmp");
+    phiNode->addIncoming(m_context.m_builder.getInt1(!isAnd), frame.m_blocks[0]);
+    phiNode->addIncoming(rhsCondition, frame.m_blocks[1]);
+
+    if (frame.m_asCondition) {
+        value = phiNode;
+    } else if (frame.m_values[0]->getType()->isIntegerTy() && rhsValue->getType()->isIntegerTy()) {
+        value = this->convertBoolean(phiNode, rhsValue);
+    } else {
+        value = m_context.m_builder.CreateUIToFP(phiNode, this->getType(type_double), "booltmp");
+    }
+    return true;
+}
+
+bool CodeGenerator::codegenCall(CodegenFrame &frame, llvm::Value *&value, NodeIndex &child) {
+    NodeIndex node = frame.m_node;
+    llvm::ArrayRef<NodeIndex> args = m_ast.getCallArgs(node);
+
+    if (frame.m_stage == 0) {
+        // 记录调试信息
+        m_context.emitLocation(&m_ast.getLocation(node));
+
+        // 取的要调用的函数，没有这个函数时再看是不是内建函数
+        llvm::Function *calleeFunc = this->findFunction(m_ast.getSymbol(node));
+        BuiltinFunction builtin = calleeFunc ? builtin_none : getBuiltinFunction(m_ast.getSymbol(node));
+        if (!calleeFunc && builtin == builtin_none) {
+            value = logErrorV("Unknown function referenced");
+            return true;
+        }
+
+        if ((calleeFunc ? calleeFunc->arg_size() : getBuiltinArgCount(builtin)) != args.size()) {
+            value = logErrorV("Incorrect # arguments passed");
+            return true;
+        }
+
+        frame.m_function = calleeFunc;
+        frame.m_listBegin = (unsigned)m_argValues.size();
+    } else {
+        // 将各个参数对应设置上，转换成参数的类型，内建函数的参数由 codegenBuiltin 自己转换
+        if (value && frame.m_function) {
+            value = this->convertValue(value, frame.m_function->getFunctionType()->getParamType(frame.m_stage - 1));
+        }
+        if (!value) {
+            m_argValues.resize(frame.m_listBegin);
+            return true;
+        }
+        m_argValues.push_back(value);
+    }
+
+    // m_stage 是已经生成的参数个数
+    if (frame.m_stage < args.size()) {
+        child = args[frame.m_stage++];
+        return false;
+    }
+
+    // 创建函数调用的 llvm IR 代码
+    llvm::ArrayRef<llvm::Value *> argsValue = llvm::makeArrayRef(m_argValues).slice(frame.m_listBegin);
+    if (frame.m_function) {
+        // 语言中没有指针，被调用的函数不会访问调用方栈上的变量，尾部位置的调用标记为 tail，之后可以消除尾递归
+        llvm::CallInst *call = m_context.m_builder.CreateCall(frame.m_function, argsValue, "calltmp");
+        if (std::find(m_tailCalls.begin(), m_tailCalls.end(), node) != m_tailCalls.end()) {
+            call->setTailCall();
+        }
+        value = this->convertCallResult(call);
+    } else {
+        value = this->codegenBuiltin(getBuiltinFunction(m_ast.getSymbol(node)), argsValue);
+    }
+    m_argValues.resize(frame.m_listBegin);
+
+    return true;
+}
+
+llvm::Value *CodeGenerator::codegenBuiltin(BuiltinFunction builtin, llvm::ArrayRef<llvm::Value *> args) {
+    llvm::IRBuilder<> &builder = m_context.m_builder;
+    llvm::Type *floatType = this->getType(type_double);
+
+    if (builtin == builtin_vec2 || builtin == builtin_vec4) {
+        // 分量都是常量时 IRBuilder 直接折叠成常量向量
+        llvm::Value *vector = llvm::UndefValue::get(llvm::VectorType::get(floatType, (unsigned)args.size()));
+        for (unsigned i = 0; i < args.size(); ++i) {
+            llvm::Value *element = this->convertValue(args[i], floatType);
+            if (!element) {
+                return nullptr;
+            }
+            vector = builder.CreateInsertElement(vector, element, builder.getInt32(i), "vectmp");
+        }
+        return vector;
+    }
+
+    llvm::Value *vector = args[0];
+    if (!vector->getType()->isVectorTy()) {
+        return logErrorV("Expected a vector argument");
+    }
+    unsigned width = vector->getType()->getVectorNumElements();
+
+    if (builtin == builtin_lane || builtin == builtin_setlane) {
+        llvm::Value *index = this->convertValue(args[1], builder.getInt64Ty());
+        if (!index) {
+            return nullptr;
+        }
+        // 常量下标越界时报错，运行时越界的结果是未定义的
+        auto constantIndex = llvm::dyn_cast<llvm::ConstantInt>(index);
+        if (constantIndex && constantIndex->getZExtValue() >= width) {
+            return logErrorV("Vector lane index out of range");
+        }
+
+        if (builtin == builtin_lane) {
+            return builder.CreateExtractElement(vector, index, "lanetmp");
+        }
+        llvm::Value *element = this->convertValue(args[2], vector->getType()->getVectorElementType());
+        if (!element) {
+            return nullptr;
+        }
+        return builder.CreateInsertElement(vector, element, index, "setlanetmp");
+    }
+
+    // 归约时把两半按分量合并
+    auto combine = [&](llvm::Value *low, llvm::Value *high) -> llvm::Value * {
+        switch (builtin) {
+            case builtin_hsum: return builder.CreateFAdd(low, high, "hsumtmp");
+            case builtin_hmin: return builder.CreateSelect(builder.CreateFCmpOLT(low, high), low, high, "hmintmp");
+            default: return builder.CreateSelect(builder.CreateFCmpOGT(low, high), low, high, "hmaxtmp");
+        }
+    };
+
+    // 宽度大于 2 时先用 shufflevector 取出高低两半，每一步宽度减半，只需要 log2(n) 次向量运算
+    while (width > 2) {
+        width /= 2;
+        llvm::SmallVector<uint32_t, 4> lowMask;
+        llvm::SmallVector<uint32_t, 4> highMask;
+        for (unsigned i = 0; i < width; ++i) {
+            lowMask.push_back(i);
+            highMask.push_back(width + i);
+        }
+
+        llvm::Value *undef = llvm::UndefValue::get(vector->getType());
+        llvm::Value *low = builder.CreateShuffleVector(
+                vector, undef, llvm::ConstantDataVector::get(m_context.m_llvmContext, lowMask), "lowtmp");
+        llvm::Value *high = builder.CreateShuffleVector(
+                vector, undef, llvm::ConstantDataVector::get(m_context.m_llvmContext, highMask), "hightmp");
+        vector = combine(low, high);
+    }
+
+    return combine(builder.CreateExtractElement(vector, builder.getInt32(0), "lanetmp"),
+                   builder.CreateExtractElement(vector, builder.getInt32(1), "lanetmp"));
+}
+
+/*
+ * 分支语句 llvm IR 代码结构如下
+ *       True ->    then ->
+ * entry                    ifcont
+ *       False ->   else ->
+ * llvm 会使用 SSA 机制，即静态单赋值，意思是所有变量只能被复制一次，便于后期代码优化
+ * 这样，就需要 ifcont 来根据上一步运行的是 then 还是 else 来分别处理后续的赋值步骤
+ */
+bool CodeGenerator::codegenIf(CodegenFrame &frame, llvm::Value *&value, NodeIndex &child) {
+    NodeIndex node = frame.m_node;
+    // m_blocks 中依次是 then else ifcont 三个代码块
+    switch (frame.m_stage) {
+        case 0: {
+            // 记录调试信息
+            m_context.emitLocation(&m_ast.getLocation(node));
+
+            frame.m_stage = 1;
+            child = m_ast.getFirstChild(node);
+            m_conditionNode = child;
+        } return false;
+
+        case 1: {
+            llvm::Value *conditionValue = value;
+            if (!conditionValue) {
+                return true;
+            }
+
+            // 作为条件表达式，我们需要把它的值转换为 bool 类型，比较运算直接就是 bool，其余的值和 0.0 比较
+            conditionValue = this->convertCondition(conditionValue, "ifcondition");
+            if (!conditionValue) {
+                value = nullptr;
+                return true;
+            }
+
+            // 当前分支语句的总函数
+            llvm::Function *function = m_context.m_builder.GetInsertBlock()->getParent();
+            frame.m_function = function;
+
+            // 分别创建 the else ifcont 的代码块，此时还没有向其中添加真是的 IR 代码
+            // 第一句创建 thenBlock 时顺便将 thenBlock 挂到了 function 上
+            frame.m_blocks[0] = llvm::BasicBlock::Create(m_context.m_llvmContext, "then", function);
+            frame.m_blocks[1] = llvm::BasicBlock::Create(m_context.m_llvmContext, "else");
+            frame.m_blocks[2] = llvm::BasicBlock::Create(m_context.m_llvmContext, "ifcont");
+
+            // 当前函数的插入点上，插入执行分支语句的代码
+            m_context.m_builder.CreateCondBr(conditionValue, frame.m_blocks[0], frame.m_blocks[1]);
+
+            // 给 then 代码块添加 IR 代码
+            m_context.m_builder.SetInsertPoint(frame.m_blocks[0]);
+            this->pushSharedScope();
+            frame.m_stage = 2;
+            child = m_ast.getSecondChild(node);
+        } return false;
+
+        case 2: {
+            this->popSharedScope();
+            if (!value) {
+                return true;
+            }
+            frame.m_values[0] = value;
+
+            // then 代码块完成后运行 mergeBlock
+            m_context.m_builder.CreateBr(frame.m_blocks[2]);
+            // 此时 then 代码块的内容已经改变了，后边 phi 还要用到它，所以更新一下
+            frame.m_blocks[0] = m_context.m_builder.GetInsertBlock();
+
+            // 将 elseBlock 挂到 function 上
+            frame.m_function->getBasicBlockList().push_back(frame.m_blocks[1]);
+            // 给 else 代码块添加 IR 代码
+            m_context.m_builder.SetInsertPoint(frame.m_blocks[1]);
+            this->pushSharedScope();
+            frame.m_stage = 3;
+            child = m_ast.getThirdChild(node);
+        } return false;
+
+        default:
+            break;
+    }
+
+    this->popSharedScope();
+    llvm::Value *elseValue = value;
+    if (!elseValue) {
+        return true;
+    }
+
+    // 两个分支都是 i64 时整个 if 是 i64，有一边是向量时是向量，否则都转换成当前精度的浮点数
+    llvm::Value *thenValue = frame.m_values[0];
+    llvm::Type *phiType = thenValue->getType();
+    if (elseValue->getType() != phiType) {
+        if (elseValue->getType()->isVectorTy()) {
+            phiType = elseValue->getType();
+        } else if (!phiType->isVectorTy()) {
+            phiType = this->getType(type_double);
+        }
+        elseValue = this->convertValue(elseValue, phiType);
+        if (!elseValue) {
+            value = nullptr;
+            return true;
+        }
+    }
+
+    // else 代码块完成后运行 mergeBlock
+    m_context.m_builder.CreateBr(frame.m_blocks[2]);
+    // 此时 else 代码块的内容已经改变了，后边 phi 还要用到它，所以更新一下
+    frame.m_blocks[1] = m_context.m_builder.GetInsertBlock();
+
+    // then 代码块已经结束，需要转换时插在它最后的跳转之前
+    if (thenValue->getType() != phiType) {
+        llvm::DebugLoc location = m_context.m_builder.getCurrentDebugLocation();
+        m_context.m_builder.SetInsertPoint(frame.m_blocks[0]->getTerminator());
+        thenValue = this->convertValue(thenValue, phiType);
+        m_context.m_builder.SetCurrentDebugLocation(location);
+        if (!thenValue) {
+            value = nullptr;
+            return true;
+        }
+    }
+
+    // 给 mergeBlock 添加 IR 代码
+    frame.m_function->getBasicBlockList().push_back(frame.m_blocks[2]);
+    m_context.m_builder.SetInsertPoint(frame.m_blocks[2]);
+    // 使用 PHI 创建分支语句最后的 IR 代码
+    llvm::PHINode *phiNode = m_context.m_builder.CreatePHI(phiType, 2, "iftmp");
+    phiNode->addIncoming(thenValue, frame.m_blocks[0]);
+    phiNode->addIncoming(elseValue, frame.m_blocks[1]);
+
+    value = phiNode;
+    return true;
+}
+
+/*
+ * 生成 var 定义的一个 type 类型的变量，并赋上初值
+ */
+bool CodeGenerator::bindVariable(llvm::Function *function, Symbol varName, llvm::Type *type, llvm::Value *initValue) {
+    initValue = this->convertValue(initValue, type);
+    if (!initValue) {
+        return false;
+    }
+
+    // 生成变量
+    llvm::AllocaInst *alloca = m_context.createEntryBlockAlloca(function, varName, type);
+    // 赋初值
+    m_context.m_builder.CreateStore(initValue, alloca);
+
+    // 记录在当前作用域中，varName 名字的变量的内存，外层的同名变量被覆盖
+    m_context.m_namedValues.bind(varName, alloca);
+    return true;
+}
+
+llvm::Function *CodeGenerator::findFunction(Symbol name) {
+    if (llvm::Function *function = m_context.getFunction(name)) {
+        return function;
+    }
+
+    const FlatAST *externalAST;
+    FunctionIndex external;
+    if (!m_context.findExternalFunction(name, externalAST, external)) {
+        return nullptr;
+    }
+
+    // 声明不改变当前的插入点和调试位置
+    return CodeGenerator(m_context, *externalAST).codegenPrototype(external);
+}
+
+bool CodeGenerator::codegenVar(CodegenFrame &frame, llvm::Value *&value, NodeIndex &child) {
+    NodeIndex node = frame.m_node;
+    unsigned count = m_ast.getVarCount(node);
+    // 下一个要生成的变量，m_stage 为 i + 1 时正在等第 i 个变量的初值，为 count + 1 时正在等 body
+    unsigned next;
+
+    if (frame.m_stage == 0) {
+        // 当前函数
+        frame.m_function = m_context.m_builder.GetInsertBlock()->getParent();
+
+        // 这些变量只在当前作用域中有效
+        m_context.m_namedValues.pushScope();
+        next = 0;
+    } else if (frame.m_stage <= count) {
+        if (!value || !this->bindVariable(frame.m_function, m_ast.getVarName(node, frame.m_stage - 1),
+                                          this->getType(m_typeInference.getBindingType(node, frame.m_stage - 1)),
+                                          value)) {
+            m_context.m_namedValues.popScope();
+            value = nullptr;
+            return true;
+        }
+        this->invalidateSharedValues();
+        next = frame.m_stage;
+    } else {
+        // 当前作用域结束之后，恢复旧的同名变量，body 的值就是整个 var 的值
+        m_context.m_namedValues.popScope();
+        this->invalidateSharedValues();
+        return true;
+    }
+
+    for (; next < count; ++next) {
+        // 先插入右值代码，再在函数作用域中生成左值变量
+        // 比如 var a = a 这种情况，
+        // 不先执行右值计算，a 值会使用错误，并且再也无法访问外边的 a 值
+        NodeIndex init = m_ast.getVarInit(node, next);
+        if (init != kNoNode) {
+            frame.m_stage = next + 1;
+            child = init;
+            return false;
+        }
+
+        // 如果没有写右值，那么默认是 0.0
+        llvm::Type *type = this->getType(m_typeInference.getBindingType(node, next));
+        this->bindVariable(frame.m_function, m_ast.getVarName(node, next), type, llvm::Constant::getNullValue(type));
+        this->invalidateSharedValues();
+    }
+
+    // 记录调试信息
+    m_context.emitLocation(&m_ast.getLocation(node));
+
+    // 现在，所有 body 用到的变量都有了，可以开始生成 body 的 IR 代码了
+    frame.m_stage = count + 1;
+    child = m_ast.getThirdChild(node);
+    return false;
+}
+
+bool CodeGenerator::codegenFor(CodegenFrame &frame, llvm::Value *&value, NodeIndex &child) {
+    NodeIndex node = frame.m_node;
+    Symbol varName = m_ast.getSymbol(node);
+    // m_values 中依次是循环变量和步进的值，m_blocks[0] 是循环的代码块
+    switch (frame.m_stage) {
+        case 0: {
+            // 当前函数
+            frame.m_function = m_context.m_builder.GetInsertBlock()->getParent();
+            // 循环的变量，类型是推断出的类型
+            frame.m_values[0] = m_context.createEntryBlockAlloca(frame.m_function, varName,
+                                                                 this->getType(m_typeInference.getBindingType(node, 0)));
+
+            // 记录调试信息
+            m_context.emitLocation(&m_ast.getLocation(node));
+
+            frame.m_stage = 1;
+            child = m_ast.getSecondChild(node);
+        } return false;
+
+        case 1: {
+            llvm::Value *startValue = value;
+            if (nullptr == startValue) {
+                return true;
+            }
+
+            // 存储循环变量的值
+            llvm::AllocaInst *alloca = static_cast<llvm::AllocaInst *>(frame.m_values[0]);
+            startValue = this->convertValue(startValue, alloca->getAllocatedType());
+            if (!startValue) {
+                value = nullptr;
+                return true;
+            }
+            m_context.m_builder.CreateStore(startValue, alloca);
+
+            frame.m_blocks[0] = llvm::BasicBlock::Create(m_context.m_llvmContext, "loop", frame.m_function);
+
+            // 当前函数插入点上，插入运行当前分支语句的代码
+            m_context.m_builder.CreateBr(frame.m_blocks[0]);
+            // 开始往循环中插入代码
+            m_context.m_builder.SetInsertPoint(frame.m_blocks[0]);
+
+            // 如果在循环中循环变量覆盖了当前作用域的变量，我们需要在循环结束后恢复那个变量，所以循环变量放在新的作用域中
+            m_context.m_namedValues.pushScope();
+            m_context.m_namedValues.bind(varName, static_cast<llvm::AllocaInst *>(frame.m_values[0]));
+            // 循环体会执行多次，循环之前生成的值在下一次循环时可能已经过期
+            this->invalidateSharedValues();
+
+            frame.m_stage = 2;
+            child = m_ast.getForBody(node);
+        } return false;
+
+        case 2:
+        case 3: {
+            if (nullptr == value) {
+                m_context.m_namedValues.popScope();
+                return true;
+            }
+
+            // 生成循环变量步进的代码
+            if (frame.m_stage == 2) {
+                NodeIndex step = m_ast.getForStep(node);
+                if (step != kNoNode) {
+                    frame.m_stage = 3;
+                    child = step;
+                    return false;
+                }
+
+                // 如果没有步进，那么步进默认为 1
+                value = llvm::ConstantInt::get(llvm::Type::getInt64Ty(m_context.m_llvmContext), 1);
+            }
+            frame.m_values[1] = value;
+
+            // 循环结束条件
+            frame.m_stage = 4;
+            child = m_ast.getForEnd(node);
+            m_conditionNode = child;
+        } return false;
+
+        default:
+            break;
+    }
+
+    llvm::Value *endCondition = value;
+    if (endCondition && endCondition->getType()->isVectorTy()) {
+        endCondition = logErrorV("Vector value cannot be used as a condition");
+    }
+    if (nullptr == endCondition) {
+        m_context.m_namedValues.popScope();
+        value = nullptr;
+        return true;
+    }
+
+    // 将循环变量的值设置为最新的
+    // 重新读取一下循环变量的值，因为 body 中可能改变了循环变量的值
+    llvm::Value *alloca = frame.m_values[0];
+    llvm::Value *curValue = m_context.m_builder.CreateLoad(alloca);
+    llvm::Value *stepValue = this->convertValue(frame.m_values[1], curValue->getType());
+    if (!stepValue) {
+        m_context.m_namedValues.popScope();
+        value = nullptr;
+        return true;
+    }
+    llvm::Value *nextValue;
+    if (curValue->getType()->isIntegerTy()) {
+        // 循环变量溢出是未定义的，标上 nsw 之后 llvm 才能算出循环次数，循环才能被向量化
+        nextValue = m_context.m_builder.CreateNSWAdd(curValue, stepValue, "nextVar");
+    } else {
+        nextValue = m_context.m_builder.CreateFAdd(curValue, stepValue, "nextVar");
+    }
+    m_context.m_builder.CreateStore(nextValue, alloca);
+    this->invalidateSharedValues();
+
+    // 创建分支语句，符合结束条件走 after block 不符合继续走 loop block
+    // 循环体至少执行一次，循环本来就是在末尾判断结束条件的形式，不需要 llvm 再做 loop rotate
+    // 前面跳到 loop 的代码块就是 preheader，after block 只从这里进入，是唯一的出口
+    llvm::BasicBlock *afterBlock = llvm::BasicBlock::Create(m_context.m_llvmContext, "afterloop", frame.m_function);
+    llvm::BranchInst *backEdge;
+    if (endCondition->getType()->isIntegerTy(1)) {
+        // 比较运算作为结束条件时直接跳转
+        backEdge = m_context.m_builder.CreateCondBr(endCondition, afterBlock, frame.m_blocks[0]);
+    } else {
+        // 循环结束条件与 true(1.0) 判断
+        if (endCondition->getType()->isIntegerTy()) {
+            endCondition = m_context.m_builder.CreateICmpNE(endCondition,
+                                                            llvm::ConstantInt::get(endCondition->getType(), 1),
+                                                            "loopcond");
+        } else {
+            endCondition = m_context.m_builder.CreateFCmpONE(endCondition,
+                                                             llvm::ConstantFP::get(endCondition->getType(), 1.0),
+                                                             "loopcond");
+        }
+        backEdge = m_context.m_builder.CreateCondBr(endCondition, frame.m_blocks[0], afterBlock);
+    }
+    backEdge->setMetadata(llvm::LLVMContext::MD_loop,
+                          m_context.createLoopID(m_ast.getLocation(node), m_ast.getForHints(node)));
+
+    // 将后边的代码添加地点放到循环结束后
+    m_context.m_builder.SetInsertPoint(afterBlock);
+
+    m_context.m_namedValues.popScope();
+
+    // for 循环作为表达式，整体对外的值永远是 0.0
+    value = llvm::Constant::getNullValue(this->getType(type_double));
+    return true;
+}
+
+llvm::Function* CodeGenerator::codegenPrototype(FunctionIndex function) {
+    const FlatFunction &prototype = m_ast.getFunction(function);
+    llvm::ArrayRef<Symbol> args = m_ast.getArgs(function);
+
+    // 参数和返回值的类型在原型中写出，没有写时是 double
+    llvm::FunctionType *functionType = this->getFunctionType(function);
+
+    // extern 声明的 C 库数学函数换成 llvm 的内建函数，llvm 知道它们没有副作用、不写 errno，
+    // 常量参数时直接折叠，循环中可以外提和向量化，最后仍然生成对 C 库的调用，单精度时是带 f 后缀的版本
+    if (llvm::Function *intrinsic = this->getMathIntrinsic(function, functionType)) {
+        m_context.cacheFunction(prototype.m_name, intrinsic);
+        return intrinsic;
+    }
+
+    // 单精度的 extern 按 C 库的习惯调用带 f 后缀的版本，比如 sin 对应 sinf，有了实现之后再改回原名
+    llvm::SmallString<16> functionName = kIdentifierTable.getString(prototype.m_name);
+    if (prototype.m_body == kNoNode && !prototype.m_isOperator && m_context.isSinglePrecision(prototype.m_floatMode)) {
+        functionName += 'f';
+    }
+    // 在当前模块中创建函数
+    llvm::Function *theFunction = llvm::Function::Create(functionType, llvm::Function::ExternalLinkage,
+                                                         functionName, m_context.getModule());
+    m_context.cacheFunction(prototype.m_name, theFunction);
+
+    // 设置各个参数名
+    unsigned long index = 0;
+    for (auto &arg : theFunction->args()) {
+        arg.setName(kIdentifierTable.getString(args[index++]));
+    }
+
+    return theFunction;
+}
+
+llvm::Function* CodeGenerator::codegenFunction(FunctionIndex function) {
+    const FlatFunction &prototype = m_ast.getFunction(function);
+
+    // 看函数是否已经创建过，如果没有的话，创建一个
+    llvm::Function *theFunction = m_context.getFunction(prototype.m_name);
+    if (theFunction && theFunction->isIntrinsic()) {
+        // 之前 extern 的数学函数换成了内建函数，现在有了自己的实现，按普通函数重新声明，已经生成的调用不受影响
+        m_context.m_functionCache[prototype.m_name] = nullptr;
+        theFunction = nullptr;
+    }
+    if (!theFunction) {
+        theFunction = this->codegenPrototype(function);
+    }
+
+    if (!theFunction) {
+        return nullptr;
+    }
+
+    // 函数不应该被重复实现，如果原来实现过，说明有问题
+    if (!theFunction->empty()) {
+        return (llvm::Function*)logErrorV("Function cannot be redefined");
+    }
+
+    // 之前 extern 声明的类型要和实现一致，包括浮点精度
+    if (theFunction->getFunctionType() != this->getFunctionType(function)) {
+        return (llvm::Function*)logErrorV("Function definition does not match its declared types");
+    }
+    if (theFunction->getName() != kIdentifierTable.getString(prototype.m_name)) {
+        theFunction->setName(kIdentifierTable.getString(prototype.m_name));
+    }
+    m_floatMode = prototype.m_floatMode;
+
+    // 创建函数实现
+    llvm::BasicBlock *basicBlock = llvm::BasicBlock::Create(m_context.m_llvmContext, "entry", theFunction);
+    m_context.m_builder.SetInsertPoint(basicBlock);
+
+    // 为函数创建单独的调试信息记录
+    llvm::DIFile *debugUnit = m_context.m_debugBuilder->createFile(m_context.m_compileUnit->getFilename(),
+                                                        m_context.m_compileUnit->getDirectory());
+    llvm::DIScope *functionContext = debugUnit;
+    unsigned lineNumber = prototype.m_line;
+    unsigned scopeLine = lineNumber;
+    llvm::DISubprogram *subprogram = m_context.m_debugBuilder->createFunction(
+            functionContext, kIdentifierTable.getString(prototype.m_name), llvm::StringRef(), debugUnit, lineNumber,
+            m_context.createFunctionType(theFunction->getFunctionType(), debugUnit),
+            false, true, scopeLine,
+            llvm::DINode::FlagPrototyped, false);
+    theFunction->setSubprogram(subprogram);
+    m_context.m_lexicalBlocks.push_back(subprogram);
+    m_context.emitLocation(nullptr);
+
+
+    // 记录参数名与其对应的 llvm::Value 对象，参数名以当前函数实现的原型为准
+    m_context.m_namedValues.clear();
+    this->invalidateSharedValues();
+    m_sharedScopes.clear();
+    llvm::ArrayRef<Symbol> argNames = m_ast.getArgs(function);
+    unsigned long argIndex = 0;
+    for (auto &arg : theFunction->args()) {
+        if (argIndex == argNames.size()) {
+            break;
+        }
+        Symbol argName = argNames[argIndex++];
+
+        // 创建
+        llvm::AllocaInst *alloca = m_context.createEntryBlockAlloca(theFunction, argName, arg.getType());
+
+        // 赋值
+        m_context.m_builder.CreateStore(&arg, alloca);
+
+        // 记录
+        m_context.m_namedValues.bind(argName, alloca);
+    }
+
+    m_context.emitLocation(&m_ast.getLocation(prototype.m_body));
+
+    // 对于二元运算符，我们要存储它的优先级
+    if (prototype.m_isOperator && argNames.size() == 2) {
+        m_context.m_operatorTable.setBinaryPrecedence(kIdentifierTable.getString(prototype.m_name).back(), prototype.m_precedence);
+    }
+
+    this->collectTailCalls(prototype.m_body);
+
+    // 生成函数体之前先推断出所有局部变量的类型
+    m_typeInference.inferFunction(function, [this](Symbol name) {
+        return this->getReturnType(name);
+    });
+
+    // 函数内部实现对应的 llvm IR 代码和返回值设定，返回值转换成原型中的类型
+    llvm::Value *retVal = this->codegen(prototype.m_body);
+    if (retVal) {
+        retVal = this->convertValue(retVal, theFunction->getReturnType());
+    }
+    if (retVal) {
+        m_context.m_builder.CreateRet(retVal);
+
+        // 使用 llvm 自带的函数验证当前的函数是否有问题
+        llvm::verifyFunction(*theFunction);
+
+        // 运算符函数总是内联到调用的地方，和内建的运算符一样没有调用的开销
+        if (prototype.m_isOperator) {
+            theFunction->addFnAttr(llvm::Attribute::AlwaysInline);
+        }
+
+        return theFunction;
+    }
+
+    // 函数实现创建有问题的时候，去掉模块中对应的函数定义，之前已经有调用时只去掉实现
+    if (m_context.getFunction(prototype.m_name) == theFunction) {
+        m_context.eraseFunction(prototype.m_name);
+    } else {
+        theFunction->eraseFromParent();
+    }
+    return nullptr;
+}
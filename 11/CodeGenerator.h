@@ -0,0 +1,217 @@
+//
+// Created by 董宏昌 on 2017/2/26.
+//
+
+#ifndef PROJECT_CODEGENERATOR_H
+#define PROJECT_CODEGENERATOR_H
+
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+#include "FlatAST.h"
+#include "TypeInference.h"
+
+namespace llvm {
+    class BasicBlock;
+    class Twine;
+    class Value;
+    class Function;
+    class FunctionType;
+    class Type;
+}
+
+class CodegenContext;
+
+
+/// 运算符函数名的编号，比如 '+' 对应 "binary+"，每个运算符只拼接和查找一次字符串，可以在多个线程中同时调用
+extern Symbol getOperatorSymbol(bool isBinary, char op);
+
+
+/// 内建的向量函数，同名的函数不存在时才按内建函数生成
+enum BuiltinFunction {
+    builtin_none,
+    /// vec2(x, y)、vec4(x, y, z, w) 由各个分量构造向量
+    builtin_vec2,
+    builtin_vec4,
+    /// lane(v, i) 取出第 i 个分量，setlane(v, i, x) 返回把第 i 个分量换成 x 的新向量
+    builtin_lane,
+    builtin_setlane,
+    /// hsum(v)、hmin(v)、hmax(v) 所有分量的和、最小值、最大值
+    builtin_hsum,
+    builtin_hmin,
+    builtin_hmax,
+};
+
+/// 按函数名查找内建函数，不是内建函数时返回 builtin_none
+extern BuiltinFunction getBuiltinFunction(Symbol name);
+
+/// 为模块中声明的 setExternalFunctions 中的函数生成 available_externally 的函数体，供优化器跨模块内联
+/// 只生成运算符和不超过 kMaxInlineBodySize 条指令的函数，JIT 按函数分模块编译时使用
+extern void codegenInlineBodies(CodegenContext &context);
+
+
+/*
+ * CodeGenerator 显式栈上一个还没有生成完的节点
+ */
+struct CodegenFrame {
+    NodeIndex m_node;
+    /// 当前节点已经走到了第几步，每两步之间生成一个子节点
+    unsigned m_stage;
+    /// 各步之间要保存的值、代码块和所在的函数，含义由节点类型决定
+    llvm::Value *m_values[2];
+    llvm::BasicBlock *m_blocks[3];
+    llvm::Function *m_function;
+    /// 函数调用已经生成的参数在 m_argValues 中的起始位置
+    unsigned m_listBegin;
+    /// 节点是 if、for 或者逻辑运算的条件，内建的比较和逻辑运算直接交出 i1
+    bool m_asCondition;
+
+    explicit CodegenFrame(NodeIndex node)
+            : m_node(node), m_stage(0), m_values{nullptr, nullptr}, m_blocks{nullptr, nullptr, nullptr},
+              m_function(nullptr), m_listBegin(0), m_asCondition(false) {
+    }
+};
+
+
+/*
+ * 在 FlatAST 上生成 llvm IR 代码
+ * 按节点的 m_kind switch 分发到各个 codegenXXX，不需要虚函数
+ * 每生成一个函数创建一次，几个栈都带有内联的空间，一般的函数不需要在堆上分配
+ * 所有的 llvm 状态都在 m_context 中，使用不同 CodegenContext 的 CodeGenerator 可以在不同的线程中同时生成代码
+ */
+class CodeGenerator {
+private:
+    CodegenContext &m_context;
+    const FlatAST &m_ast;
+    /// 当前函数中局部变量的类型
+    TypeInference m_typeInference;
+    /// 当前函数原型中写的浮点精度
+    FloatMode m_floatMode;
+    /// 下一个要生成的子节点作为条件使用，见 CodegenFrame::m_asCondition
+    NodeIndex m_conditionNode;
+    /// 还没有生成完的节点
+    llvm::SmallVector<CodegenFrame, 32> m_frames;
+    /// 还没有生成完的函数调用已经生成的参数
+    llvm::SmallVector<llvm::Value *, 16> m_argValues;
+    /// 共享节点已经生成的值，生成它的代码块支配当前插入点，并且之后没有写过变量时才有效
+    llvm::SmallDenseMap<NodeIndex, llvm::Value *, 16> m_sharedValues;
+    /// 按生成顺序记录的 m_sharedValues 中的节点
+    llvm::SmallVector<NodeIndex, 16> m_sharedOrder;
+    /// 每个支配域开始时 m_sharedOrder 的长度
+    llvm::SmallVector<size_t, 8> m_sharedScopes;
+    /// 当前函数中处在尾部位置的调用，它们的返回值直接就是函数的返回值
+    llvm::SmallVector<NodeIndex, 8> m_tailCalls;
+
+    /*
+    生成并取得节点对应的 llvm::Value 对象
+    不使用递归，嵌套很深的表达式也不会栈溢出
+    */
+    llvm::Value *codegen(NodeIndex root);
+
+    /*
+     * 进入和离开只被当前位置支配的代码块，比如 if 的两个分支，离开时丢掉在其中生成的共享节点的值
+     */
+    void pushSharedScope();
+    void popSharedScope();
+    /*
+     * 写了变量或者变量名换了绑定之后，已经生成的共享节点的值都不能再用
+     */
+    void invalidateSharedValues();
+    /*
+     * 查找和记录共享节点的值，不是共享节点时什么都不做
+     */
+    llvm::Value *findSharedValue(NodeIndex node);
+    void rememberSharedValue(NodeIndex node, llvm::Value *value);
+
+    /*
+     * 从函数体开始，经过 if 的两个分支和 var 的作用域，找出处在尾部位置的调用记在 m_tailCalls 中
+     */
+    void collectTailCalls(NodeIndex body);
+
+    /*
+     * 当前函数中 type 对应的 llvm 类型，单精度的函数中 double 是 float
+     */
+    llvm::Type *getType(ValueType type);
+    /*
+     * 在 i64、float、double 之间转换，类型相同时直接返回 value
+     * 标量转换成向量时先转换成元素的类型再复制到每个分量，向量不能转换成标量或者宽度不同的向量，这时报错返回 nullptr
+     */
+    llvm::Value *convertValue(llvm::Value *value, llvm::Type *type);
+    /*
+     * 调用精度不同的函数得到的浮点数和向量转换成当前函数的精度，i64 不变
+     */
+    llvm::Value *convertCallResult(llvm::Value *value);
+    /*
+     * 把值转换成分支用的 i1，已经是 i1 时直接返回，否则和 0 比较，向量不能作为条件，报错返回 nullptr
+     */
+    llvm::Value *convertCondition(llvm::Value *value, const llvm::Twine &name);
+    /*
+     * 条件的 i1 转换成 0/1，typeSource 是 i64 时是 i64，否则是当前精度的浮点数
+     */
+    llvm::Value *convertBoolean(llvm::Value *condition, llvm::Value *typeSource);
+    /*
+     * 被调用函数的返回值类型，找不到函数时返回 type_auto，生成调用时再报错
+     */
+    ValueType getReturnType(Symbol name);
+    /*
+     * extern 声明的原型是可以换成 llvm 内建函数的 C 库数学函数时，返回模块中内建函数的声明，否则返回 nullptr
+     * 比如 extern sin(x) 对应 llvm.sin.f64，单精度时是 llvm.sin.f32
+     */
+    llvm::Function *getMathIntrinsic(FunctionIndex function, llvm::FunctionType *functionType);
+    /*
+     * 按原型中的参数和返回值类型，以及原型的浮点精度生成函数类型
+     */
+    llvm::FunctionType *getFunctionType(FunctionIndex function);
+
+    llvm::Value *codegenNumber(NodeIndex node);
+    llvm::Value *codegenVariable(NodeIndex node);
+    /*
+     * 生成有子节点的节点的下一步，value 是上一步交出的子节点的值
+     * 返回 false 时需要先生成 child，返回 true 时节点生成完毕，value 是它的值，失败时为 nullptr
+     */
+    bool codegenUnary(CodegenFrame &frame, llvm::Value *&value, NodeIndex &child);
+    bool codegenBinary(CodegenFrame &frame, llvm::Value *&value, NodeIndex &child);
+    /*
+     * && 和 || 短路求值，右边生成在单独的代码块中，只在需要时运行
+     */
+    bool codegenLogical(CodegenFrame &frame, llvm::Value *&value, NodeIndex &child);
+    /*
+     * 内建的比较运算，两边已经转换成相同的类型
+     */
+    llvm::Value *codegenComparison(char op, llvm::Value *lhsValue, llvm::Value *rhsValue, bool asCondition);
+    /*
+     * 有一边是向量的 + - *，标量的一边先复制成同样宽度的向量，再按分量运算
+     */
+    llvm::Value *codegenVectorArithmetic(char op, llvm::Value *lhsValue, llvm::Value *rhsValue);
+    bool codegenCall(CodegenFrame &frame, llvm::Value *&value, NodeIndex &child);
+    /*
+     * 参数都已经生成的内建函数，参数个数已经检查过
+     */
+    llvm::Value *codegenBuiltin(BuiltinFunction builtin, llvm::ArrayRef<llvm::Value *> args);
+    bool codegenIf(CodegenFrame &frame, llvm::Value *&value, NodeIndex &child);
+    bool codegenFor(CodegenFrame &frame, llvm::Value *&value, NodeIndex &child);
+    bool codegenVar(CodegenFrame &frame, llvm::Value *&value, NodeIndex &child);
+    /*
+     * 生成 var 定义的一个 type 类型的变量，并赋上初值，初值不能转换成 type 时返回 false
+     */
+    bool bindVariable(llvm::Function *function, Symbol varName, llvm::Type *type, llvm::Value *initValue);
+    /*
+     * 查找被调用的函数，不在当前模块中时按 CodegenContext 中设置的外部函数原型声明它
+     */
+    llvm::Function *findFunction(Symbol name);
+
+public:
+    CodeGenerator(CodegenContext &context, const FlatAST &ast);
+
+    /*
+     * 生成函数声明，extern 和函数实现都会用到
+     */
+    llvm::Function *codegenPrototype(FunctionIndex function);
+    /*
+     * 生成函数实现
+     */
+    llvm::Function *codegenFunction(FunctionIndex function);
+};
+
+
+#endif //PROJECT_CODEGENERATOR_H
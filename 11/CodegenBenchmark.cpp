@@ -0,0 +1,126 @@
+//
+// Created by 董宏昌 on 2017/2/28.
+//
+
+/*
+ * 多线程生成代码的扩展性测试
+ * 生成含有很多函数定义的库，解析一次后分别用不同的线程数把每个函数生成到单独的模块中，
+ * 记录生成 llvm IR 和链接成一个模块的耗时
+ * 用法：llvmTest11CodegenBenchmark [函数个数] [最大线程数]，默认 20000 个函数，线程数从 1 开始每次乘 2，默认到机器的核数
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+#include "CodegenContext.h"
+#include "ExprParser.h"
+#include "ParallelCodegen.h"
+#include "Token.h"
+
+
+static double millisecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+/*
+ * 生成 count 个函数定义，每个函数调用前一个函数，用到 if for var 和各种运算
+ */
+static std::string buildLibrary(unsigned count) {
+    std::string source = "extern sin(x);\n";
+    char definition[256];
+    for (unsigned i = 0; i < count; ++i) {
+        if (i == 0) {
+            snprintf(definition, sizeof(definition), "def lib0(x y) sin(x) * y + 1;\n");
+        } else {
+            snprintf(definition, sizeof(definition),
+                     "def lib%u(x y) var a = x * %u + y, b in "
+                     "(for i = 1, a < i, 0.5 in b = b + lib%u(i, y - 1)) + "
+                     "(if a < y then a * (x + %u.25) else b - a);\n",
+                     i, i, i - 1, i);
+        }
+        source += definition;
+    }
+
+    return source;
+}
+
+static bool parseLibrary(const std::string &source, ExprParser &parser, FlatAST &flatAST) {
+    std::vector<TopLevelItem> items;
+    parser.parseTopLevelItems(source, items);
+    for (const auto &item : items) {
+        if (!item.m_errors.empty()) {
+            fputs(item.m_errors.c_str(), stderr);
+            return false;
+        }
+
+        if (item.m_function) {
+            flatAST.addFunction(item.m_function);
+        } else if (item.m_prototype) {
+            flatAST.addPrototype(item.m_prototype);
+        }
+    }
+
+    return true;
+}
+
+
+int main(int argc, char const *argv[]) {
+    unsigned count = argc > 1 ? (unsigned)strtoul(argv[1], nullptr, 10) : 20000;
+    unsigned maxThreads = argc > 2 ? (unsigned)strtoul(argv[2], nullptr, 10) :
+                          std::max(1u, std::thread::hardware_concurrency());
+
+    // 和 toy.cpp 中相同的运算符优先级
+    {
+        kOperatorTable.setBinaryPrecedence('=', 2);
+        kOperatorTable.setBinaryPrecedence(token_or, 5);
+        kOperatorTable.setBinaryPrecedence(token_and, 6);
+        kOperatorTable.setBinaryPrecedence(token_equal, 9);
+        kOperatorTable.setBinaryPrecedence(token_not_equal, 9);
+        kOperatorTable.setBinaryPrecedence('<', 10);
+        kOperatorTable.setBinaryPrecedence('>', 10);
+        kOperatorTable.setBinaryPrecedence(token_less_equal, 10);
+        kOperatorTable.setBinaryPrecedence(token_greater_equal, 10);
+        kOperatorTable.setBinaryPrecedence('+', 20);
+        kOperatorTable.setBinaryPrecedence('-', 30);
+        kOperatorTable.setBinaryPrecedence('*', 40);
+    }
+
+    // AST 在所有测试中共用，parser 持有节点所在的内存
+    std::string source = buildLibrary(count);
+    ExprParser parser;
+    FlatAST flatAST;
+    if (!parseLibrary(source, parser, flatAST)) {
+        return 1;
+    }
+
+    printf("%10s %10s %12s %12s %10s\n", "functions", "threads", "codegen(ms)", "link(ms)", "speedup");
+
+    bool succeeded = true;
+    double baseTime = 0;
+    for (unsigned threads = 1; threads <= maxThreads; threads *= 2) {
+        ParallelCodegen codegen(threads);
+        auto codegenStart = std::chrono::steady_clock::now();
+        bool generated = codegen.generate(flatAST, kOperatorTable);
+        double codegenTime = millisecondsSince(codegenStart);
+
+        CodegenContext codegenContext;
+        auto linkStart = std::chrono::steady_clock::now();
+        bool linked = codegen.linkInto(*codegenContext.getModule());
+        double linkTime = millisecondsSince(linkStart);
+
+        if (threads == 1) {
+            baseTime = codegenTime;
+        }
+        printf("%10u %10u %12.2f %12.2f %9.1fx%s\n", count, threads, codegenTime, linkTime,
+               codegenTime > 0 ? baseTime / codegenTime : 0.0, generated && linked ? "" : "  FAILED");
+        fflush(stdout);
+
+        succeeded = succeeded && generated && linked;
+    }
+
+    return succeeded ? 0 : 1;
+}
@@ -0,0 +1,219 @@
+//
+// Created by 董宏昌 on 2017/2/28.
+//
+
+#include "CodegenContext.h"
+
+
+CodegenContext::CodegenContext()
+        : m_builder(m_llvmContext), m_operatorTable(kOperatorTable), m_externalAST(nullptr),
+          m_externalFunctions(nullptr), m_floatMode(float_double), m_compileUnit(nullptr),
+          m_doubleDebugType(nullptr), m_floatDebugType(nullptr), m_i64DebugType(nullptr) {
+    this->createModule();
+}
+
+CodegenContext::~CodegenContext() {
+    // 先释放依赖模块的对象，最后才是 m_llvmContext
+    m_debugBuilder.reset();
+    m_module.reset();
+}
+
+void CodegenContext::createModule() {
+    m_module = llvm::make_unique<llvm::Module>("My custom jit", m_llvmContext);
+    // 没有版本号的调试信息在读入 bitcode 和链接时会被丢掉
+    m_module->addModuleFlag(llvm::Module::Warning, "Debug Info Version", llvm::DEBUG_METADATA_VERSION);
+    m_functionCache.clear();
+
+    m_debugBuilder = llvm::make_unique<llvm::DIBuilder>(*m_module);
+    m_compileUnit = m_debugBuilder->createCompileUnit(llvm::dwarf::DW_LANG_C, "fib.ks", ".",
+                                                      "Kaleidoscope Compiler", false, "", 0);
+    m_doubleDebugType = nullptr;
+    m_floatDebugType = nullptr;
+    m_i64DebugType = nullptr;
+    m_lexicalBlocks.clear();
+}
+
+void CodegenContext::cacheFunction(Symbol name, llvm::Function *function) {
+    if (name == kEmptySymbol) {
+        return;
+    }
+    if (name >= m_functionCache.size()) {
+        m_functionCache.resize(name + 1, nullptr);
+    }
+    if (!m_functionCache[name]) {
+        m_functionCache[name] = function;
+    }
+}
+
+void CodegenContext::emitLocation(const SourceLocation *location) {
+    if (!location) {
+        m_builder.SetCurrentDebugLocation(llvm::DebugLoc());
+        return;
+    }
+
+    llvm::DIScope *scope;
+    if (m_lexicalBlocks.empty()) {
+        scope = m_compileUnit;
+    } else {
+        scope = m_lexicalBlocks.back();
+    }
+
+    m_builder.SetCurrentDebugLocation(llvm::DebugLoc::get(location->line, location->col, scope));
+}
+
+llvm::MDNode *CodegenContext::createLoopID(const SourceLocation &location, const LoopHints &hints) {
+    // 第一个操作数是元数据自己，这样每个循环的元数据都是不同的
+    llvm::SmallVector<llvm::Metadata *, 4> operands;
+    operands.push_back(nullptr);
+    if (!m_lexicalBlocks.empty()) {
+        operands.push_back(llvm::DILocation::get(m_llvmContext, location.line, location.col, m_lexicalBlocks.back()));
+    }
+
+    if (hints.m_vectorize) {
+        llvm::Metadata *vectorize[] = {
+                llvm::MDString::get(m_llvmContext, "llvm.loop.vectorize.enable"),
+                llvm::ConstantAsMetadata::get(m_builder.getTrue()),
+        };
+        operands.push_back(llvm::MDNode::get(m_llvmContext, vectorize));
+    }
+    if (hints.m_unrollCount) {
+        llvm::Metadata *unroll[] = {
+                llvm::MDString::get(m_llvmContext, "llvm.loop.unroll.count"),
+                llvm::ConstantAsMetadata::get(m_builder.getInt32(hints.m_unrollCount)),
+        };
+        operands.push_back(llvm::MDNode::get(m_llvmContext, unroll));
+    }
+
+    llvm::MDNode *loopID = llvm::MDNode::getDistinct(m_llvmContext, operands);
+    loopID->replaceOperandWith(0, loopID);
+    return loopID;
+}
+
+llvm::DIType *CodegenContext::getDebugType(llvm::Type *type) {
+    if (type->isVectorTy()) {
+        // 调试器中按有 n 个元素的数组显示
+        unsigned width = type->getVectorNumElements();
+        uint64_t sizeInBits = type->getPrimitiveSizeInBits();
+        llvm::Metadata *subscripts[] = {m_debugBuilder->getOrCreateSubrange(0, width)};
+        return m_debugBuilder->createVectorType(sizeInBits, sizeInBits, this->getDebugType(type->getVectorElementType()),
+                                                m_debugBuilder->getOrCreateArray(subscripts));
+    }
+
+    if (type->isIntegerTy()) {
+        if (!m_i64DebugType) {
+            m_i64DebugType = m_debugBuilder->createBasicType("i64", 64, 64, llvm::dwarf::DW_ATE_signed);
+        }
+
+        return m_i64DebugType;
+    }
+
+    if (type->isFloatTy()) {
+        if (!m_floatDebugType) {
+            m_floatDebugType = m_debugBuilder->createBasicType("float", 32, 32, llvm::dwarf::DW_ATE_float);
+        }
+
+        return m_floatDebugType;
+    }
+
+    if (!m_doubleDebugType) {
+        m_doubleDebugType = m_debugBuilder->createBasicType("double", 64, 64, llvm::dwarf::DW_ATE_float);
+    }
+
+    return m_doubleDebugType;
+}
+
+llvm::DISubroutineType *CodegenContext::createFunctionType(llvm::FunctionType *functionType, llvm::DIFile *unit) {
+    llvm::SmallVector<llvm::Metadata *, 8> eltTypes;
+
+    eltTypes.push_back(this->getDebugType(functionType->getReturnType()));
+
+    for (llvm::Type *paramType : functionType->params()) {
+        eltTypes.push_back(this->getDebugType(paramType));
+    }
+
+    llvm::ArrayRef<llvm::Metadata *> array(eltTypes);
+
+    return m_debugBuilder->createSubroutineType(m_debugBuilder->getOrCreateTypeArray(array));
+}
+
+/**
+ * 在函数作用域的栈中创建变量
+ * 这里的函数含义比较广，不如一个循环结构，一个分支结构等，都可以有自己独立的栈
+ * 最直接的体现就是这些作用域里边的变量是会覆盖外边的变量的
+ */
+llvm::AllocaInst *CodegenContext::createEntryBlockAlloca(llvm::Function *function, Symbol varName,
+                                                        llvm::Type *type) {
+    llvm::IRBuilder<> tmpBuilder(&function->getEntryBlock(), function->getEntryBlock().begin());
+
+    return tmpBuilder.CreateAlloca(type, 0, kIdentifierTable.getString(varName));
+}
+
+void CodegenContext::setFastMath(bool enabled) {
+    llvm::FastMathFlags flags;
+    if (enabled) {
+        flags.setUnsafeAlgebra();
+    }
+    m_builder.setFastMathFlags(flags);
+}
+
+void CodegenContext::setExternalFunctions(const FlatAST *ast,
+                                          const llvm::DenseMap<Symbol, FunctionIndex> *functions) {
+    m_externalAST = ast;
+    m_externalFunctions = functions;
+}
+
+bool CodegenContext::findExternalFunction(Symbol name, const FlatAST *&ast, FunctionIndex &function) const {
+    if (!m_externalFunctions) {
+        return false;
+    }
+
+    auto found = m_externalFunctions->find(name);
+    if (found == m_externalFunctions->end()) {
+        return false;
+    }
+
+    ast = m_externalAST;
+    function = found->second;
+    return true;
+}
+
+llvm::Module *CodegenContext::dumpModule() {
+    m_module->dump();
+
+    m_debugBuilder->finalize();
+
+    return m_module.get();
+}
+
+std::unique_ptr<llvm::Module> CodegenContext::takeModule() {
+    m_debugBuilder->finalize();
+
+    // 缓存中的函数都随模块交给了调用方
+    std::unique_ptr<llvm::Module> module = std::move(m_module);
+    this->createModule();
+
+    return module;
+}
+
+void CodegenContext::deleteFunctionBody(Symbol name) {
+    if (llvm::Function *function = this->getFunction(name)) {
+        function->deleteBody();
+    }
+}
+
+void CodegenContext::eraseFunction(Symbol name) {
+    llvm::Function *function = this->getFunction(name);
+    if (!function) {
+        return;
+    }
+
+    function->deleteBody();
+    if (function->use_empty()) {
+        m_functionCache[name] = nullptr;
+        function->eraseFromParent();
+    }
+}
+
+void CodegenContext::eraseAnonymousFunction(llvm::Function *function) {
+    function->eraseFromParent();
+}
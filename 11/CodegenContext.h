@@ -0,0 +1,183 @@
+//
+// Created by 董宏昌 on 2017/2/28.
+//
+
+#ifndef PROJECT_CODEGENCONTEXT_H
+#define PROJECT_CODEGENCONTEXT_H
+
+
+#include <memory>
+#include <vector>
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/IR/DIBuilder.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "FlatAST.h"
+#include "OperatorTable.h"
+#include "ScopedSymbolTable.h"
+
+
+/*
+ * 一次编译的全部代码生成状态
+ * 自己持有 llvm 上下文、IRBuilder、模块、局部变量表、函数缓存、运算符表和调试信息，
+ * 不同的 CodegenContext 之间不共享任何可变的状态，可以在不同的线程中同时生成代码，
+ * 同一个 CodegenContext 同时只能被一个线程使用
+ */
+class CodegenContext {
+private:
+    friend class CodeGenerator;
+
+    /// 这次编译的 llvm 上下文，类型和常量都属于它，必须比 m_module 活得久
+    llvm::LLVMContext m_llvmContext;
+    /// 用于构建各个 llvm IR 对象，比如函数等
+    llvm::IRBuilder<> m_builder;
+    /// 当前模块，这次编译的函数都在其中生成
+    std::unique_ptr<llvm::Module> m_module;
+    /// 保存变量名与变量地址的对应关系
+    /// var 和 for 在其中开启新的作用域，离开作用域时自动恢复被覆盖的同名变量
+    ScopedSymbolTable m_namedValues;
+    /// m_module 中的函数，下标是函数名的 Symbol 编号，代替按字符串查找 m_module->getFunction
+    std::vector<llvm::Function *> m_functionCache;
+    /// 这次编译的运算符表，创建时拷贝 kOperatorTable，def binary 生成代码时在这里登记优先级
+    OperatorTable m_operatorTable;
+    /// 不在 m_module 中的函数按名字到这里查找原型，见 setExternalFunctions
+    const FlatAST *m_externalAST;
+    const llvm::DenseMap<Symbol, FunctionIndex> *m_externalFunctions;
+    /// 整个模块的浮点精度，函数原型中没有写精度时使用
+    FloatMode m_floatMode;
+
+    /// 用来生成 m_module 的调试信息
+    std::unique_ptr<llvm::DIBuilder> m_debugBuilder;
+    llvm::DICompileUnit *m_compileUnit;
+    llvm::DIType *m_doubleDebugType;
+    llvm::DIType *m_floatDebugType;
+    llvm::DIType *m_i64DebugType;
+    std::vector<llvm::DIScope *> m_lexicalBlocks;
+
+    /*
+     * 创建新的空模块和它的调试信息
+     */
+    void createModule();
+    /*
+     * 记录 m_module 中新建的函数，同名函数已经存在时 llvm 会给新函数改名，这时保留原来的记录
+     * 顶层表达式的匿名函数没有名字，不能被查找到，所以不记录
+     */
+    void cacheFunction(Symbol name, llvm::Function *function);
+    /*
+     * 设置之后生成的指令的源码位置，location 为 nullptr 时清除
+     */
+    void emitLocation(const SourceLocation *location);
+    /*
+     * 创建循环的 llvm.loop 元数据，挂在循环回跳的分支上
+     * 其中有循环开始的源码位置，优化的诊断信息按它对应到 for，还有 hints 中的优化提示
+     */
+    llvm::MDNode *createLoopID(const SourceLocation &location, const LoopHints &hints);
+    /*
+     * 返回 double、float、i64 或者它们的向量对应的调试信息类型
+     */
+    llvm::DIType *getDebugType(llvm::Type *type);
+    llvm::DISubroutineType *createFunctionType(llvm::FunctionType *functionType, llvm::DIFile *unit);
+    /*
+     * 在函数的入口代码块中为 type 类型的变量分配栈上的空间
+     */
+    llvm::AllocaInst *createEntryBlockAlloca(llvm::Function *function, Symbol varName, llvm::Type *type);
+
+public:
+    CodegenContext();
+    ~CodegenContext();
+    CodegenContext(const CodegenContext &) = delete;
+    CodegenContext &operator=(const CodegenContext &) = delete;
+
+    llvm::LLVMContext &getLLVMContext() {
+        return m_llvmContext;
+    }
+    llvm::Module *getModule() {
+        return m_module.get();
+    }
+    /*
+     * 解析要在这次编译中生成代码的源码时，解析器应该使用这个运算符表
+     */
+    OperatorTable &getOperatorTable() {
+        return m_operatorTable;
+    }
+
+    /*
+     * 设置整个模块的浮点精度，只影响之后生成的函数，默认是 float_double
+     */
+    void setFloatMode(FloatMode floatMode) {
+        m_floatMode = floatMode;
+    }
+    FloatMode getFloatMode() const {
+        return m_floatMode;
+    }
+    /*
+     * 原型中的精度为 functionMode 的函数是否按 float 生成
+     */
+    bool isSinglePrecision(FloatMode functionMode) const {
+        return (functionMode == float_default ? m_floatMode : functionMode) == float_single;
+    }
+    /*
+     * 打开时浮点运算带上 fast-math 标记，允许重新结合，浮点数的归约循环才能被向量化，默认关闭
+     */
+    void setFastMath(bool enabled);
+
+    /*
+     * 精度为 functionMode 的函数中值的类型对应的 llvm 类型，type_auto 按 double 处理，向量的元素是当前精度的浮点数
+     */
+    llvm::Type *getType(ValueType type, FloatMode functionMode) {
+        if (type == type_i64) {
+            return llvm::Type::getInt64Ty(m_llvmContext);
+        }
+
+        llvm::Type *floatType = this->isSinglePrecision(functionMode) ? llvm::Type::getFloatTy(m_llvmContext) :
+                                llvm::Type::getDoubleTy(m_llvmContext);
+        if (unsigned width = getVectorWidth(type)) {
+            return llvm::VectorType::get(floatType, width);
+        }
+        return floatType;
+    }
+
+    /*
+     * 按函数名的编号查找 m_module 中的函数，没有时返回 nullptr
+     */
+    llvm::Function *getFunction(Symbol name) const {
+        return name < m_functionCache.size() ? m_functionCache[name] : nullptr;
+    }
+
+    /*
+     * 设置生成在其他模块中的函数，functions 是函数名到 ast 中函数的下标
+     * 调用的函数不在 m_module 中时，按 ast 中的原型在 m_module 中声明它，链接或者 JIT 载入时再解析到实现
+     * 调用方要保证两者比之后的代码生成活得久，传入 nullptr 时取消
+     */
+    void setExternalFunctions(const FlatAST *ast, const llvm::DenseMap<Symbol, FunctionIndex> *functions);
+    /*
+     * 按函数名查找 setExternalFunctions 设置的函数，没有时返回 false
+     */
+    bool findExternalFunction(Symbol name, const FlatAST *&ast, FunctionIndex &function) const;
+
+    /*
+     * 完成调试信息并 dump 出模块中现在的代码，返回模块
+     */
+    llvm::Module *dumpModule();
+    /*
+     * 完成调试信息后把模块交给调用方，之后的代码生成在新的空模块中
+     */
+    std::unique_ptr<llvm::Module> takeModule();
+
+    /*
+     * 丢掉函数现在的实现，只留下声明，调用它的地方仍然有效，之后可以重新生成实现
+     */
+    void deleteFunctionBody(Symbol name);
+    /*
+     * 从模块中删掉函数，还有地方调用它时只丢掉实现
+     */
+    void eraseFunction(Symbol name);
+    /*
+     * 删掉顶层表达式生成的匿名函数
+     */
+    void eraseAnonymousFunction(llvm::Function *function);
+};
+
+
+#endif //PROJECT_CODEGENCONTEXT_H
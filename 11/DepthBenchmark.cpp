@@ -0,0 +1,159 @@
+//
+// Created by 董宏昌 on 2017/2/28.
+//
+
+/*
+ * 表达式嵌套深度的压力测试
+ * 生成嵌套很深的表达式，分别记录解析、展开和生成 llvm IR 的耗时，以及进程的内存峰值
+ * 用法：llvmTest11DepthBenchmark [最大深度]，深度从 100 开始每次乘 10，默认最大到 100000
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include "CodeGenerator.h"
+#include "CodegenContext.h"
+#include "ExprAST.h"
+#include "ExprParser.h"
+#include "Token.h"
+
+
+/*
+ * 一种嵌套的写法，prelude 是表达式用到的函数定义
+ */
+struct NestingShape {
+    const char *m_name;
+    const char *m_prelude;
+    /// 每层嵌套在表达式前后各加上的部分
+    const char *m_open;
+    const char *m_close;
+    /// 最里层的表达式
+    const char *m_leaf;
+};
+
+static const NestingShape kShapes[] = {
+        // ((((x))))
+        {"paren", "", "(", ")", "x"},
+        // x+x+x+x，左结合，AST 是向左边伸展的一条链
+        {"binary", "", "", "+x", "x"},
+        // x+(x+(x+x))，AST 是向右边伸展的一条链
+        {"rbinary", "", "x+(", ")", "x"},
+        // ----x
+        {"unary", "def unary-(v) 0-v;", "-", "", "x"},
+        // g(g(g(x)))
+        {"call", "def g(v) v;", "g(", ")", "x"},
+        // if x then x else if x then x else x，每层生成三个代码块
+        {"if", "", "if x then x else ", "", "x"},
+        // var a = x in var a = x in a，每层一个新的作用域
+        {"var", "", "var a = x in ", "", "a"},
+};
+
+
+/*
+ * 进程到现在为止的内存峰值，单位 KB
+ */
+static long peakMemoryKB() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    // macOS 上 ru_maxrss 的单位是字节
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+}
+
+static double millisecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static std::string buildSource(const NestingShape &shape, unsigned depth) {
+    std::string source = shape.m_prelude;
+    source += "def f(x) ";
+    for (unsigned i = 0; i < depth; ++i) {
+        source += shape.m_open;
+    }
+    source += shape.m_leaf;
+    for (unsigned i = 0; i < depth; ++i) {
+        source += shape.m_close;
+    }
+    source += ";";
+
+    return source;
+}
+
+/*
+ * 解析并生成一段代码，返回是否所有定义都生成成功
+ */
+static bool runShape(const NestingShape &shape, unsigned depth) {
+    std::string source = buildSource(shape, depth);
+
+    // 每次都用新的 CodegenContext，上一次生成的代码在这里整体释放
+    CodegenContext codegenContext;
+
+    auto parseStart = std::chrono::steady_clock::now();
+    ExprParser parser;
+    parser.setOperatorTable(&codegenContext.getOperatorTable());
+    std::vector<TopLevelItem> items;
+    parser.parseTopLevelItems(source, items);
+    double parseTime = millisecondsSince(parseStart);
+
+    auto codegenStart = std::chrono::steady_clock::now();
+    FlatAST flatAST;
+    bool succeeded = true;
+    for (const auto &item : items) {
+        if (!item.m_errors.empty() || !item.m_function) {
+            fputs(item.m_errors.c_str(), stderr);
+            succeeded = false;
+            continue;
+        }
+
+        FunctionIndex function = flatAST.addFunction(item.m_function);
+        if (!CodeGenerator(codegenContext, flatAST).codegenFunction(function)) {
+            succeeded = false;
+        }
+    }
+    double codegenTime = millisecondsSince(codegenStart);
+
+    printf("%-8s %10u %12.2f %12.2f %12zu %12ld%s\n", shape.m_name, depth, parseTime, codegenTime,
+           flatAST.getNodeCount(), peakMemoryKB(), succeeded ? "" : "  FAILED");
+    fflush(stdout);
+
+    return succeeded;
+}
+
+
+int main(int argc, char const *argv[]) {
+    unsigned maxDepth = argc > 1 ? (unsigned)strtoul(argv[1], nullptr, 10) : 100000;
+
+    // 和 toy.cpp 中相同的运算符优先级
+    {
+        kOperatorTable.setBinaryPrecedence('=', 2);
+        kOperatorTable.setBinaryPrecedence(token_or, 5);
+        kOperatorTable.setBinaryPrecedence(token_and, 6);
+        kOperatorTable.setBinaryPrecedence(token_equal, 9);
+        kOperatorTable.setBinaryPrecedence(token_not_equal, 9);
+        kOperatorTable.setBinaryPrecedence('<', 10);
+        kOperatorTable.setBinaryPrecedence('>', 10);
+        kOperatorTable.setBinaryPrecedence(token_less_equal, 10);
+        kOperatorTable.setBinaryPrecedence(token_greater_equal, 10);
+        kOperatorTable.setBinaryPrecedence('+', 20);
+        kOperatorTable.setBinaryPrecedence('-', 30);
+        kOperatorTable.setBinaryPrecedence('*', 40);
+    }
+
+    // 内存峰值只增不减，所以每种写法从浅到深依次运行，深度最大的那次决定峰值
+    printf("%-8s %10s %12s %12s %12s %12s\n", "shape", "depth", "parse(ms)", "codegen(ms)", "nodes", "maxrss(KB)");
+
+    bool succeeded = true;
+    for (const auto &shape : kShapes) {
+        for (unsigned long depth = 100; depth <= maxDepth; depth *= 10) {
+            succeeded = runShape(shape, (unsigned)depth) && succeeded;
+        }
+    }
+
+    return succeeded ? 0 : 1;
+}
@@ -8,28 +8,76 @@
 #include <memory>
 #include <string>
 #include <vector>
-#include <map>
-#include <llvm/IR/Module.h>
+#include <cstdint>
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
+#include "IdentifierTable.h"
 
-namespace llvm {
-    class Value;
-    class Function;
+
+struct SourceLocation {
+    unsigned line;
+    unsigned col;
+};
+
+
+/// 表达式节点的类型，遍历 AST 时用它 switch，不使用虚函数和 dynamic_cast
+enum ASTKind : uint8_t {
+    ast_number,
+    ast_variable,
+    ast_unary,
+    ast_binary,
+    ast_call,
+    ast_if,
+    ast_for,
+    ast_var,
+};
+
+
+/// 值的类型
+enum ValueType : uint8_t {
+    /// 没有写类型，只用于 var 定义的变量，按初值和之后的赋值推断
+    type_auto,
+    type_double,
+    type_i64,
+    /// 2 个和 4 个浮点数的向量，直接对应 llvm 的向量类型，精度和函数中的浮点数相同
+    type_vec2,
+    type_vec4,
+};
+
+
+/*
+ * 向量类型的宽度，不是向量时返回 0
+ */
+inline unsigned getVectorWidth(ValueType type) {
+    return type == type_vec2 ? 2 : (type == type_vec4 ? 4 : 0);
 }
 
 
-/// 储存了各个操作符的优先级
-extern std::map<char, int> kBinaryOPPrecedence;
+/// 函数中浮点数的精度
+enum FloatMode : uint8_t {
+    /// 没有写精度，使用 CodegenContext 中整个模块的设置
+    float_default,
+    /// double 都按 float 生成，extern 调用 C 库中带 f 后缀的版本
+    float_single,
+    float_double,
+};
 
 
-/// 初始化 llvm 上下文，之后才可以生成 llvm IR 代码
-extern void initLLVMContext();
-/// dump 出 llvm IR 中现在的代码
-extern llvm::Module* dumpLLVMContext();
+/// for 循环在 in 之前写的优化提示，比如 for i = 0, n < i vectorize unroll 4 in ...，生成代码时变成 llvm.loop 元数据
+struct LoopHints {
+    /// 要求向量化这个循环
+    bool m_vectorize;
+    /// 展开的次数，没有写时是 0，由 llvm 决定
+    unsigned m_unrollCount;
+};
 
 
-struct SourceLocation {
-    unsigned line;
-    unsigned col;
+/// ExprAST::m_flags 中的标记
+enum ExprFlags : uint8_t {
+    /// 节点在 HashConsTable 中，结构相同的表达式都使用这一个节点
+    expr_hash_consed = 1,
+    /// 节点被不止一处引用，AST 不再是树而是 DAG
+    expr_shared = 2,
 };
 
 
@@ -37,40 +85,48 @@ struct SourceLocation {
 AST : abstract syntax tree 抽象语法树
 ExprAST : 表达式的抽象语法树
 所有表达式节点的基类
+节点都分配在 ASTContext 中，不会被单独释放，所以子节点用裸指针引用，名字用 IdentifierTable 中的 Symbol 编号
+这里只是语法分析的结果，代码生成和 dump 都在展开成 FlatAST 之后进行
 */
 class ExprAST {
 protected:
+    ASTKind m_kind;
+    /// ExprFlags 的组合
+    uint8_t m_flags;
     SourceLocation m_sourceLocation;
 
 public:
-    virtual ~ExprAST();
+    ExprAST(ASTKind kind);
 
+    ASTKind getKind();
+    bool isShared();
+    const SourceLocation &getLocation();
+    void setLocation(const SourceLocation &location);
     unsigned getLine();
     unsigned getCol();
-    virtual llvm::raw_ostream &dump(llvm::raw_ostream &out, int index);
 
-    /*
-    生成并取得 AST 节点对应的 llvm::Value 对象
-    */
-    virtual llvm::Value *codegen() = 0;
+    friend class HashConsTable;
 };
 
 
 /*
 数字常量节点
-比如 "1.0"
+比如 "1.0"，没有小数点和指数的 "1" 是 i64 常量
 */
 class NumberExprAST : public ExprAST {
 private:
-    /// 常量值
+    /// 常量的类型，type_double 或 type_i64
+    ValueType m_type;
+    /// 常量值，i64 常量的值在 m_integer 中
     double m_val;
+    int64_t m_integer;
 
 public:
     NumberExprAST(double val);
+    NumberExprAST(int64_t integer);
 
-    llvm::raw_ostream &dump(llvm::raw_ostream &out, int index) override;
-
-    llvm::Value *codegen() override;
+    friend class FlatAST;
+    friend class HashConsTable;
 };
 
 
@@ -81,16 +137,16 @@ public:
 class VariableExprAST : public ExprAST {
 private:
     /// 变量名
-    std::string m_name;
+    Symbol m_name;
 
 public:
-    VariableExprAST(const std::string &name);
-
-    std::string getName();
+    VariableExprAST(Symbol name);
 
-    llvm::raw_ostream &dump(llvm::raw_ostream &out, int index) override;
+    Symbol getSymbol();
+    llvm::StringRef getName();
 
-    llvm::Value *codegen() override;
+    friend class FlatAST;
+    friend class HashConsTable;
 };
 
 
@@ -103,14 +159,12 @@ private:
     /// 自定义的运算符的字符
     char m_operatorCode;
     /// 自定义的运算符的运算对象
-    std::unique_ptr<ExprAST> m_operand;
+    ExprAST *m_operand;
 
 public:
-    UnaryExprAST(char operatorCode, std::unique_ptr<ExprAST> operand);
+    UnaryExprAST(char operatorCode, ExprAST *operand);
 
-    llvm::raw_ostream &dump(llvm::raw_ostream &out, int index) override;
-
-    llvm::Value *codegen() override;
+    friend class FlatAST;
 };
 
 
@@ -123,14 +177,13 @@ private:
     /// 操作符
     char m_op;
     /// 操作符左右的表达式
-    std::unique_ptr<ExprAST> m_lhs, m_rhs;
+    ExprAST *m_lhs, *m_rhs;
 
 public:
-    BinaryExprAST(char op, std::unique_ptr<ExprAST> lhs, std::unique_ptr<ExprAST> rhs);
-
-    llvm::raw_ostream &dump(llvm::raw_ostream &out, int index) override;
+    BinaryExprAST(char op, ExprAST *lhs, ExprAST *rhs);
 
-    llvm::Value *codegen() override;
+    friend class FlatAST;
+    friend class HashConsTable;
 };
 
 
@@ -141,16 +194,14 @@ public:
 class CallExprAST : public ExprAST {
 private:
     /// 被调用函数名
-    std::string m_callee;
-    /// 各个参数的表达式
-    std::vector<std::unique_ptr<ExprAST>> m_args;
+    Symbol m_callee;
+    /// 各个参数的表达式，数组本身也在 ASTContext 中
+    llvm::ArrayRef<ExprAST *> m_args;
 
 public:
-    CallExprAST(const std::string &callee, std::vector<std::unique_ptr<ExprAST>> args);
+    CallExprAST(Symbol callee, llvm::ArrayRef<ExprAST *> args);
 
-    llvm::raw_ostream &dump(llvm::raw_ostream &out, int index) override;
-
-    llvm::Value *codegen() override;
+    friend class FlatAST;
 };
 
 
@@ -160,16 +211,14 @@ public:
  */
 class IfExprAST : public ExprAST {
 private:
-    std::unique_ptr<ExprAST> m_condition;
-    std::unique_ptr<ExprAST> m_then;
-    std::unique_ptr<ExprAST> m_else;
+    ExprAST *m_condition;
+    ExprAST *m_then;
+    ExprAST *m_else;
 
 public:
-    IfExprAST(std::unique_ptr<ExprAST> condition, std::unique_ptr<ExprAST> then, std::unique_ptr<ExprAST> elseExpr);
-
-    llvm::raw_ostream &dump(llvm::raw_ostream &out, int index) override;
+    IfExprAST(ExprAST *condition, ExprAST *then, ExprAST *elseExpr);
 
-    llvm::Value *codegen() override;
+    friend class FlatAST;
 };
 
 
@@ -179,19 +228,31 @@ public:
  */
 class ForExprAST : public ExprAST {
 private:
-    std::string m_varName;
-    std::unique_ptr<ExprAST> m_start;
-    std::unique_ptr<ExprAST> m_end;
-    std::unique_ptr<ExprAST> m_step;
-    std::unique_ptr<ExprAST> m_body;
+    Symbol m_varName;
+    ExprAST *m_start;
+    ExprAST *m_end;
+    /// 步进是可选的，没有写时为 nullptr
+    ExprAST *m_step;
+    ExprAST *m_body;
+    LoopHints m_hints;
 
 public:
-    ForExprAST(const std::string &varName, std::unique_ptr<ExprAST> start, std::unique_ptr<ExprAST> end,
-               std::unique_ptr<ExprAST> step, std::unique_ptr<ExprAST> body);
+    ForExprAST(Symbol varName, ExprAST *start, ExprAST *end, ExprAST *step, ExprAST *body, const LoopHints &hints);
+
+    friend class FlatAST;
+};
 
-    llvm::raw_ostream &dump(llvm::raw_ostream &out, int index) override;
 
-    llvm::Value *codegen() override;
+/**
+ * var 定义的一个变量
+ * a:i64 = 1
+ */
+struct VarBinding {
+    Symbol m_name;
+    /// 没有写类型时是 type_auto
+    ValueType m_type;
+    /// 初值，没有写时为 nullptr
+    ExprAST *m_init;
 };
 
 
@@ -201,15 +262,14 @@ public:
  */
 class VarExprAST : public ExprAST {
 private:
-    std::vector<std::pair<std::string, std::unique_ptr<ExprAST>>> m_varNames;
-    std::unique_ptr<ExprAST> m_body;
+    /// 各个变量，数组本身也在 ASTContext 中
+    llvm::ArrayRef<VarBinding> m_varNames;
+    ExprAST *m_body;
 
 public:
-    VarExprAST(std::vector<std::pair<std::string, std::unique_ptr<ExprAST>>> varNames, std::unique_ptr<ExprAST> body);
+    VarExprAST(llvm::ArrayRef<VarBinding> varNames, ExprAST *body);
 
-    llvm::raw_ostream &dump(llvm::raw_ostream &out, int index) override;
-
-    llvm::Value *codegen() override;
+    friend class FlatAST;
 };
 
 
@@ -221,9 +281,15 @@ public:
 class PrototypeAST {
 private:
     /// 函数名
-    std::string m_name;
+    Symbol m_name;
     /// 各个参数名
-    std::vector<std::string> m_args;
+    llvm::ArrayRef<Symbol> m_args;
+    /// 各个参数的类型，为空时都是 double
+    llvm::ArrayRef<ValueType> m_argTypes;
+    /// 返回值的类型
+    ValueType m_returnType;
+    /// 浮点数的精度，def float f(x) 中写在函数名之前
+    FloatMode m_floatMode;
     /// 是否是一个运算符
     bool m_isOperator;
     /// 针对二元运算符的优先级
@@ -231,10 +297,21 @@ private:
     unsigned m_line;
 
 public:
-    PrototypeAST(const std::string &name, std::vector<std::string> args, bool isOperator = false, unsigned precedence = 0);
-
-    /// 返回函数名
-    std::string getName();
+    PrototypeAST(Symbol name, llvm::ArrayRef<Symbol> args,
+                 llvm::ArrayRef<ValueType> argTypes = llvm::ArrayRef<ValueType>(), ValueType returnType = type_double,
+                 bool isOperator = false, unsigned precedence = 0);
+
+    /// 返回函数名，字符串保存在 kIdentifierTable 中，一直有效
+    llvm::StringRef getName();
+    /// 返回函数名的编号
+    Symbol getSymbol();
+    /// 返回各个参数名的编号
+    llvm::ArrayRef<Symbol> getArgs();
+    /// 返回第 i 个参数的类型
+    ValueType getArgType(unsigned i);
+    ValueType getReturnType();
+    FloatMode getFloatMode();
+    void setFloatMode(FloatMode floatMode);
     /// 取的运算符的 ascii 码
     char getOperatorName();
     /// 返回函数是否是一元运算符
@@ -245,10 +322,7 @@ public:
     unsigned getBinaryPrecedence();
     unsigned getLine();
 
-//    /// 创建各个参数，并且记录地址到 kNamedValue，以便后边的访问和更改
-//    void createArgumentAllocas(llvm::Function *function);
-
-    llvm::Function *codegen();
+    friend class FlatAST;
 };
 
 
@@ -260,18 +334,16 @@ public:
 class FunctionAST {
 private:
     /// 函数定义
-    std::unique_ptr<PrototypeAST> m_prototype;
+    PrototypeAST *m_prototype;
     /// 函数实现内容的各个表达式
-    std::unique_ptr<ExprAST> m_body;
+    ExprAST *m_body;
 
 public:
-    FunctionAST(std::unique_ptr<PrototypeAST> prototype, std::unique_ptr<ExprAST> body);
-
-    std::string getName();
+    FunctionAST(PrototypeAST *prototype, ExprAST *body);
 
-    llvm::raw_ostream &dump(llvm::raw_ostream &out, int index);
+    llvm::StringRef getName();
 
-    llvm::Function *codegen();
+    friend class FlatAST;
 };
 
 
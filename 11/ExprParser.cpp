@@ -3,397 +3,419 @@
 //
 
 #include "ExprParser.h"
+#include <cassert>
 #include <iostream>
-#include <sstream>
-
-
-/// 解析的 token 类型枚举，这里都是负数，token 如果不是这里的类型，会返回 0-255 返回的 ascii 码
-enum Token {
-    token_eof = -1,
-    token_def = -2,
-    token_extern = -3,
-    token_identifier = -4,
-    token_number = -5,
-
-    // 控制流关键字
-    token_if = -6,
-    token_then = -7,
-    token_else = -8,
+#include <cstring>
+#include "NumberLiteral.h"
+#include "CodeGenerator.h"
+#include "CodegenContext.h"
+#include "Token.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/Function.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+
+/// 字符类别，用于查表代替 isspace/isalpha 等逐个判断
+enum CharClass {
+    char_space = 1,
+    char_alpha = 2,
+    char_digit = 4,
+    char_newline = 8,
+};
 
-    // 循环控制关键字
-    token_for = -9,
-    token_in = -10,
+static constexpr unsigned char charClassOf(int c) {
+    return c == '\n' || c == '\r' ? char_space | char_newline
+         : c == ' ' || c == '\t' || c == '\v' || c == '\f' ? char_space
+         : (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ? char_alpha
+         : c >= '0' && c <= '9' ? char_digit
+         : 0;
+}
 
-    // 用户自定义运算符的关键字
-    token_binary = -11, // 二元
-    token_unary = -12,  // 一元
+#define CHAR_CLASS_4(c) charClassOf(c), charClassOf(c + 1), charClassOf(c + 2), charClassOf(c + 3)
+#define CHAR_CLASS_16(c) CHAR_CLASS_4(c), CHAR_CLASS_4(c + 4), CHAR_CLASS_4(c + 8), CHAR_CLASS_4(c + 12)
+#define CHAR_CLASS_64(c) CHAR_CLASS_16(c), CHAR_CLASS_16(c + 16), CHAR_CLASS_16(c + 32), CHAR_CLASS_16(c + 48)
 
-    // 用户定义变量关键字
-    token_var = -13,
+/// 每个字节对应的字符类别，编译期生成
+static constexpr unsigned char kCharClassTable[256] = {
+        CHAR_CLASS_64(0), CHAR_CLASS_64(64), CHAR_CLASS_64(128), CHAR_CLASS_64(192)
 };
 
+#undef CHAR_CLASS_64
+#undef CHAR_CLASS_16
+#undef CHAR_CLASS_4
 
-int ExprParser::getNextChar() {
-    int c = m_codeStream->get();
-    return c;
+static inline bool isCharClass(int c, unsigned charClass) {
+    // EOF 不属于任何类别
+    return c >= 0 && (kCharClassTable[c] & charClass);
 }
 
-int ExprParser::getToken() {
-    // 跳过空格
-    while (isspace(m_lastChar)) {
-        m_lastChar = this->getNextChar();
-    }
 
-    // [a-zA-Z]
-    if (isalpha(m_lastChar)) {
-        // 获取并记录当前这个字符串
-        m_lastTokenIdentifierString = m_lastChar;
-        // [a-zA-Z0-9]
-        while (isalnum(m_lastChar = this->getNextChar())) {
-            m_lastTokenIdentifierString += m_lastChar;
-        }
+/// 关键字表中的一项
+struct KeywordEntry {
+    const char *name;
+    unsigned length;
+    int token;
+};
 
-        // 针对当前字符串的值进行判断，这部分都是一些语言的关键字
-        if (m_lastTokenIdentifierString == "def") {
-            return token_def;
-        } else if (m_lastTokenIdentifierString == "extern") {
-            return token_extern;
-        } else if (m_lastTokenIdentifierString == "if") {
-            return token_if;
-        } else if (m_lastTokenIdentifierString == "then") {
-            return token_then;
-        } else if (m_lastTokenIdentifierString == "else") {
-            return token_else;
-        } else if (m_lastTokenIdentifierString == "for") {
-            return token_for;
-        } else if (m_lastTokenIdentifierString == "in") {
-            return token_in;
-        } else if (m_lastTokenIdentifierString == "binary") {
-            return token_binary;
-        } else if (m_lastTokenIdentifierString == "unary") {
-            return token_unary;
-        } else if (m_lastTokenIdentifierString == "var") {
-            return token_var;
-        }
+/*
+ * 关键字的完美哈希，用首尾两个字符就能把所有关键字区分到不同的槽里
+ * 增加关键字时需要重新挑选系数，下边的 static_assert 会检查冲突
+ */
+static constexpr unsigned keywordHash(char first, char last) {
+    return ((unsigned char)first + 3u * (unsigned char)last) & 31u;
+}
+
+static_assert(keywordHash('u', 'y') == 0, "unary");
+static_assert(keywordHash('v', 'r') == 12, "var");
+static_assert(keywordHash('b', 'y') == 13, "binary");
+static_assert(keywordHash('e', 'n') == 15, "extern");
+static_assert(keywordHash('i', 'n') == 19, "in");
+static_assert(keywordHash('e', 'e') == 20, "else");
+static_assert(keywordHash('d', 'f') == 22, "def");
+static_assert(keywordHash('i', 'f') == 27, "if");
+static_assert(keywordHash('f', 'r') == 28, "for");
+static_assert(keywordHash('t', 'n') == 30, "then");
+
+/// 以 keywordHash 为下标的关键字表，空槽的 name 为 nullptr
+static const KeywordEntry kKeywordTable[32] = {
+        {"unary", 5, token_unary}, {nullptr, 0, 0}, {nullptr, 0, 0}, {nullptr, 0, 0},
+        {nullptr, 0, 0}, {nullptr, 0, 0}, {nullptr, 0, 0}, {nullptr, 0, 0},
+        {nullptr, 0, 0}, {nullptr, 0, 0}, {nullptr, 0, 0}, {nullptr, 0, 0},
+        {"var", 3, token_var}, {"binary", 6, token_binary}, {nullptr, 0, 0}, {"extern", 6, token_extern},
+        {nullptr, 0, 0}, {nullptr, 0, 0}, {nullptr, 0, 0}, {"in", 2, token_in},
+        {"else", 4, token_else}, {nullptr, 0, 0}, {"def", 3, token_def}, {nullptr, 0, 0},
+        {nullptr, 0, 0}, {nullptr, 0, 0}, {nullptr, 0, 0}, {"if", 2, token_if},
+        {"for", 3, token_for}, {nullptr, 0, 0}, {"then", 4, token_then}, {nullptr, 0, 0},
+};
 
-        // 一个普通的字符串很可能是一个标识，比如变量名
-        return token_identifier;
+/*
+ * 查找关键字，不是关键字时返回 token_identifier
+ */
+static int lookupKeyword(llvm::StringRef identifier) {
+    const KeywordEntry &entry = kKeywordTable[keywordHash(identifier.front(), identifier.back())];
+    if (entry.length == identifier.size() && memcmp(entry.name, identifier.data(), entry.length) == 0) {
+        return entry.token;
     }
-    // [0-9\.]
-    else if (isdigit(m_lastChar) || m_lastChar == '.') {
-        std::string numberString;
-        do {
-            numberString += m_lastChar;
-            m_lastChar = this->getNextChar();
-        } while(isdigit(m_lastChar) || m_lastChar == '.');
 
-        m_lastTokenNumberValue = strtod(numberString.c_str(), nullptr);
+    return token_identifier;
+}
 
-        return token_number;
+/*
+ * 查找两个字符的内建运算符，不是时返回 0
+ */
+static int lookupOperator(int first, int second) {
+    switch (first) {
+        case '<': return second == '=' ? token_less_equal : 0;
+        case '>': return second == '=' ? token_greater_equal : 0;
+        case '=': return second == '=' ? token_equal : 0;
+        case '!': return second == '=' ? token_not_equal : 0;
+        case '&': return second == '&' ? token_and : 0;
+        case '|': return second == '|' ? token_or : 0;
+        default: return 0;
     }
-    // # 开头的一行为注释
-    else if (m_lastChar == '#') {
-        do {
-            m_lastChar = this->getNextChar();
-        } while(m_lastChar != EOF && m_lastChar != '\n' && m_lastChar != '\r');
+}
 
-        if (m_lastChar != EOF) {
-            return this->getToken();
-        } else {
-            return token_eof;
-        }
-    }
-    else {
-        if (m_lastChar == EOF) {
-            return token_eof;
-        } else {
-            // 如果 m_lastChar 是一个不认识的字符，比如 '('，
-            // 那么下次解析时，m_lastChar 应该指向了下一个字符，不然会重复返回 '('
-            int thisChar = m_lastChar;
-            m_lastChar = getNextChar();
 
-            return thisChar;
+/*
+ * 下边几个函数从 ptr 开始向后扫描，返回第一个不满足条件的位置
+ * 有 SSE2 时每次比较 16 个字节，剩下不足 16 个字节的部分逐个查表
+ */
+static const char *skipSpaces(const char *ptr, const char *end) {
+#ifdef __SSE2__
+    const __m128i nine = _mm_set1_epi8(9);
+    const __m128i four = _mm_set1_epi8(4);
+    const __m128i space = _mm_set1_epi8(' ');
+    while (end - ptr >= 16) {
+        __m128i chars = _mm_loadu_si128((const __m128i *)ptr);
+        // '\t' '\n' '\v' '\f' '\r' 是 9..13，减去 9 后无符号地不大于 4
+        __m128i control = _mm_sub_epi8(chars, nine);
+        __m128i isControl = _mm_cmpeq_epi8(_mm_min_epu8(control, four), control);
+        __m128i isSpace = _mm_or_si128(isControl, _mm_cmpeq_epi8(chars, space));
+        unsigned mask = (unsigned)_mm_movemask_epi8(isSpace);
+        if (mask != 0xFFFF) {
+            return ptr + __builtin_ctz(~mask);
         }
+        ptr += 16;
+    }
+#endif
+    while (ptr != end && isCharClass((unsigned char)*ptr, char_space)) {
+        ++ptr;
     }
-}
 
-void ExprParser::getNextToken() {
-    m_lastToken = getToken();
+    return ptr;
 }
 
-int ExprParser::getTokenPrecedence(int token) {
-    // 不认识的字符
-    if (!isascii(token)) {
-        return -1;
+static const char *skipIdentifier(const char *ptr, const char *end) {
+#ifdef __SSE2__
+    const __m128i lowerBit = _mm_set1_epi8(0x20);
+    const __m128i letterA = _mm_set1_epi8('a');
+    const __m128i digit0 = _mm_set1_epi8('0');
+    const __m128i twentyFive = _mm_set1_epi8(25);
+    const __m128i nine = _mm_set1_epi8(9);
+    while (end - ptr >= 16) {
+        __m128i chars = _mm_loadu_si128((const __m128i *)ptr);
+        // 大写字母或上 0x20 变成小写，减去 'a' 后无符号地不大于 25
+        __m128i letter = _mm_sub_epi8(_mm_or_si128(chars, lowerBit), letterA);
+        __m128i isLetter = _mm_cmpeq_epi8(_mm_min_epu8(letter, twentyFive), letter);
+        __m128i digit = _mm_sub_epi8(chars, digit0);
+        __m128i isDigit = _mm_cmpeq_epi8(_mm_min_epu8(digit, nine), digit);
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_or_si128(isLetter, isDigit));
+        if (mask != 0xFFFF) {
+            return ptr + __builtin_ctz(~mask);
+        }
+        ptr += 16;
     }
-
-    int tokenPrecedence = kBinaryOPPrecedence[token];
-    if (tokenPrecedence <= 0) {
-        return -1;
-    } else {
-        return tokenPrecedence;
+#endif
+    while (ptr != end && isCharClass((unsigned char)*ptr, char_alpha | char_digit)) {
+        ++ptr;
     }
-}
 
-void ExprParser::logError(const char *string) {
-    fprintf(stderr, "LogError: %s\n", string);
+    return ptr;
 }
 
-std::unique_ptr<ExprAST> ExprParser::parseNumberExpr() {
-    auto result = llvm::make_unique<NumberExprAST>(m_lastTokenNumberValue);
-    getNextToken();
+static const char *skipComment(const char *ptr, const char *end) {
+#ifdef __SSE2__
+    const __m128i lineFeed = _mm_set1_epi8('\n');
+    const __m128i carriageReturn = _mm_set1_epi8('\r');
+    while (end - ptr >= 16) {
+        __m128i chars = _mm_loadu_si128((const __m128i *)ptr);
+        __m128i isNewline = _mm_or_si128(_mm_cmpeq_epi8(chars, lineFeed), _mm_cmpeq_epi8(chars, carriageReturn));
+        unsigned mask = (unsigned)_mm_movemask_epi8(isNewline);
+        if (mask != 0) {
+            return ptr + __builtin_ctz(mask);
+        }
+        ptr += 16;
+    }
+#endif
+    while (ptr != end && !isCharClass((unsigned char)*ptr, char_newline)) {
+        ++ptr;
+    }
 
-    return std::move(result);
+    return ptr;
 }
 
-std::unique_ptr<ExprAST> ExprParser::parseUnary() {
-    // 如果当前字符不是一个合法的一元运算符，那么交给其他解析去处理
-    if (!isascii(m_lastToken) || m_lastToken == '(' || m_lastToken == ',') {
-        return this->parsePrimary();
-    }
 
-    // 记录当前一元运算符的 ascii 码
-    int operatorChar = m_lastToken;
-    // 记录一元运算符的运算对象
-    this->getNextToken();
-    if (auto operand = this->parseUnary()) {
-        return llvm::make_unique<UnaryExprAST>(operatorChar, std::move(operand));
+int ExprParser::getNextChar() {
+    if (m_bufferPtr == m_bufferEnd) {
+        return EOF;
     }
-    return nullptr;
+
+    return (unsigned char)*m_bufferPtr++;
 }
 
-std::unique_ptr<ExprAST> ExprParser::parseBinaryOPRHS(int exprPrecedence, std::unique_ptr<ExprAST> lhs) {
+int ExprParser::getToken() {
     while (1) {
-        int tokenPrecedence = this->getTokenPrecedence(m_lastToken);
-
-        // 后续表达式的优先级低于当前解析的部分，那么当前解析的部分可以作为整体返回了
-        if (tokenPrecedence < exprPrecedence) {
-            return lhs;
-        }
-
-        // 因为 exprPrecedence 初始为 0，所以如果上边判断条件不成立
-        // 那么 token 必然是一个我们定义了优先级的二元操作符
-        int binaryOP = m_lastToken;
-        this->getNextToken();
-
-        // 此处也优先查看右值是否是一个一元运算符的计算
-        auto rhs = parseUnary();
-        if (!rhs) {
-            return nullptr;
+        // 跳过空格，m_lastChar 已经从缓冲区中读出，整段空白从 m_bufferPtr 开始
+        if (isCharClass(m_lastChar, char_space)) {
+            m_bufferPtr = skipSpaces(m_bufferPtr, m_bufferEnd);
+            m_lastChar = this->getNextChar();
         }
 
-        // 下一个 token 的优先级如果大于当前部分
-        // 那么它一定是另一个优先级更高的二元操作符
-        // 那么我们将右边的所有表达式作为一个整体当做右值
-        // 即优先计算他们，将他们的计算结果作为当前操作符的右值
-        int nextPrecedence = this->getTokenPrecedence(m_lastToken);
-        if (tokenPrecedence < nextPrecedence) {
-            rhs = parseBinaryOPRHS(tokenPrecedence + 1, std::move(rhs));
-            if (!rhs) {
-                return nullptr;
-            }
+        // # 开头的一行为注释，跳过之后继续找下一个 token
+        if (m_lastChar == '#') {
+            m_bufferPtr = skipComment(m_bufferPtr, m_bufferEnd);
+            m_lastChar = this->getNextChar();
+            continue;
         }
 
-        // 我们将当前的计算结果作为一个整体
-        // 在下一次循环看是不是还继续是操作符
-        // 比如 a+b+c 这种，我们在这不相当于做了 (a+b)
-        // 后边我们将它作为整体计算 (a+b)+c
-        lhs = llvm::make_unique<BinaryExprAST>(binaryOP, std::move(lhs), std::move(rhs));
-    }
-}
-
-std::unique_ptr<ExprAST> ExprParser::parseExpression() {
-    // 优先查看其是否是一个一元运算符，parseUnary() 中会检查 parsePrimary
-    auto lhs = this->parseUnary();
-    if (!lhs) {
-        return nullptr;
+        break;
     }
 
-    // 初始优先级设为 0 使得我们自定义的操作符优先于当前表达式，其余为 -1，
-    return this->parseBinaryOPRHS(0, std::move(lhs));
-}
-
-std::unique_ptr<ExprAST> ExprParser::parseParentExpr() {
-    this->getNextToken();
-    auto v = this->parseExpression();
-    if (!v) {
-        return nullptr;
-    }
+    // [a-zA-Z]
+    if (isCharClass(m_lastChar, char_alpha)) {
+        // m_lastChar 已经从缓冲区中读出，所以字符串从它的前一个位置开始
+        const char *identifierStart = m_bufferPtr - 1;
+        // [a-zA-Z0-9]
+        m_bufferPtr = skipIdentifier(m_bufferPtr, m_bufferEnd);
+        m_lastTokenIdentifierString = llvm::StringRef(identifierStart, m_bufferPtr - identifierStart);
+        m_lastChar = this->getNextChar();
 
-    if (m_lastToken != ')') {
-        this->logError("Expected ')'");
+        // 关键字直接查表，一个普通的字符串很可能是一个标识，比如变量名
+        int token = lookupKeyword(m_lastTokenIdentifierString);
+        if (token == token_identifier) {
+            // 标识符只在这里查找一次字符串，之后都使用编号
+            m_lastTokenSymbol = this->internIdentifier(m_lastTokenIdentifierString);
+        }
 
-        return nullptr;
+        return token;
     }
+    // [0-9\.]
+    else if (isCharClass(m_lastChar, char_digit) || m_lastChar == '.') {
+        const char *numberEnd = m_bufferPtr - 1;
+        bool isValid = parseNumberLiteral(numberEnd, m_bufferEnd, m_lastTokenNumberValue, m_lastTokenIsInteger,
+                                          m_lastTokenIntegerValue);
+        m_bufferPtr = numberEnd;
+        m_lastChar = this->getNextChar();
 
-    // 下次该解析 ')' 后边的东西了，这个 getNextToken 提前拿出 ‘)’
-    getNextToken();
-
-    return v;
-}
-
-std::unique_ptr<ExprAST> ExprParser::parseIdentifierExpr() {
-    std::string identifierName = m_lastTokenIdentifierString;
+        if (!isValid) {
+            this->logError("Malformed number literal");
 
-    getNextToken();
+            return token_error;
+        }
 
-    if (m_lastToken != '(') {
-        return llvm::make_unique<VariableExprAST>(identifierName);
+        return token_number;
     }
+    else {
+        if (m_lastChar == EOF) {
+            return token_eof;
+        } else {
+            // 如果 m_lastChar 是一个不认识的字符，比如 '('，
+            // 那么下次解析时，m_lastChar 应该指向了下一个字符，不然会重复返回 '('
+            int thisChar = m_lastChar;
+            m_lastChar = getNextChar();
 
-    getNextToken();
-    std::vector<std::unique_ptr<ExprAST>> args;
-    if (m_lastToken != ')') {
-        while (1) {
-            if (auto arg = parseExpression()) {
-                args.push_back(std::move(arg));
-            } else {
-                return nullptr;
-            }
-
-            if (m_lastToken == ')') {
-                break;
-            }
-
-            if (m_lastToken != ',') {
-                logError("Expected ')' or ',' in argument list");
+            // <= >= == != && || 是一个 token
+            if (int operatorToken = lookupOperator(thisChar, m_lastChar)) {
+                m_lastChar = getNextChar();
 
-                return nullptr;
+                return operatorToken;
             }
 
-            getNextToken();
+            return thisChar;
         }
     }
+}
 
-    // 下次该解析 ')' 后边的东西了，这个 getNextToken 提前拿出 ‘)’
-    getNextToken();
+void ExprParser::getNextToken() {
+    m_lastToken = getToken();
+}
 
-    return llvm::make_unique<CallExprAST>(identifierName, std::move(args));
+int ExprParser::getTokenPrecedence(int token) {
+    // 直接查中缀表，不认识的字符和关键字都返回 -1
+    return m_operatorTable->getBinaryPrecedence(token);
 }
 
-std::unique_ptr<ExprAST> ExprParser::parseIfExpr() {
-    // 走过 if
-    getNextToken();
+void ExprParser::logError(const char *string) {
+    if (m_errorBuffer) {
+        m_errorBuffer->append("LogError: ");
+        m_errorBuffer->append(string);
+        m_errorBuffer->append("\n");
+    } else {
+        fprintf(stderr, "LogError: %s\n", string);
+    }
+}
 
-    auto condition = parseExpression();
-    if (!condition) {
-        return nullptr;
+Symbol ExprParser::internIdentifier(llvm::StringRef name) {
+    auto result = m_symbolCache.insert(std::make_pair(name, kEmptySymbol));
+    if (result.second) {
+        result.first->getValue() = kIdentifierTable.intern(name);
     }
 
-    if (m_lastToken != token_then) {
-        logError("Expected then");
+    return result.first->getValue();
+}
 
-        return nullptr;
+ExprAST *ExprParser::createNumber(double val) {
+    if (m_hashConsing) {
+        return m_hashConsTable.getNumber(*m_context, val);
     }
-    // 走过 then
-    getNextToken();
 
-    auto then = parseExpression();
-    if (!then) {
-        return nullptr;
+    return m_context->create<NumberExprAST>(val);
+}
+
+ExprAST *ExprParser::createInteger(int64_t integer) {
+    if (m_hashConsing) {
+        return m_hashConsTable.getInteger(*m_context, integer);
     }
 
-    if (m_lastToken != token_else) {
-        logError("Expecte else");
+    return m_context->create<NumberExprAST>(integer);
+}
 
-        return nullptr;
+ExprAST *ExprParser::createVariable(Symbol name) {
+    if (m_hashConsing) {
+        return m_hashConsTable.getVariable(*m_context, name);
     }
-    // 走过 else
-    getNextToken();
 
-    auto elseExpression = parseExpression();
-    if (!elseExpression) {
-        return nullptr;
+    return m_context->create<VariableExprAST>(name);
+}
+
+ExprAST *ExprParser::createBinary(char op, ExprAST *lhs, ExprAST *rhs) {
+    if (m_hashConsing) {
+        return m_hashConsTable.getBinary(*m_context, op, lhs, rhs);
     }
 
-    return llvm::make_unique<IfExprAST>(std::move(condition), std::move(then), std::move(elseExpression));
+    return m_context->create<BinaryExprAST>(op, lhs, rhs);
 }
 
-std::unique_ptr<ExprAST> ExprParser::parseForExpr() {
+bool ExprParser::parseTypeAnnotation(ValueType &type) {
     getNextToken();
     if (m_lastToken != token_identifier) {
-        logError("Expected identifier after for");
+        logError("Expected type name after ':'");
 
-        return nullptr;
+        return false;
     }
-    std::string idName = m_lastTokenIdentifierString;
 
-    getNextToken();
-    if (m_lastToken != '=') {
-        logError("Expected '=' after for");
+    if (m_lastTokenIdentifierString == "i64") {
+        type = type_i64;
+    } else if (m_lastTokenIdentifierString == "double") {
+        type = type_double;
+    } else if (m_lastTokenIdentifierString == "vec2") {
+        type = type_vec2;
+    } else if (m_lastTokenIdentifierString == "vec4") {
+        type = type_vec4;
+    } else {
+        logError("Unknown type name, expected i64, double, vec2 or vec4");
 
-        return nullptr;
+        return false;
     }
 
     getNextToken();
-    auto start = parseExpression();
-    if (nullptr == start) {
-        return nullptr;
-    }
-    if (m_lastToken != ',') {
-        logError("Expected ',' after for start value");
+    return true;
+}
 
-        return nullptr;
-    }
+bool ExprParser::parseLoopHints(LoopHints &hints) {
+    while (m_lastToken == token_identifier) {
+        if (m_lastTokenIdentifierString == "vectorize") {
+            hints.m_vectorize = true;
+            getNextToken();
+        } else if (m_lastTokenIdentifierString == "unroll") {
+            getNextToken();
+            if (m_lastToken != token_number || !m_lastTokenIsInteger || m_lastTokenIntegerValue < 1 ||
+                m_lastTokenIntegerValue > 1024) {
+                logError("Expected unroll count: must be 1..1024");
 
-    getNextToken();
-    auto end = parseExpression();
-    if (!end) {
-        return nullptr;
-    }
+                return false;
+            }
+            hints.m_unrollCount = (unsigned)m_lastTokenIntegerValue;
+            getNextToken();
+        } else {
+            logError("Unknown loop hint, expected vectorize or unroll");
 
-    // step 是可选的
-    std::unique_ptr<ExprAST> step;
-    if (m_lastToken == ',') {
-        getNextToken();
-        step = parseExpression();
-        if (!step) {
-            return nullptr;
+            return false;
         }
     }
 
-    if (m_lastToken != token_in) {
-        logError("Expected 'in' after for");
-
-        return nullptr;
-    }
-
-    getNextToken();
-    auto body = parseExpression();
-    if (!body) {
-        return nullptr;
-    }
-
-    return llvm::make_unique<ForExprAST>(idName, std::move(start), std::move(end), std::move(step), std::move(body));
+    return true;
 }
 
-std::unique_ptr<ExprAST> ExprParser::parseVarExpr() {
-    std::vector<std::pair<std::string, std::unique_ptr<ExprAST>>> varNames;
-
-    getNextToken();
-    if (m_lastToken != token_identifier) {
-        logError("Expected identifier after var");
-
-        return nullptr;
-    }
-
+bool ExprParser::parseVarList(ParseFrame &frame, bool afterBinding) {
     while (1) {
-        // 变量名
-        std::string name = m_lastTokenIdentifierString;
-        // 记录右值表达式
-        std::unique_ptr<ExprAST> init;
-
-        getNextToken();
-        if (m_lastToken == '=') {
+        if (!afterBinding) {
+            // 变量名和可选的类型
+            Symbol name = m_lastTokenSymbol;
+            ValueType type = type_auto;
 
             getNextToken();
-            init = parseExpression();
-            if (!init) {
-                return nullptr;
+            if (m_lastToken == ':' && !this->parseTypeAnnotation(type)) {
+                return false;
             }
-        }
 
-        varNames.push_back(std::make_pair(name, std::move(init)));
+            if (m_lastToken == '=') {
+                // 先解析右值表达式，解析完后再回到这里
+                getNextToken();
+                frame.m_kind = ParseFrame::frame_var_init;
+                frame.m_symbol = name;
+                frame.m_type = type;
+
+                return true;
+            }
+
+            VarBinding binding = {name, type, nullptr};
+            m_bindingStack.push_back(binding);
+        }
+        afterBinding = false;
 
         // var 用 ',' 来同时定义多个变量，如果找不到 ','，那么循环就可以结束了
         if (m_lastToken != ',') {
@@ -405,7 +427,7 @@ std::unique_ptr<ExprAST> ExprParser::parseVarExpr() {
         if (m_lastToken != token_identifier) {
             logError("Expected identifier list after var");
 
-            return nullptr;
+            return false;
         }
     }
 
@@ -413,56 +435,332 @@ std::unique_ptr<ExprAST> ExprParser::parseVarExpr() {
     if (m_lastToken != token_in) {
         logError("Expected 'in' keywork after 'var'");
 
-        return nullptr;
+        return false;
     }
 
-    // 解析主体表达式
+    // 接下来解析主体表达式
     getNextToken();
-    auto body = parseExpression();
-    if (!body) {
-        return nullptr;
-    }
+    frame.m_kind = ParseFrame::frame_var_body;
 
-    return llvm::make_unique<VarExprAST>(std::move(varNames), std::move(body));
+    return true;
 }
 
-std::unique_ptr<ExprAST> ExprParser::parsePrimary() {
-    switch (m_lastToken) {
-        case token_identifier: {
-            return parseIdentifierExpr();
-        } break;
+ExprAST *ExprParser::parseExpression() {
+    // 只处理本次调用压入的帧，出错时把栈恢复到进入时的样子
+    size_t frameBase = m_parseStack.size();
+    size_t argBase = m_argStack.size();
+    size_t bindingBase = m_bindingStack.size();
+    ExprAST *operand = nullptr;
 
-        case token_number: {
-            return parseNumberExpr();
-        } break;
+    while (1) {
+        // 期待一个运算对象，按前缀表分发
+        // 如果当前字符是一个合法的一元运算符，先记下它，运算对象解析完后再生成节点
+        PrefixKind prefixKind;
+        while ((prefixKind = m_operatorTable->getPrefixKind(m_lastToken)) == prefix_unary) {
+            ParseFrame frame(ParseFrame::frame_unary);
+            frame.m_op = (char)m_lastToken;
+            m_parseStack.push_back(frame);
+            getNextToken();
+        }
 
-        case '(': {
-            return parseParentExpr();
-        } break;
+        bool needOperand = true;
+        switch (prefixKind) {
+            // 解析 a 或 a(‘expression’, 'expression') 这种写法
+            case prefix_identifier: {
+                Symbol identifierName = m_lastTokenSymbol;
 
-        case token_if: {
-            return parseIfExpr();
-        } break;
+                getNextToken();
+                if (m_lastToken != '(') {
+                    operand = this->createVariable(identifierName);
+                    needOperand = false;
+                    break;
+                }
 
-        case token_for: {
-            return parseForExpr();
-        } break;
+                getNextToken();
+                if (m_lastToken == ')') {
+                    // 下次该解析 ')' 后边的东西了，这个 getNextToken 提前拿出 ‘)’
+                    getNextToken();
+                    operand = m_context->create<CallExprAST>(identifierName, llvm::ArrayRef<ExprAST *>());
+                    needOperand = false;
+                    break;
+                }
 
-        case token_var: {
-            return parseVarExpr();
-        } break;
+                ParseFrame frame(ParseFrame::frame_call);
+                frame.m_symbol = identifierName;
+                frame.m_listBegin = (unsigned)m_argStack.size();
+                m_parseStack.push_back(frame);
+            } break;
+
+            case prefix_number: {
+                if (m_lastTokenIsInteger) {
+                    operand = this->createInteger(m_lastTokenIntegerValue);
+                } else {
+                    operand = this->createNumber(m_lastTokenNumberValue);
+                }
+                getNextToken();
+                needOperand = false;
+            } break;
 
-        default: {
-            logError("Unknown token when expecting an expression");
+            // 解析类似 (expression) 的写法
+            case prefix_paren: {
+                getNextToken();
+                m_parseStack.push_back(ParseFrame(ParseFrame::frame_paren));
+            } break;
 
-            return nullptr;
-        } break;
+            // 解析 if then else 这样的写法，走过 if
+            case prefix_if: {
+                getNextToken();
+                m_parseStack.push_back(ParseFrame(ParseFrame::frame_if_condition));
+            } break;
+
+            // 解析 for in 写法
+            case prefix_for: {
+                // 循环的优化结果按 for 的位置报告
+                SourceLocation location = this->getSourceLocation(m_lastTokenIdentifierString.data());
+                getNextToken();
+                if (m_lastToken != token_identifier) {
+                    logError("Expected identifier after for");
+
+                    goto error;
+                }
+                Symbol idName = m_lastTokenSymbol;
+
+                getNextToken();
+                if (m_lastToken != '=') {
+                    logError("Expected '=' after for");
+
+                    goto error;
+                }
+
+                getNextToken();
+                ParseFrame frame(ParseFrame::frame_for_start);
+                frame.m_symbol = idName;
+                frame.m_location = location;
+                m_parseStack.push_back(frame);
+            } break;
+
+            // 解析 var a = 1.0 in ... 写法
+            case prefix_var: {
+                getNextToken();
+                if (m_lastToken != token_identifier) {
+                    logError("Expected identifier after var");
+
+                    goto error;
+                }
+
+                ParseFrame frame(ParseFrame::frame_var_init);
+                frame.m_listBegin = (unsigned)m_bindingStack.size();
+                m_parseStack.push_back(frame);
+                if (!this->parseVarList(m_parseStack.back(), false)) {
+                    goto error;
+                }
+            } break;
+
+            case prefix_error: {
+                goto error;
+            } break;
+
+            case prefix_unary:
+            case prefix_none: {
+                logError("Unknown token when expecting an expression");
+
+                goto error;
+            } break;
+        }
+
+        if (needOperand) {
+            continue;
+        }
+
+        // 已经有了一个运算对象，把它交给栈顶等待它的结构
+        while (1) {
+            // 一元运算符只作用在紧跟着它的运算对象上
+            while (m_parseStack.size() > frameBase && m_parseStack.back().m_kind == ParseFrame::frame_unary) {
+                operand = m_context->create<UnaryExprAST>(m_parseStack.back().m_op, operand);
+                m_parseStack.pop_back();
+            }
+
+            // 优先级不低于下一个二元操作符的部分可以作为一个整体了
+            // 比如 a+b+c 这种，遇到第二个 + 时先做 (a+b)，后边将它作为整体计算 (a+b)+c
+            int tokenPrecedence = this->getTokenPrecedence(m_lastToken);
+            while (m_parseStack.size() > frameBase && m_parseStack.back().m_kind == ParseFrame::frame_binary &&
+                   m_parseStack.back().m_precedence >= tokenPrecedence) {
+                const ParseFrame &frame = m_parseStack.back();
+                operand = this->createBinary(frame.m_op, frame.m_exprs[0], operand);
+                m_parseStack.pop_back();
+            }
+
+            // 下一个 token 是中缀表中的二元操作符，当前的运算对象是它的左值
+            if (tokenPrecedence >= 0) {
+                ParseFrame frame(ParseFrame::frame_binary);
+                frame.m_op = (char)m_lastToken;
+                frame.m_precedence = tokenPrecedence;
+                frame.m_exprs[0] = operand;
+                m_parseStack.push_back(frame);
+                getNextToken();
+                break;
+            }
+
+            // 当前表达式结束了
+            if (m_parseStack.size() == frameBase) {
+                return operand;
+            }
+
+            ParseFrame &frame = m_parseStack.back();
+            bool finished = false;
+            switch (frame.m_kind) {
+                case ParseFrame::frame_paren: {
+                    if (m_lastToken != ')') {
+                        this->logError("Expected ')'");
+
+                        goto error;
+                    }
+
+                    // 下次该解析 ')' 后边的东西了，这个 getNextToken 提前拿出 ‘)’
+                    getNextToken();
+                    finished = true;
+                } break;
+
+                case ParseFrame::frame_call: {
+                    m_argStack.push_back(operand);
+                    if (m_lastToken == ')') {
+                        getNextToken();
+                        llvm::ArrayRef<ExprAST *> args(m_argStack);
+                        operand = m_context->create<CallExprAST>(frame.m_symbol,
+                                                                 m_context->copyArray(args.slice(frame.m_listBegin)));
+                        m_argStack.resize(frame.m_listBegin);
+                        finished = true;
+                        break;
+                    }
+
+                    if (m_lastToken != ',') {
+                        logError("Expected ')' or ',' in argument list");
+
+                        goto error;
+                    }
+
+                    getNextToken();
+                } break;
+
+                case ParseFrame::frame_if_condition: {
+                    if (m_lastToken != token_then) {
+                        logError("Expected then");
+
+                        goto error;
+                    }
+                    // 走过 then
+                    getNextToken();
+                    frame.m_exprs[0] = operand;
+                    frame.m_kind = ParseFrame::frame_if_then;
+                } break;
+
+                case ParseFrame::frame_if_then: {
+                    if (m_lastToken != token_else) {
+                        logError("Expecte else");
+
+                        goto error;
+                    }
+                    // 走过 else
+                    getNextToken();
+                    frame.m_exprs[1] = operand;
+                    frame.m_kind = ParseFrame::frame_if_else;
+                } break;
+
+                case ParseFrame::frame_if_else: {
+                    operand = m_context->create<IfExprAST>(frame.m_exprs[0], frame.m_exprs[1], operand);
+                    finished = true;
+                } break;
+
+                case ParseFrame::frame_for_start: {
+                    if (m_lastToken != ',') {
+                        logError("Expected ',' after for start value");
+
+                        goto error;
+                    }
+
+                    getNextToken();
+                    frame.m_exprs[0] = operand;
+                    frame.m_kind = ParseFrame::frame_for_end;
+                } break;
+
+                case ParseFrame::frame_for_end:
+                case ParseFrame::frame_for_step: {
+                    if (frame.m_kind == ParseFrame::frame_for_end) {
+                        frame.m_exprs[1] = operand;
+                        // step 是可选的
+                        if (m_lastToken == ',') {
+                            getNextToken();
+                            frame.m_kind = ParseFrame::frame_for_step;
+                            break;
+                        }
+                    } else {
+                        frame.m_exprs[2] = operand;
+                    }
+
+                    if (!this->parseLoopHints(frame.m_loopHints)) {
+                        goto error;
+                    }
+
+                    if (m_lastToken != token_in) {
+                        logError("Expected 'in' after for");
+
+                        goto error;
+                    }
+
+                    getNextToken();
+                    frame.m_kind = ParseFrame::frame_for_body;
+                } break;
+
+                case ParseFrame::frame_for_body: {
+                    operand = m_context->create<ForExprAST>(frame.m_symbol, frame.m_exprs[0], frame.m_exprs[1],
+                                                            frame.m_exprs[2], operand, frame.m_loopHints);
+                    operand->setLocation(frame.m_location);
+                    finished = true;
+                } break;
+
+                case ParseFrame::frame_var_init: {
+                    VarBinding binding = {frame.m_symbol, frame.m_type, operand};
+                    m_bindingStack.push_back(binding);
+                    if (!this->parseVarList(frame, true)) {
+                        goto error;
+                    }
+                } break;
+
+                case ParseFrame::frame_var_body: {
+                    llvm::ArrayRef<VarBinding> varNames(m_bindingStack);
+                    operand = m_context->create<VarExprAST>(m_context->copyArray(varNames.slice(frame.m_listBegin)),
+                                                            operand);
+                    m_bindingStack.resize(frame.m_listBegin);
+                    finished = true;
+                } break;
+
+                case ParseFrame::frame_unary:
+                case ParseFrame::frame_binary: {
+                    // 上边已经处理过了
+                } break;
+            }
+
+            if (!finished) {
+                // 接着解析下一个子表达式
+                break;
+            }
+
+            // 当前结构解析完了，它整体作为一个运算对象交给外层
+            m_parseStack.pop_back();
+        }
     }
+
+error:
+    m_parseStack.erase(m_parseStack.begin() + frameBase, m_parseStack.end());
+    m_argStack.resize(argBase);
+    m_bindingStack.resize(bindingBase);
+
+    return nullptr;
 }
 
-std::unique_ptr<PrototypeAST> ExprParser::parsePrototype() {
-    // 记录函数名
-    std::string functionName;
+PrototypeAST *ExprParser::parsePrototype() {
+    // 记录函数名，运算符的函数名是 unary/binary 加上运算符
+    llvm::SmallString<16> functionName;
     // 函数类型定义
     enum FunctionKind {
         // 普通函数
@@ -477,6 +775,15 @@ std::unique_ptr<PrototypeAST> ExprParser::parsePrototype() {
     // 记录二元运算符的优先级
     unsigned binaryPrecedence = 30;
 
+    // 函数名之前的 float 或 double 是这个函数的浮点精度，比如 def float dot(x y) ...
+    FloatMode floatMode = float_default;
+    if (m_lastToken == token_identifier &&
+        (m_lastTokenIdentifierString == "float" || m_lastTokenIdentifierString == "double")) {
+        floatMode = m_lastTokenIdentifierString == "float" ? float_single : float_double;
+        functionName = m_lastTokenIdentifierString;
+        getNextToken();
+    }
+
     switch (m_lastToken) {
         case token_identifier: {
             functionName = m_lastTokenIdentifierString;
@@ -493,7 +800,7 @@ std::unique_ptr<PrototypeAST> ExprParser::parsePrototype() {
             }
 
             functionName = "unary";
-            functionName += m_lastToken;
+            functionName += (char)m_lastToken;
             kind = Unary;
             getNextToken();
         } break;
@@ -508,7 +815,7 @@ std::unique_ptr<PrototypeAST> ExprParser::parsePrototype() {
             }
 
             functionName = "binary";
-            functionName += m_lastToken;
+            functionName += (char)m_lastToken;
             kind = Binary;
 
             getNextToken();
@@ -523,6 +830,16 @@ std::unique_ptr<PrototypeAST> ExprParser::parsePrototype() {
             }
         } break;
 
+        case '(': {
+            // 函数本身就叫 float 或者 double，没有写精度
+            if (floatMode == float_default) {
+                logError("Expected Function name in prototype");
+
+                return nullptr;
+            }
+            floatMode = float_default;
+        } break;
+
         default: {
             logError("Expected Function name in prototype");
 
@@ -536,12 +853,17 @@ std::unique_ptr<PrototypeAST> ExprParser::parsePrototype() {
 
         return nullptr;
     }
-    std::vector<std::string> argNames;
+    llvm::SmallVector<Symbol, 8> argNames;
+    llvm::SmallVector<ValueType, 8> argTypes;
     getNextToken();
     while (m_lastToken == token_identifier) {
-        argNames.push_back(m_lastTokenIdentifierString);
+        argNames.push_back(m_lastTokenSymbol);
+        argTypes.push_back(type_double);
 
         getNextToken();
+        if (m_lastToken == ':' && !this->parseTypeAnnotation(argTypes.back())) {
+            return nullptr;
+        }
     }
     if (m_lastToken != ')') {
         logError("Expected ')' in prototype");
@@ -559,10 +881,22 @@ std::unique_ptr<PrototypeAST> ExprParser::parsePrototype() {
     // 准备给后续 parse 的下一个 token
     getNextToken();
 
-    return llvm::make_unique<PrototypeAST>(functionName, std::move(argNames), kind != Identifier, binaryPrecedence);
+    // ')' 之后的 ':' 是返回值的类型
+    ValueType returnType = type_double;
+    if (m_lastToken == ':' && !this->parseTypeAnnotation(returnType)) {
+        return nullptr;
+    }
+
+    auto prototype = m_context->create<PrototypeAST>(this->internIdentifier(functionName),
+                                                     m_context->copyArray(llvm::makeArrayRef(argNames)),
+                                                     m_context->copyArray(llvm::makeArrayRef(argTypes)), returnType,
+                                                     kind != Identifier, binaryPrecedence);
+    prototype->setFloatMode(floatMode);
+
+    return prototype;
 }
 
-std::unique_ptr<FunctionAST> ExprParser::parseDefinition() {
+FunctionAST *ExprParser::parseDefinition() {
     // 将 def 走过去
     getNextToken();
 
@@ -574,86 +908,225 @@ std::unique_ptr<FunctionAST> ExprParser::parseDefinition() {
 
     // 解析函数的实现，并生成函数实现 AST 节点
     if (auto expression = parseExpression()) {
-        return llvm::make_unique<FunctionAST>(std::move(prototype), std::move(expression));
+        return m_context->create<FunctionAST>(prototype, expression);
     }
 
     return nullptr;
 }
 
-std::unique_ptr<PrototypeAST> ExprParser::parseExtern() {
+PrototypeAST *ExprParser::parseExtern() {
     // 将 extern 走过去
     getNextToken();
 
     return parsePrototype();
 }
 
-std::unique_ptr<FunctionAST> ExprParser::parseTopLevelExpr() {
+FunctionAST *ExprParser::parseTopLevelExpr() {
     if (auto expression = parseExpression()) {
-        auto prototype = llvm::make_unique<PrototypeAST>("", std::vector<std::string>());
+        auto prototype = m_context->create<PrototypeAST>(kEmptySymbol, llvm::ArrayRef<Symbol>());
 
-        return llvm::make_unique<FunctionAST>(std::move(prototype), std::move(expression));
+        return m_context->create<FunctionAST>(prototype, expression);
     }
 
     return nullptr;
 }
 
-void ExprParser::handleDefinition() {
-    if (auto functionAST = parseDefinition()) {
-        if (auto *functionIR = functionAST->codegen()) {
-            fprintf(stderr, "Read function definition:");
-            functionIR->dump();
-        }
+ExprParser::ExprParser()
+        : m_bufferPtr(nullptr), m_bufferEnd(nullptr), m_sourceStart(nullptr), m_sourceStartFixed(false), m_firstLine(1),
+          m_lineCursor(nullptr), m_cursorLine(1), m_cursorLineStart(nullptr), m_lastChar(' '), m_lastToken(0), m_lastTokenSymbol(kEmptySymbol),
+          m_lastTokenNumberValue(0), m_lastTokenIsInteger(false), m_lastTokenIntegerValue(0), m_errorBuffer(nullptr),
+          m_operatorTable(&kOperatorTable), m_codegenContext(nullptr), m_hashConsing(false) {
+
+}
+
+void ExprParser::setHashConsing(bool enabled) {
+    m_hashConsing = enabled;
+}
+
+void ExprParser::setOperatorTable(const OperatorTable *operatorTable) {
+    m_operatorTable = operatorTable;
+}
+
+void ExprParser::setCodegenContext(CodegenContext *codegenContext) {
+    m_codegenContext = codegenContext;
+    m_operatorTable = &codegenContext->getOperatorTable();
+}
+
+void ExprParser::emitTopLevelItem(CodegenContext &codegenContext, FlatAST &flatAST, const TopLevelItem &item) {
+    if (!item.m_errors.empty()) {
+        fputs(item.m_errors.c_str(), stderr);
+    }
+
+    switch (item.m_kind) {
+        case TopLevelItem::item_definition:
+        case TopLevelItem::item_expression: {
+            if (item.m_function) {
+                emitFunction(codegenContext, flatAST, flatAST.addFunction(item.m_function));
+            }
+        } break;
+
+        case TopLevelItem::item_extern: {
+            if (item.m_prototype) {
+                emitFunction(codegenContext, flatAST, flatAST.addPrototype(item.m_prototype));
+            }
+        } break;
     }
 }
 
-void ExprParser::handleExtern() {
-    if (auto protoAST = parseExtern()) {
-        if (auto protoIR = protoAST->codegen()) {
+llvm::Function *ExprParser::emitFunction(CodegenContext &codegenContext, const FlatAST &flatAST,
+                                         FunctionIndex function) {
+    const FlatFunction &flatFunction = flatAST.getFunction(function);
+    if (flatFunction.m_body == kNoNode) {
+        auto protoIR = CodeGenerator(codegenContext, flatAST).codegenPrototype(function);
+        if (protoIR) {
             fprintf(stderr, "Read extern:");
             protoIR->dump();
         }
+
+        return protoIR;
+    }
+
+    auto functionIR = CodeGenerator(codegenContext, flatAST).codegenFunction(function);
+    if (functionIR) {
+        // 顶层表达式生成的是匿名函数
+        fprintf(stderr, flatFunction.m_name == kEmptySymbol ? "Read top-level expr:" : "Read function definition:");
+        functionIR->dump();
     }
+
+    return functionIR;
 }
 
-void ExprParser::handleTopLevelExpression() {
-    if (auto expressionAST = parseTopLevelExpr()) {
-        if (auto expressionIR = expressionAST->codegen()) {
-            fprintf(stderr, "Read top-level expr:");
-            expressionIR->dump();
+bool ExprParser::parseTopLevelItem(TopLevelItem &item) {
+    item.m_function = nullptr;
+    item.m_prototype = nullptr;
+
+    getNextToken();
+    switch (m_lastToken) {
+        case token_eof: {
+            return false;
+        }
+
+        case token_def: {
+            item.m_kind = TopLevelItem::item_definition;
+            item.m_function = parseDefinition();
+
+            break;
+        }
+
+        case token_extern: {
+            item.m_kind = TopLevelItem::item_extern;
+            item.m_prototype = parseExtern();
+
+            break;
+        }
+
+        default: {
+            item.m_kind = TopLevelItem::item_expression;
+            item.m_function = parseTopLevelExpr();
+
+            break;
         }
     }
+
+    return true;
 }
 
-void ExprParser::startParse(std::string codeString) {
-    m_codeStream = new std::istringstream();
-    m_codeStream->str(codeString);
+bool ExprParser::startParseFile(const std::string &fileName) {
+    // 足够大的文件 MemoryBuffer 会直接 mmap，不会整体读入一份拷贝
+    auto fileOrError = llvm::MemoryBuffer::getFile(fileName, -1, false);
+    if (!fileOrError) {
+        fprintf(stderr, "Could not open file %s: %s\n", fileName.c_str(), fileOrError.getError().message().c_str());
+
+        return false;
+    }
+
+    m_fileBuffer = std::move(fileOrError.get());
+    this->startParse(m_fileBuffer->getBuffer());
+
+    return true;
+}
+
+std::shared_ptr<ASTContext> ExprParser::getASTContext() {
+    return m_context;
+}
+
+const FlatAST& ExprParser::getFlatAST() {
+    return m_flatAST;
+}
+
+void ExprParser::resetBuffer(llvm::StringRef codeString) {
+    m_bufferPtr = codeString.begin();
+    m_bufferEnd = codeString.end();
     m_lastChar = ' ';
     m_lastToken = 0;
+    if (!m_sourceStartFixed) {
+        m_sourceStart = codeString.begin();
+        m_lineCursor = nullptr;
+    }
+}
 
-    while (1) {
-        getNextToken();
-        switch (m_lastToken) {
-            case token_eof: {
-                return;
-            }
+void ExprParser::setSourceStart(const char *sourceStart) {
+    m_sourceStart = sourceStart;
+    m_sourceStartFixed = true;
+    m_lineCursor = nullptr;
+}
 
-            case token_def: {
-                handleDefinition();
+SourceLocation ExprParser::getSourceLocation(const char *position) {
+    // 换了一段输入，或者这段在上次数到的位置之前，从头数起
+    if (!m_lineCursor || position < m_lineCursor) {
+        m_lineCursor = m_sourceStart;
+        m_cursorLine = m_firstLine;
+        m_cursorLineStart = m_sourceStart;
+    }
 
-                break;
-            }
+    while (auto newline = (const char *)memchr(m_lineCursor, '\n', position - m_lineCursor)) {
+        ++m_cursorLine;
+        m_lineCursor = newline + 1;
+        m_cursorLineStart = m_lineCursor;
+    }
+    m_lineCursor = position;
 
-            case token_extern: {
-                handleExtern();
+    SourceLocation location = {m_cursorLine, (unsigned)(position - m_cursorLineStart) + 1};
+    return location;
+}
 
-                break;
-            }
+void ExprParser::startParse(llvm::StringRef codeString) {
+    assert(m_codegenContext && "startParse needs a CodegenContext");
 
-            default: {
-                handleTopLevelExpression();
+    // 每次解析都是一个新的翻译单元，上一次的 AST 没有其他地方持有时直接复用它的内存，否则交给持有方释放
+    if (m_context && m_context.use_count() == 1) {
+        m_context->reset();
+    } else {
+        m_context = std::make_shared<ASTContext>();
+    }
+    m_hashConsTable.clear();
+    m_flatAST.clear();
+    this->resetBuffer(codeString);
+
+    // 每个定义解析完马上生成代码，后边的定义才能用到前边定义的运算符优先级
+    TopLevelItem item;
+    while (this->parseTopLevelItem(item)) {
+        emitTopLevelItem(*m_codegenContext, m_flatAST, item);
+    }
+    ++m_firstLine;
+}
 
-                break;
-            }
+void ExprParser::parseTopLevelItems(llvm::StringRef codeString, std::vector<TopLevelItem> &items) {
+    if (!m_context) {
+        m_context = std::make_shared<ASTContext>();
+        m_hashConsTable.clear();
+    }
+    this->resetBuffer(codeString);
+
+    while (1) {
+        TopLevelItem item;
+        m_errorBuffer = &item.m_errors;
+        bool hasItem = this->parseTopLevelItem(item);
+        m_errorBuffer = nullptr;
+        if (!hasItem) {
+            return;
         }
+
+        items.push_back(std::move(item));
     }
 }
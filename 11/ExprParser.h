@@ -7,22 +7,144 @@
 
 
 #include <string>
+#include <vector>
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "ASTContext.h"
 #include "ExprAST.h"
+#include "FlatAST.h"
+#include "HashConsTable.h"
+#include "OperatorTable.h"
+
+class CodegenContext;
+
+namespace llvm {
+    class Function;
+}
+
+
+/*
+ * 解析出的一个顶层定义，还没有生成代码
+ */
+struct TopLevelItem {
+    enum Kind {
+        item_definition,
+        item_extern,
+        item_expression,
+    };
+
+    Kind m_kind;
+    /// item_definition 和 item_expression 的函数，解析失败时为 nullptr
+    FunctionAST *m_function;
+    /// item_extern 的函数原型，解析失败时为 nullptr
+    PrototypeAST *m_prototype;
+    /// 解析这个定义时产生的错误信息，只在 parseTopLevelItems 中记录
+    std::string m_errors;
+};
+
+
+/*
+ * parseExpression 显式栈上的一个还没有解析完的结构，等待它的下一个子表达式
+ */
+struct ParseFrame {
+    enum Kind : uint8_t {
+        /// 一元运算符 m_op，等待运算对象
+        frame_unary,
+        /// 二元运算符 m_op，左值是 m_exprs[0]，等待右值
+        frame_binary,
+        /// '(' 等待括号中的表达式
+        frame_paren,
+        /// 调用 m_symbol，等待下一个参数，已经解析出的参数在 m_argStack 中 m_listBegin 之后
+        frame_call,
+        /// if 等待条件、then 和 else 的表达式，已经解析出的放在 m_exprs 中
+        frame_if_condition,
+        frame_if_then,
+        frame_if_else,
+        /// for m_symbol 等待 start、end、step 和 body 的表达式，已经解析出的放在 m_exprs 中
+        frame_for_start,
+        frame_for_end,
+        frame_for_step,
+        frame_for_body,
+        /// var 等待类型为 m_type 的变量 m_symbol 的初值，已经解析出的变量在 m_bindingStack 中 m_listBegin 之后
+        frame_var_init,
+        /// var 等待主体表达式
+        frame_var_body,
+    };
+
+    Kind m_kind;
+    char m_op;
+    ValueType m_type;
+    int m_precedence;
+    Symbol m_symbol;
+    unsigned m_listBegin;
+    ExprAST *m_exprs[3];
+    /// for 在 in 之前写的优化提示和 for 的源码位置
+    LoopHints m_loopHints;
+    SourceLocation m_location;
+
+    explicit ParseFrame(Kind kind)
+            : m_kind(kind), m_op(0), m_type(type_auto), m_precedence(0), m_symbol(kEmptySymbol), m_listBegin(0),
+              m_exprs{nullptr, nullptr, nullptr}, m_loopHints{false, 0}, m_location{0, 0} {
+    }
+};
 
 
 class ExprParser {
 private:
-    /// 输入的代码字符串流
-    std::istringstream *m_codeStream;
+    /// 通过 startParseFile 映射进内存的源文件，startParse 时输入由调用方持有
+    std::unique_ptr<llvm::MemoryBuffer> m_fileBuffer;
+    /// 当前翻译单元的 AST 节点都分配在这里
+    std::shared_ptr<ASTContext> m_context;
+    /// 当前翻译单元展开后的 AST，代码生成在这上面进行
+    FlatAST m_flatAST;
+    /// 当前解析器读到的位置，直接在输入缓冲区上移动，不做拷贝
+    const char *m_bufferPtr;
+    /// 输入缓冲区的结束位置
+    const char *m_bufferEnd;
+    /// 源码位置的行号从这里数起，没有 setSourceStart 时是每段输入的开头
+    const char *m_sourceStart;
+    bool m_sourceStartFixed;
+    /// m_sourceStart 所在的行号，startParse 每次的输入从新的一行开始
+    unsigned m_firstLine;
+    /// 已经数过换行的位置、它所在的行号和这一行的开头，源码位置只在需要时往后数
+    const char *m_lineCursor;
+    unsigned m_cursorLine;
+    const char *m_cursorLineStart;
 
     /// 当前解析器遍历到的最新字符
     int m_lastChar;
     /// 当前解析器当前正在解析的 token
     int m_lastToken;
-    /// m_lastToken 为 token_identifier 时，记下当前的 token 字符串
-    std::string m_lastTokenIdentifierString;
+    /// 指向输入缓冲区中最近一次读到的标识符或关键字字符串
+    llvm::StringRef m_lastTokenIdentifierString;
+    /// m_lastToken 为 token_identifier 时，当前标识符在 kIdentifierTable 中的编号
+    Symbol m_lastTokenSymbol;
     /// m_lastToken 为 token_number 时，记下当前的值
     double m_lastTokenNumberValue;
+    /// m_lastToken 为 token_number 时，常量是否是 i64 常量，是的话它的精确值
+    bool m_lastTokenIsInteger;
+    int64_t m_lastTokenIntegerValue;
+
+    /// 当前解析器见过的标识符，命中时不需要访问加锁的 kIdentifierTable
+    llvm::StringMap<Symbol> m_symbolCache;
+    /// 不为空时错误信息追加到这里，否则直接打印
+    std::string *m_errorBuffer;
+    /// 解析时查询的运算符表
+    const OperatorTable *m_operatorTable;
+    /// startParse 解析出的定义在这里生成代码
+    CodegenContext *m_codegenContext;
+    /// 是否把结构相同、没有副作用的子表达式合并成一个节点
+    bool m_hashConsing;
+    /// m_hashConsing 打开时当前 ASTContext 中可以共享的节点
+    HashConsTable m_hashConsTable;
+
+    /// parseExpression 中还没有解析完的结构
+    std::vector<ParseFrame> m_parseStack;
+    /// 还没有解析完的函数调用已经解析出的参数
+    std::vector<ExprAST *> m_argStack;
+    /// 还没有解析完的 var 已经解析出的变量
+    std::vector<VarBinding> m_bindingStack;
 
 private:
     /*
@@ -38,6 +160,11 @@ private:
      */
     void getNextToken();
 
+    /*
+     * 返回标识符的编号
+     */
+    Symbol internIdentifier(llvm::StringRef name);
+
     /*
      * 取的 token 的优先级
      */
@@ -49,74 +176,122 @@ private:
     void logError(const char *string);
 
     /*
-     * 解析数字
+     * 解析 ':' 之后的类型名，当前 token 是 ':'，成功后当前 token 是类型名之后的 token
      */
-    std::unique_ptr<ExprAST> parseNumberExpr();
+    bool parseTypeAnnotation(ValueType &type);
+
     /*
-     * 解析一元运算符表达式
+     * 创建数字、变量和二元运算节点，打开 hash consing 时可能返回已有的节点
      */
-    std::unique_ptr<ExprAST> parseUnary();
+    ExprAST *createNumber(double val);
+    ExprAST *createInteger(int64_t integer);
+    ExprAST *createVariable(Symbol name);
+    ExprAST *createBinary(char op, ExprAST *lhs, ExprAST *rhs);
     /*
-     * 解析表达式
-     * 递归的使用自身解析
-     * 输入是当前的表达式和其优先级，
-     * 默认输入 0，lhs，
-     * 这样当后接一个二元操作符，比如 + 时，后续的表达式优先级比当前输入大
+     * 解析 var 的变量列表，直到需要解析一个表达式（变量的初值或者 var 的主体）为止
+     * afterBinding 为 true 时刚解析完一个变量的初值，否则当前 token 是变量名
      */
-    std::unique_ptr<ExprAST> parseBinaryOPRHS(int exprPrecedence, std::unique_ptr<ExprAST> lhs);
+    bool parseVarList(ParseFrame &frame, bool afterBinding);
+    /*
+     * 解析 for 在 in 之前的 vectorize 和 unroll N，当前 token 是结束条件或步进之后的 token
+     * 它们不是关键字，在这个位置之外仍然可以当作变量名
+     */
+    bool parseLoopHints(LoopHints &hints);
     /*
      * 解析普通的表达式
-     * 递归的使用 parseBinaryOPRHS 实现解析
+     * Pratt 解析：表达式的开头按前缀表分发，之后按中缀表中的优先级决定二元运算符的结合
+     * 不使用递归，未完成的一元、二元运算和 if for var 等结构都记在 m_parseStack 中，
+     * 嵌套深度只受堆内存的限制
      */
-    std::unique_ptr<ExprAST> parseExpression();
+    ExprAST *parseExpression();
     /*
-     * 解析类似 (expression) 的写法
+     * 解析 func(a, b, c) 这种写法，即函数定义
+     * 解析二元运算符的函数定义
+     * 参数和返回值可以写类型，比如 func(a:i64 b):i64，没有写时是 double
      */
-    std::unique_ptr<ExprAST> parseParentExpr();
+    PrototypeAST *parsePrototype();
     /*
-     * 解析 a 或 a(‘expression’, 'expression') 这种写法
+     * 解析 def func(a, b) 这种写法，即函数实现
      */
-    std::unique_ptr<ExprAST> parseIdentifierExpr();
+    FunctionAST *parseDefinition();
     /*
-     * 解析 if then else 这样的写法
+     * 解析 extern func 这种写法，即提前声明的函数定义
      */
-    std::unique_ptr<ExprAST> parseIfExpr();
+    PrototypeAST *parseExtern();
     /*
-     * 解析 for in 写法
+     * 解析在全局作用范围内的表达式，即最顶层写的，不在任何函数中的表达式
      */
-    std::unique_ptr<ExprAST> parseForExpr();
+    FunctionAST *parseTopLevelExpr();
+
     /*
-     * 解析 var a = 1.0 in ... 写法
+     * 开始解析新的输入缓冲区
      */
-    std::unique_ptr<ExprAST> parseVarExpr();
+    void resetBuffer(llvm::StringRef codeString);
     /*
-     * 能解析大部分表达式 token 的主函数
+     * 输入缓冲区中 position 处的行号和列号，都从 1 开始
+     * 只有 for 这种需要源码位置的节点才会调用，平时的词法分析不数换行
      */
-    std::unique_ptr<ExprAST> parsePrimary();
+    SourceLocation getSourceLocation(const char *position);
     /*
-     * 解析 func(a, b, c) 这种写法，即函数定义
-     * 解析二元运算符的函数定义
+     * 解析下一个顶层定义，输入结束时返回 false
      */
-    std::unique_ptr<PrototypeAST> parsePrototype();
+    bool parseTopLevelItem(TopLevelItem &item);
+
+public:
+    ExprParser();
+
     /*
-     * 解析 def func(a, b) 这种写法，即函数实现
+     * 设置解析时使用的运算符表，默认是 kOperatorTable
+     * 传入一个快照时解析过程中不会看到其他线程对运算符的修改，调用方要保证它比解析器活得久
      */
-    std::unique_ptr<FunctionAST> parseDefinition();
+    void setOperatorTable(const OperatorTable *operatorTable);
     /*
-     * 解析 extern func 这种写法，即提前声明的函数定义
+     * 设置 startParse 生成代码使用的 CodegenContext，同时改用它的运算符表，调用方要保证它比解析器活得久
+     * 只做语法分析时不需要设置
      */
-    std::unique_ptr<PrototypeAST> parseExtern();
+    void setCodegenContext(CodegenContext *codegenContext);
     /*
-     * 解析在全局作用范围内的表达式，即最顶层写的，不在任何函数中的表达式
+     * 打开后结构相同、没有副作用的子表达式共享同一个节点，AST 成为 DAG，生成代码时每个支配域只生成一次
      */
-    std::unique_ptr<FunctionAST> parseTopLevelExpr();
+    void setHashConsing(bool enabled);
+    /*
+     * parseTopLevelItems 的各段代码都来自同一个源文件时，设置文件的开头，源码位置的行号按整个文件计算
+     * 没有设置时行号从每段代码的开头算起
+     */
+    void setSourceStart(const char *sourceStart);
 
-    void handleDefinition();
-    void handleExtern();
-    void handleTopLevelExpression();
+    /*
+     * 生成顶层定义的代码，并打印解析和代码生成的结果
+     */
+    static void emitTopLevelItem(CodegenContext &codegenContext, FlatAST &flatAST, const TopLevelItem &item);
+    /*
+     * 生成 flatAST 中一个已经展开的函数的代码并打印，extern、顶层表达式和函数实现的输出与 emitTopLevelItem 相同
+     * 返回生成的函数，失败时返回 nullptr
+     */
+    static llvm::Function *emitFunction(CodegenContext &codegenContext, const FlatAST &flatAST, FunctionIndex function);
 
-public:
-    void startParse(std::string codeString);
+    /*
+     * 当前翻译单元的 ASTContext，需要在解析结束后继续使用 AST 时（比如 JIT 延迟编译）持有它
+     */
+    std::shared_ptr<ASTContext> getASTContext();
+    /*
+     * 当前翻译单元中已经展开的所有函数
+     */
+    const FlatAST &getFlatAST();
+
+    /*
+     * 解析一段代码并生成代码，codeString 由调用方持有，解析结束前不能释放，之前必须先 setCodegenContext
+     */
+    void startParse(llvm::StringRef codeString);
+    /*
+     * 将源文件映射进内存后解析，文件打不开时返回 false
+     */
+    bool startParseFile(const std::string &fileName);
+    /*
+     * 只做语法分析，把 codeString 中的顶层定义依次追加到 items，不生成代码，错误信息记录在各个 item 中
+     * 多次调用时节点都分配在同一个 ASTContext 中
+     */
+    void parseTopLevelItems(llvm::StringRef codeString, std::vector<TopLevelItem> &items);
 
 };
 
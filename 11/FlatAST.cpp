@@ -0,0 +1,353 @@
+//
+// Created by 董宏昌 on 2017/2/26.
+//
+
+#include "FlatAST.h"
+#include <algorithm>
+#include "Token.h"
+
+
+static_assert(sizeof(FlatNode) == 16, "FlatNode should stay small");
+
+/// FlattenTask 的下标要填进 m_lists 而不是父节点的 m_operands
+static const uint8_t kListSlot = 3;
+
+
+/*
+ * 运算符的写法，两个字符的内建运算符在 m_op 中是 token 的编号
+ */
+static llvm::StringRef getOperatorName(const char &op) {
+    switch (op) {
+        case (char)token_less_equal: return "<=";
+        case (char)token_greater_equal: return ">=";
+        case (char)token_equal: return "==";
+        case (char)token_not_equal: return "!=";
+        case (char)token_and: return "&&";
+        case (char)token_or: return "||";
+        default: return llvm::StringRef(&op, 1);
+    }
+}
+
+
+/*
+ * flatten 中还没有展开的子树，以及展开后它的下标要填到哪里
+ */
+struct FlattenTask {
+    ExprAST *m_expr;
+    /// 父节点的下标，或者 m_lists 中的位置，根节点为 kNoNode
+    uint32_t m_target;
+    /// 填进父节点的第几个子节点，kListSlot 表示填进 m_lists
+    uint8_t m_operand;
+
+    FlattenTask(ExprAST *expr, uint32_t target, uint8_t operand)
+            : m_expr(expr), m_target(target), m_operand(operand) {
+    }
+};
+
+
+static llvm::raw_ostream &indent(llvm::raw_ostream &out, int size) {
+    return out.indent(size);
+}
+
+
+NodeIndex FlatAST::addNode(ASTKind kind, const SourceLocation &location) {
+    // 先整体清零，填充字节也是确定的，写出的 .ksb 文件内容只由 AST 决定
+    FlatNode flatNode = FlatNode();
+    flatNode.m_kind = kind;
+    flatNode.m_op = 0;
+    flatNode.m_flags = 0;
+    flatNode.m_operands[0] = flatNode.m_operands[1] = flatNode.m_operands[2] = kNoNode;
+
+    m_nodes.push_back(flatNode);
+    m_locations.push_back(location);
+
+    return (NodeIndex)m_nodes.size() - 1;
+}
+
+uint32_t FlatAST::addList(unsigned count) {
+    uint32_t first = (uint32_t)m_lists.size();
+    m_lists.resize(m_lists.size() + count, kNoNode);
+
+    return first;
+}
+
+NodeIndex FlatAST::flatten(ExprAST *root) {
+    // 不使用递归，还没有展开的子树放在栈上
+    // 先放下父节点，再展开子节点，子节点的下标展开后再填回去
+    // 子节点逆序入栈，出栈的顺序和递归展开时一样，节点仍然按先序排列
+    NodeIndex rootNode = kNoNode;
+    llvm::SmallVector<FlattenTask, 64> tasks;
+    tasks.push_back(FlattenTask(root, kNoNode, kListSlot));
+
+    while (!tasks.empty()) {
+        FlattenTask task = tasks.back();
+        tasks.pop_back();
+
+        ExprAST *expr = task.m_expr;
+        NodeIndex node = kNoNode;
+        if (expr->isShared()) {
+            // 共享节点只展开一次，之后直接引用第一次展开的节点
+            auto found = m_sharedNodes.find(expr);
+            if (found != m_sharedNodes.end()) {
+                node = found->second;
+            }
+        }
+
+        bool expanded = node != kNoNode;
+        if (!expanded) {
+            node = this->addNode(expr->getKind(), expr->getLocation());
+            if (expr->isShared()) {
+                m_nodes[node].m_flags = expr_shared;
+                m_sharedNodes[expr] = node;
+            }
+        }
+
+        if (task.m_target == kNoNode) {
+            rootNode = node;
+        } else if (task.m_operand == kListSlot) {
+            m_lists[task.m_target] = node;
+        } else {
+            m_nodes[task.m_target].m_operands[task.m_operand] = node;
+        }
+
+        if (expanded) {
+            continue;
+        }
+
+        switch (expr->getKind()) {
+            case ast_number: {
+                auto numberExpr = static_cast<NumberExprAST *>(expr);
+                m_nodes[node].m_op = numberExpr->m_type;
+                if (numberExpr->m_type == type_i64) {
+                    m_nodes[node].m_operands[0] = (uint32_t)m_integers.size();
+                    m_integers.push_back(numberExpr->m_integer);
+                } else {
+                    m_nodes[node].m_operands[0] = (uint32_t)m_numbers.size();
+                    m_numbers.push_back(numberExpr->m_val);
+                }
+            } break;
+
+            case ast_variable: {
+                auto variableExpr = static_cast<VariableExprAST *>(expr);
+                m_nodes[node].m_operands[0] = variableExpr->m_name;
+            } break;
+
+            case ast_unary: {
+                auto unaryExpr = static_cast<UnaryExprAST *>(expr);
+                m_nodes[node].m_op = unaryExpr->m_operatorCode;
+                tasks.push_back(FlattenTask(unaryExpr->m_operand, node, 0));
+            } break;
+
+            case ast_binary: {
+                auto binaryExpr = static_cast<BinaryExprAST *>(expr);
+                m_nodes[node].m_op = binaryExpr->m_op;
+                tasks.push_back(FlattenTask(binaryExpr->m_rhs, node, 1));
+                tasks.push_back(FlattenTask(binaryExpr->m_lhs, node, 0));
+            } break;
+
+            case ast_call: {
+                auto callExpr = static_cast<CallExprAST *>(expr);
+                unsigned count = (unsigned)callExpr->m_args.size();
+                uint32_t firstArg = this->addList(count);
+                m_nodes[node].m_operands[0] = callExpr->m_callee;
+                m_nodes[node].m_operands[1] = firstArg;
+                m_nodes[node].m_operands[2] = count;
+                for (unsigned i = count; i > 0; --i) {
+                    tasks.push_back(FlattenTask(callExpr->m_args[i - 1], firstArg + i - 1, kListSlot));
+                }
+            } break;
+
+            case ast_if: {
+                auto ifExpr = static_cast<IfExprAST *>(expr);
+                tasks.push_back(FlattenTask(ifExpr->m_else, node, 2));
+                tasks.push_back(FlattenTask(ifExpr->m_then, node, 1));
+                tasks.push_back(FlattenTask(ifExpr->m_condition, node, 0));
+            } break;
+
+            case ast_for: {
+                auto forExpr = static_cast<ForExprAST *>(expr);
+                uint32_t parts = this->addList(5);
+                m_nodes[node].m_operands[0] = forExpr->m_varName;
+                m_nodes[node].m_operands[2] = parts;
+                m_lists[parts + 3] = forExpr->m_hints.m_vectorize;
+                m_lists[parts + 4] = forExpr->m_hints.m_unrollCount;
+                tasks.push_back(FlattenTask(forExpr->m_body, parts + 2, kListSlot));
+                if (forExpr->m_step) {
+                    tasks.push_back(FlattenTask(forExpr->m_step, parts + 1, kListSlot));
+                }
+                tasks.push_back(FlattenTask(forExpr->m_end, parts, kListSlot));
+                tasks.push_back(FlattenTask(forExpr->m_start, node, 1));
+            } break;
+
+            case ast_var: {
+                auto varExpr = static_cast<VarExprAST *>(expr);
+                unsigned count = (unsigned)varExpr->m_varNames.size();
+                uint32_t firstVar = this->addList(count * 3);
+                m_nodes[node].m_operands[0] = firstVar;
+                m_nodes[node].m_operands[1] = count;
+                tasks.push_back(FlattenTask(varExpr->m_body, node, 2));
+                for (unsigned i = count; i > 0; --i) {
+                    const VarBinding &binding = varExpr->m_varNames[i - 1];
+                    uint32_t slot = firstVar + (i - 1) * 3;
+                    m_lists[slot] = binding.m_name;
+                    m_lists[slot + 2] = binding.m_type;
+                    if (binding.m_init) {
+                        tasks.push_back(FlattenTask(binding.m_init, slot + 1, kListSlot));
+                    }
+                }
+            } break;
+        }
+    }
+
+    return rootNode;
+}
+
+FunctionIndex FlatAST::addPrototypeWithBody(PrototypeAST *prototype, ExprAST *body) {
+    FlatFunction flatFunction = FlatFunction();
+    flatFunction.m_name = prototype->m_name;
+    flatFunction.m_argCount = (uint32_t)prototype->m_args.size();
+    flatFunction.m_firstArg = this->addList(flatFunction.m_argCount * 2);
+    std::copy(prototype->m_args.begin(), prototype->m_args.end(), m_lists.begin() + flatFunction.m_firstArg);
+    for (uint32_t i = 0; i < flatFunction.m_argCount; ++i) {
+        m_lists[flatFunction.m_firstArg + flatFunction.m_argCount + i] = prototype->getArgType(i);
+    }
+    flatFunction.m_body = body ? this->flatten(body) : kNoNode;
+    flatFunction.m_isOperator = prototype->m_isOperator;
+    flatFunction.m_returnType = prototype->m_returnType;
+    flatFunction.m_floatMode = prototype->m_floatMode;
+    flatFunction.m_precedence = prototype->m_precedence;
+    flatFunction.m_line = prototype->m_line;
+
+    m_functions.push_back(flatFunction);
+
+    return (FunctionIndex)m_functions.size() - 1;
+}
+
+FunctionIndex FlatAST::addFunction(FunctionAST *function) {
+    return this->addPrototypeWithBody(function->m_prototype, function->m_body);
+}
+
+FunctionIndex FlatAST::addPrototype(PrototypeAST *prototype) {
+    return this->addPrototypeWithBody(prototype, nullptr);
+}
+
+void FlatAST::clear() {
+    m_nodes.clear();
+    m_locations.clear();
+    m_numbers.clear();
+    m_integers.clear();
+    m_lists.clear();
+    m_functions.clear();
+    m_sharedNodes.clear();
+}
+
+llvm::raw_ostream& FlatAST::dumpNode(llvm::raw_ostream &out, NodeIndex node, int index) const {
+    if (node == kNoNode) {
+        return out << "null\n";
+    }
+
+    const SourceLocation &location = this->getLocation(node);
+    switch (this->getKind(node)) {
+        case ast_number: {
+            if (this->getNumberType(node) == type_i64) {
+                out << this->getInteger(node);
+            } else {
+                out << this->getNumber(node);
+            }
+        } break;
+
+        case ast_variable: {
+            out << kIdentifierTable.getString(this->getSymbol(node));
+        } break;
+
+        case ast_unary: {
+            out << "unary" << getOperatorName(m_nodes[node].m_op);
+        } break;
+
+        case ast_binary: {
+            out << "binary" << getOperatorName(m_nodes[node].m_op);
+        } break;
+
+        case ast_call: {
+            out << "call " << kIdentifierTable.getString(this->getSymbol(node));
+        } break;
+
+        case ast_if: {
+            out << "if";
+        } break;
+
+        case ast_for: {
+            out << "for";
+            LoopHints hints = this->getForHints(node);
+            if (hints.m_vectorize) {
+                out << " vectorize";
+            }
+            if (hints.m_unrollCount) {
+                out << " unroll " << hints.m_unrollCount;
+            }
+        } break;
+
+        case ast_var: {
+            out << "var";
+        } break;
+    }
+    out << ':' << location.line << ':' << location.col << '\n';
+
+    // 子节点
+    switch (this->getKind(node)) {
+        case ast_number:
+        case ast_variable: {
+        } break;
+
+        case ast_unary: {
+            this->dumpNode(out, this->getFirstChild(node), index + 1);
+        } break;
+
+        case ast_binary: {
+            this->dumpNode(indent(out, index) << "lhs:", this->getFirstChild(node), index + 1);
+            this->dumpNode(indent(out, index) << "rhs:", this->getSecondChild(node), index + 1);
+        } break;
+
+        case ast_call: {
+            for (NodeIndex arg : this->getCallArgs(node)) {
+                this->dumpNode(indent(out, index + 1), arg, index + 1);
+            }
+        } break;
+
+        case ast_if: {
+            this->dumpNode(indent(out, index) << "condition:", this->getFirstChild(node), index + 1);
+            this->dumpNode(indent(out, index) << "then:", this->getSecondChild(node), index + 1);
+            this->dumpNode(indent(out, index) << "else:", this->getThirdChild(node), index + 1);
+        } break;
+
+        case ast_for: {
+            this->dumpNode(indent(out, index) << "condition:", this->getSecondChild(node), index + 1);
+            this->dumpNode(indent(out, index) << "end:", this->getForEnd(node), index + 1);
+            this->dumpNode(indent(out, index) << "step:", this->getForStep(node), index + 1);
+            this->dumpNode(indent(out, index) << "body:", this->getForBody(node), index + 1);
+        } break;
+
+        case ast_var: {
+            for (unsigned i = 0; i < this->getVarCount(node); ++i) {
+                llvm::StringRef varName = kIdentifierTable.getString(this->getVarName(node, i));
+                NodeIndex init = this->getVarInit(node, i);
+                if (init != kNoNode) {
+                    this->dumpNode(indent(out, index) << varName << ':', init, index + 1);
+                } else {
+                    indent(out, index) << varName << ":\n";
+                }
+            }
+            this->dumpNode(indent(out, index) << "body:", this->getThirdChild(node), index + 1);
+        } break;
+    }
+
+    return out;
+}
+
+llvm::raw_ostream& FlatAST::dump(llvm::raw_ostream &out, FunctionIndex function, int index) const {
+    indent(out, index) << "FunctionAST\n";
+    ++index;
+    indent(out, index) << "body:";
+
+    return this->dumpNode(out, this->getFunction(function).m_body, index);
+}
@@ -0,0 +1,218 @@
+//
+// Created by 董宏昌 on 2017/2/26.
+//
+
+#ifndef PROJECT_FLATAST_H
+#define PROJECT_FLATAST_H
+
+
+#include <cstdint>
+#include <vector>
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/raw_ostream.h"
+#include "ExprAST.h"
+
+
+/// 节点在 FlatAST 中的下标
+typedef uint32_t NodeIndex;
+/// 函数在 FlatAST 中的下标
+typedef uint32_t FunctionIndex;
+
+/// 没有节点，比如 for 没有写步进、var 没有写初值、extern 没有函数体
+static const NodeIndex kNoNode = ~0u;
+
+
+/*
+ * 展开后的表达式节点，固定 16 字节
+ * m_operands 的含义由 m_kind 决定：
+ * ast_number   [0] 常量在 m_numbers 或 m_integers 中的下标，m_op 是常量的类型
+ * ast_variable [0] 变量名
+ * ast_unary    [0] 运算对象，m_op 是运算符
+ * ast_binary   [0] 左值 [1] 右值，m_op 是运算符
+ * ast_call     [0] 被调用函数名 [1] 参数在 m_lists 中的开始位置 [2] 参数个数
+ * ast_if       [0] 条件 [1] then [2] else
+ * ast_for      [0] 循环变量名 [1] 初值 [2] 在 m_lists 中依次保存结束条件、步进、循环体、是否向量化、展开次数的开始位置
+ * ast_var      [0] 在 m_lists 中依次保存变量名、初值、类型的开始位置 [1] 变量个数 [2] 作用域中的表达式
+ */
+struct FlatNode {
+    ASTKind m_kind;
+    char m_op;
+    /// ExprFlags 的组合，只会有 expr_shared
+    uint8_t m_flags;
+    uint32_t m_operands[3];
+};
+
+
+/*
+ * 展开后的函数定义，extern 的函数体是 kNoNode
+ */
+struct FlatFunction {
+    Symbol m_name;
+    /// 参数名在 m_lists 中的开始位置和个数，参数名之后紧跟着各个参数的类型
+    uint32_t m_firstArg;
+    uint32_t m_argCount;
+    NodeIndex m_body;
+    bool m_isOperator;
+    ValueType m_returnType;
+    FloatMode m_floatMode;
+    unsigned m_precedence;
+    unsigned m_line;
+};
+
+
+/*
+ * 数组形式的 AST
+ * 节点按类型连续地保存在几个数组里，子节点用 32 位下标引用，遍历时按 m_kind switch
+ * 节点按先序排列，父节点总在子节点之前，代码生成和 dump 基本是顺序访问内存
+ * 共享节点（expr_shared）只在第一次出现的地方展开，之后的父节点直接引用它，这时子节点可以在父节点之前
+ * 所有数组都是平凡类型，可以直接整块写出和读入，见 BinaryAST
+ */
+class FlatAST {
+private:
+    std::vector<FlatNode> m_nodes;
+    /// 每个节点的源码位置，只在生成调试信息和 dump 时用到，所以不放进 FlatNode
+    std::vector<SourceLocation> m_locations;
+    std::vector<double> m_numbers;
+    std::vector<int64_t> m_integers;
+    /// 参数、变量名这些变长的部分
+    std::vector<uint32_t> m_lists;
+    std::vector<FlatFunction> m_functions;
+    /// 已经展开过的共享节点，再遇到时直接引用，不重复展开
+    llvm::DenseMap<ExprAST *, NodeIndex> m_sharedNodes;
+
+    NodeIndex addNode(ASTKind kind, const SourceLocation &location);
+    uint32_t addList(unsigned count);
+    /*
+     * 把 ExprAST 的子树展开到数组末尾，返回子树根节点的下标
+     * 用显式的栈代替递归，很深的表达式也不会栈溢出
+     */
+    NodeIndex flatten(ExprAST *root);
+    FunctionIndex addPrototypeWithBody(PrototypeAST *prototype, ExprAST *body);
+
+    llvm::raw_ostream &dumpNode(llvm::raw_ostream &out, NodeIndex node, int index) const;
+
+public:
+    /*
+     * 展开一个函数实现，返回它的下标
+     */
+    FunctionIndex addFunction(FunctionAST *function);
+    /*
+     * 展开一个 extern 的函数原型，返回它的下标
+     */
+    FunctionIndex addPrototype(PrototypeAST *prototype);
+    /*
+     * 清空所有节点和函数
+     */
+    void clear();
+
+    size_t getNodeCount() const {
+        return m_nodes.size();
+    }
+    size_t getFunctionCount() const {
+        return m_functions.size();
+    }
+
+    ASTKind getKind(NodeIndex node) const {
+        return m_nodes[node].m_kind;
+    }
+    /// 节点是否被多处引用，只在解析时打开 hash consing 才会出现
+    bool isShared(NodeIndex node) const {
+        return (m_nodes[node].m_flags & expr_shared) != 0;
+    }
+    const SourceLocation &getLocation(NodeIndex node) const {
+        return m_locations[node];
+    }
+    /// ast_number 的类型，type_double 或 type_i64
+    ValueType getNumberType(NodeIndex node) const {
+        return (ValueType)m_nodes[node].m_op;
+    }
+    /// type_double 的 ast_number 的值
+    double getNumber(NodeIndex node) const {
+        return m_numbers[m_nodes[node].m_operands[0]];
+    }
+    /// type_i64 的 ast_number 的值
+    int64_t getInteger(NodeIndex node) const {
+        return m_integers[m_nodes[node].m_operands[0]];
+    }
+    /// ast_variable 的变量名、ast_call 的函数名、ast_for 的循环变量名
+    Symbol getSymbol(NodeIndex node) const {
+        return m_nodes[node].m_operands[0];
+    }
+    /// ast_unary 和 ast_binary 的运算符
+    char getOperator(NodeIndex node) const {
+        return m_nodes[node].m_op;
+    }
+    /// ast_unary 的运算对象，ast_binary 的左值，ast_if 的条件
+    NodeIndex getFirstChild(NodeIndex node) const {
+        return m_nodes[node].m_operands[0];
+    }
+    /// ast_binary 的右值，ast_if 的 then，ast_for 的初值
+    NodeIndex getSecondChild(NodeIndex node) const {
+        return m_nodes[node].m_operands[1];
+    }
+    /// ast_if 的 else，ast_var 的作用域中的表达式
+    NodeIndex getThirdChild(NodeIndex node) const {
+        return m_nodes[node].m_operands[2];
+    }
+    /// ast_call 的各个参数
+    llvm::ArrayRef<NodeIndex> getCallArgs(NodeIndex node) const {
+        const FlatNode &flatNode = m_nodes[node];
+        return llvm::ArrayRef<NodeIndex>(m_lists.data() + flatNode.m_operands[1], flatNode.m_operands[2]);
+    }
+    /// ast_for 的结束条件
+    NodeIndex getForEnd(NodeIndex node) const {
+        return m_lists[m_nodes[node].m_operands[2]];
+    }
+    /// ast_for 的步进，没有写时是 kNoNode
+    NodeIndex getForStep(NodeIndex node) const {
+        return m_lists[m_nodes[node].m_operands[2] + 1];
+    }
+    /// ast_for 的循环体
+    NodeIndex getForBody(NodeIndex node) const {
+        return m_lists[m_nodes[node].m_operands[2] + 2];
+    }
+    /// ast_for 在 in 之前写的优化提示
+    LoopHints getForHints(NodeIndex node) const {
+        uint32_t parts = m_nodes[node].m_operands[2];
+        LoopHints hints = {m_lists[parts + 3] != 0, m_lists[parts + 4]};
+        return hints;
+    }
+    /// ast_var 定义的变量个数
+    unsigned getVarCount(NodeIndex node) const {
+        return m_nodes[node].m_operands[1];
+    }
+    /// ast_var 定义的第 i 个变量名
+    Symbol getVarName(NodeIndex node, unsigned i) const {
+        return m_lists[m_nodes[node].m_operands[0] + i * 3];
+    }
+    /// ast_var 定义的第 i 个变量的初值，没有写时是 kNoNode
+    NodeIndex getVarInit(NodeIndex node, unsigned i) const {
+        return m_lists[m_nodes[node].m_operands[0] + i * 3 + 1];
+    }
+    /// ast_var 定义的第 i 个变量写出的类型，没有写时是 type_auto
+    ValueType getVarType(NodeIndex node, unsigned i) const {
+        return (ValueType)m_lists[m_nodes[node].m_operands[0] + i * 3 + 2];
+    }
+
+    const FlatFunction &getFunction(FunctionIndex function) const {
+        return m_functions[function];
+    }
+    llvm::ArrayRef<Symbol> getArgs(FunctionIndex function) const {
+        const FlatFunction &flatFunction = m_functions[function];
+        return llvm::ArrayRef<Symbol>(m_lists.data() + flatFunction.m_firstArg, flatFunction.m_argCount);
+    }
+    /// 第 i 个参数的类型
+    ValueType getArgType(FunctionIndex function, unsigned i) const {
+        const FlatFunction &flatFunction = m_functions[function];
+        return (ValueType)m_lists[flatFunction.m_firstArg + flatFunction.m_argCount + i];
+    }
+
+    llvm::raw_ostream &dump(llvm::raw_ostream &out, FunctionIndex function, int index) const;
+
+    friend class BinaryAST;
+};
+
+
+#endif //PROJECT_FLATAST_H
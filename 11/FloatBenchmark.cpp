@@ -0,0 +1,183 @@
+//
+// Created by 董宏昌 on 2017/2/28.
+//
+
+/*
+ * 单精度模式的向量化测试
+ * 同一个归约循环分别按 double 和 float 生成，打开 fast-math 后按 O3 优化，
+ * 记录循环向量化后一条向量指令处理的元素个数，以及 JIT 运行的耗时
+ * 向量寄存器的宽度固定，float 的元素个数是 double 的两倍
+ * 用法：llvmTest11FloatBenchmark [循环次数] [重复次数]，默认循环 10000000 次，重复 20 次
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+#include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/ExecutionEngine/MCJIT.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Target/TargetMachine.h"
+#include "CodeGenerator.h"
+#include "CodegenContext.h"
+#include "ExprParser.h"
+#include "ModuleOptimizer.h"
+#include "Token.h"
+
+
+/// 被测的归约循环：n + 1 个 i * x 的和
+static const char kReductionSource[] =
+        "def reduce(n:i64 x) var s = 0.0 in (for i = 0, n < i in s = s + i * x) + s;\n";
+
+
+static double millisecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static bool parseSource(const std::string &source, ExprParser &parser, FlatAST &flatAST) {
+    std::vector<TopLevelItem> items;
+    parser.parseTopLevelItems(source, items);
+    for (const auto &item : items) {
+        if (!item.m_errors.empty()) {
+            fputs(item.m_errors.c_str(), stderr);
+            return false;
+        }
+
+        if (item.m_function) {
+            flatAST.addFunction(item.m_function);
+        } else if (item.m_prototype) {
+            flatAST.addPrototype(item.m_prototype);
+        }
+    }
+
+    return true;
+}
+
+/*
+ * 模块中浮点加法一次处理的最多元素个数，没有被向量化时是 1
+ */
+static unsigned getVectorWidth(llvm::Module &module) {
+    unsigned width = 1;
+    for (auto &function : module) {
+        for (auto &block : function) {
+            for (auto &instruction : block) {
+                if (instruction.getOpcode() == llvm::Instruction::FAdd && instruction.getType()->isVectorTy()) {
+                    width = std::max(width, instruction.getType()->getVectorNumElements());
+                }
+            }
+        }
+    }
+
+    return width;
+}
+
+/*
+ * 按 floatMode 生成、优化、运行一次归约循环，输出一行结果
+ */
+static bool runMode(const FlatAST &flatAST, FloatMode floatMode, int64_t count, unsigned repeats) {
+    bool singlePrecision = floatMode == float_single;
+
+    // 先声明 codegenContext，模块属于它的 llvm 上下文，要比 engine 活得久
+    CodegenContext codegenContext;
+    codegenContext.setFloatMode(floatMode);
+    codegenContext.setFastMath(true);
+    for (FunctionIndex function = 0; function < flatAST.getFunctionCount(); ++function) {
+        if (!CodeGenerator(codegenContext, flatAST).codegenFunction(function)) {
+            return false;
+        }
+    }
+    std::unique_ptr<llvm::Module> module = codegenContext.takeModule();
+
+    // 按本机的 CPU 生成代码，才能用上全部的向量寄存器
+    std::string error;
+    llvm::EngineBuilder engineBuilder;
+    engineBuilder.setErrorStr(&error).setEngineKind(llvm::EngineKind::JIT).setMCPU(llvm::sys::getHostCPUName());
+    llvm::TargetMachine *targetMachine = engineBuilder.selectTarget();
+    if (!targetMachine) {
+        fprintf(stderr, "Could not select target: %s\n", error.c_str());
+        return false;
+    }
+
+    auto optimizeStart = std::chrono::steady_clock::now();
+    ModuleOptimizer(*targetMachine).run(*module);
+    double optimizeTime = millisecondsSince(optimizeStart);
+    unsigned width = getVectorWidth(*module);
+
+    // engine 接管 module 和 targetMachine
+    std::unique_ptr<llvm::ExecutionEngine> engine(
+            llvm::EngineBuilder(std::move(module)).setErrorStr(&error).setEngineKind(llvm::EngineKind::JIT)
+                    .create(targetMachine));
+    if (!engine) {
+        fprintf(stderr, "Could not create JIT: %s\n", error.c_str());
+        return false;
+    }
+    engine->finalizeObject();
+    uint64_t address = engine->getFunctionAddress("reduce");
+    if (!address) {
+        fprintf(stderr, "Could not find reduce\n");
+        return false;
+    }
+
+    // 单精度时参数和返回值也都是 float
+    double result = 0;
+    auto runStart = std::chrono::steady_clock::now();
+    for (unsigned i = 0; i < repeats; ++i) {
+        if (singlePrecision) {
+            result = ((float (*)(int64_t, float))address)(count, 0.5f);
+        } else {
+            result = ((double (*)(int64_t, double))address)(count, 0.5);
+        }
+    }
+    double runTime = millisecondsSince(runStart) / repeats;
+
+    printf("%8s %10lld %8u %14.2f %12.2f %16.6g\n", singlePrecision ? "float" : "double", (long long)count, width,
+           optimizeTime, runTime, result);
+    fflush(stdout);
+
+    return true;
+}
+
+
+int main(int argc, char const *argv[]) {
+    int64_t count = argc > 1 ? strtoll(argv[1], nullptr, 10) : 10000000;
+    unsigned repeats = argc > 2 ? (unsigned)strtoul(argv[2], nullptr, 10) : 20;
+    repeats = std::max(1u, repeats);
+
+    // 和 toy.cpp 中相同的运算符优先级
+    {
+        kOperatorTable.setBinaryPrecedence('=', 2);
+        kOperatorTable.setBinaryPrecedence(token_or, 5);
+        kOperatorTable.setBinaryPrecedence(token_and, 6);
+        kOperatorTable.setBinaryPrecedence(token_equal, 9);
+        kOperatorTable.setBinaryPrecedence(token_not_equal, 9);
+        kOperatorTable.setBinaryPrecedence('<', 10);
+        kOperatorTable.setBinaryPrecedence('>', 10);
+        kOperatorTable.setBinaryPrecedence(token_less_equal, 10);
+        kOperatorTable.setBinaryPrecedence(token_greater_equal, 10);
+        kOperatorTable.setBinaryPrecedence('+', 20);
+        kOperatorTable.setBinaryPrecedence('-', 30);
+        kOperatorTable.setBinaryPrecedence('*', 40);
+    }
+
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+
+    // 两种模式共用一份 AST，浮点精度只在生成代码时决定
+    ExprParser parser;
+    FlatAST flatAST;
+    if (!parseSource(kReductionSource, parser, flatAST)) {
+        return 1;
+    }
+
+    printf("%8s %10s %8s %14s %12s %16s\n", "mode", "count", "lanes", "optimize(ms)", "run(ms)", "result");
+
+    bool succeeded = runMode(flatAST, float_double, count, repeats);
+    succeeded = runMode(flatAST, float_single, count, repeats) && succeeded;
+
+    return succeeded ? 0 : 1;
+}
@@ -0,0 +1,144 @@
+//
+// Created by 董宏昌 on 2017/2/28.
+//
+
+#include "HashConsTable.h"
+#include <cstring>
+#include "llvm/ADT/Hashing.h"
+#include "Token.h"
+
+
+/// 表的初始槽数
+static const unsigned kInitialTableSize = 64;
+
+
+static inline size_t hashKey(ASTKind kind, char op, uint64_t payload, ExprAST *lhs, ExprAST *rhs) {
+    return llvm::hash_combine((unsigned)kind, op, payload, lhs, rhs);
+}
+
+/*
+ * 代码生成时内建的二元运算符，它们只读取两边的值，没有副作用
+ * '>' 可以被 def binary> 覆盖，解析时还不知道会不会，所以不算在内
+ */
+static inline bool isPureBinaryOperator(char op) {
+    switch (op) {
+        case '+':
+        case '-':
+        case '*':
+        case '<':
+        case (char)token_less_equal:
+        case (char)token_greater_equal:
+        case (char)token_equal:
+        case (char)token_not_equal:
+        case (char)token_and:
+        case (char)token_or:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+
+bool HashConsTable::Key::operator==(const Key &other) const {
+    return m_kind == other.m_kind && m_op == other.m_op && m_payload == other.m_payload &&
+           m_lhs == other.m_lhs && m_rhs == other.m_rhs;
+}
+
+
+HashConsTable::HashConsTable()
+        : m_slots(kInitialTableSize, Slot()), m_used(0) {
+}
+
+void HashConsTable::clear() {
+    m_slots.assign(kInitialTableSize, Slot());
+    m_used = 0;
+}
+
+HashConsTable::Slot &HashConsTable::findSlot(const Key &key) {
+    size_t mask = m_slots.size() - 1;
+    size_t position = hashKey(key.m_kind, key.m_op, key.m_payload, key.m_lhs, key.m_rhs) & mask;
+    while (m_slots[position].m_node && !(m_slots[position].m_key == key)) {
+        position = (position + 1) & mask;
+    }
+
+    return m_slots[position];
+}
+
+ExprAST *HashConsTable::insert(const Key &key, ExprAST *node) {
+    if ((m_used + 1) * 4 > m_slots.size() * 3) {
+        // 扩大一倍后重新放入所有节点
+        std::vector<Slot> oldSlots(m_slots.size() * 2, Slot());
+        oldSlots.swap(m_slots);
+        for (const Slot &slot : oldSlots) {
+            if (slot.m_node) {
+                this->findSlot(slot.m_key) = slot;
+            }
+        }
+    }
+
+    Slot &slot = this->findSlot(key);
+    slot.m_key = key;
+    slot.m_node = node;
+    ++m_used;
+
+    node->m_flags |= expr_hash_consed;
+    return node;
+}
+
+ExprAST *HashConsTable::getNumber(ASTContext &context, double val) {
+    // 按二进制比较，0.0 和 -0.0 是不同的常量
+    uint64_t bits;
+    memcpy(&bits, &val, sizeof(bits));
+    Key key = {ast_number, type_double, bits, nullptr, nullptr};
+
+    Slot &slot = this->findSlot(key);
+    if (slot.m_node) {
+        slot.m_node->m_flags |= expr_shared;
+        return slot.m_node;
+    }
+
+    return this->insert(key, context.create<NumberExprAST>(val));
+}
+
+ExprAST *HashConsTable::getInteger(ASTContext &context, int64_t integer) {
+    // 1 和 1.0 的类型不同，不能共享
+    Key key = {ast_number, type_i64, (uint64_t)integer, nullptr, nullptr};
+
+    Slot &slot = this->findSlot(key);
+    if (slot.m_node) {
+        slot.m_node->m_flags |= expr_shared;
+        return slot.m_node;
+    }
+
+    return this->insert(key, context.create<NumberExprAST>(integer));
+}
+
+ExprAST *HashConsTable::getVariable(ASTContext &context, Symbol name) {
+    Key key = {ast_variable, 0, name, nullptr, nullptr};
+
+    Slot &slot = this->findSlot(key);
+    if (slot.m_node) {
+        slot.m_node->m_flags |= expr_shared;
+        return slot.m_node;
+    }
+
+    return this->insert(key, context.create<VariableExprAST>(name));
+}
+
+ExprAST *HashConsTable::getBinary(ASTContext &context, char op, ExprAST *lhs, ExprAST *rhs) {
+    // 两边都在表中，整个子树才没有副作用
+    if (!isPureBinaryOperator(op) || !(lhs->m_flags & expr_hash_consed) || !(rhs->m_flags & expr_hash_consed)) {
+        return context.create<BinaryExprAST>(op, lhs, rhs);
+    }
+
+    Key key = {ast_binary, op, 0, lhs, rhs};
+
+    Slot &slot = this->findSlot(key);
+    if (slot.m_node) {
+        slot.m_node->m_flags |= expr_shared;
+        return slot.m_node;
+    }
+
+    return this->insert(key, context.create<BinaryExprAST>(op, lhs, rhs));
+}
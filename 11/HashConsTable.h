@@ -0,0 +1,67 @@
+//
+// Created by 董宏昌 on 2017/2/28.
+//
+
+#ifndef PROJECT_HASHCONSTABLE_H
+#define PROJECT_HASHCONSTABLE_H
+
+
+#include <cstdint>
+#include <vector>
+#include "ASTContext.h"
+#include "ExprAST.h"
+
+
+/*
+ * 解析时的 hash consing 表
+ * 结构相同、没有副作用的子表达式只分配一次：数字常量、变量读取，以及两边都已经在表中的内建二元运算 + - * <
+ * 再次遇到时返回表中已有的节点并标记为 expr_shared，AST 于是成为 DAG
+ * 函数调用、一元运算符、自定义二元运算符和赋值可能有副作用，每次都分配新的节点
+ * 表中的节点都在同一个 ASTContext 里，换新的 ASTContext 时要先 clear
+ */
+class HashConsTable {
+private:
+    struct Key {
+        ASTKind m_kind;
+        /// 二元运算符，或者数字常量的类型
+        char m_op;
+        /// 数字常量的二进制表示，或者变量名
+        uint64_t m_payload;
+        ExprAST *m_lhs;
+        ExprAST *m_rhs;
+
+        bool operator==(const Key &other) const;
+    };
+
+    struct Slot {
+        Key m_key;
+        /// nullptr 表示空槽
+        ExprAST *m_node;
+    };
+
+    /// 长度是 2 的幂，线性探测
+    std::vector<Slot> m_slots;
+    unsigned m_used;
+
+    /*
+     * 返回 key 所在的槽，没有时返回应该插入的空槽
+     */
+    Slot &findSlot(const Key &key);
+    /*
+     * 把新分配的节点登记到 key 对应的空槽里
+     */
+    ExprAST *insert(const Key &key, ExprAST *node);
+
+public:
+    HashConsTable();
+
+    void clear();
+
+    ExprAST *getNumber(ASTContext &context, double val);
+    ExprAST *getInteger(ASTContext &context, int64_t integer);
+    ExprAST *getVariable(ASTContext &context, Symbol name);
+    ExprAST *getBinary(ASTContext &context, char op, ExprAST *lhs, ExprAST *rhs);
+};
+
+
+#endif //PROJECT_HASHCONSTABLE_H
@@ -0,0 +1,65 @@
+//
+// Created by 董宏昌 on 2017/2/24.
+//
+
+#include "IdentifierTable.h"
+#include "llvm/Support/MathExtras.h"
+
+
+IdentifierTable kIdentifierTable;
+
+
+IdentifierTable::IdentifierTable()
+        : m_size(0) {
+    for (auto &block : m_blocks) {
+        block.store(nullptr, std::memory_order_relaxed);
+    }
+
+    // 保证空字符串的编号是 kEmptySymbol
+    this->intern("");
+}
+
+IdentifierTable::~IdentifierTable() {
+    for (auto &block : m_blocks) {
+        delete[] block.load(std::memory_order_relaxed);
+    }
+}
+
+void IdentifierTable::locate(Symbol symbol, unsigned &block, unsigned &offset) {
+    // 第 i 块从 kFirstBlockSize * (2^i - 1) 开始，加上 kFirstBlockSize 后最高位就是块号
+    unsigned biased = symbol + kFirstBlockSize;
+    block = llvm::Log2_32(biased) - llvm::Log2_32(kFirstBlockSize);
+    offset = biased - (kFirstBlockSize << block);
+}
+
+Symbol IdentifierTable::intern(llvm::StringRef string) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    Symbol next = m_size.load(std::memory_order_relaxed);
+    auto result = m_symbols.insert(std::make_pair(string, next));
+    if (result.second) {
+        unsigned block, offset;
+        locate(next, block, offset);
+
+        llvm::StringRef *strings = m_blocks[block].load(std::memory_order_relaxed);
+        if (!strings) {
+            strings = new llvm::StringRef[kFirstBlockSize << block];
+            m_blocks[block].store(strings, std::memory_order_release);
+        }
+        strings[offset] = result.first->getKey();
+        m_size.store(next + 1, std::memory_order_release);
+    }
+
+    return result.first->getValue();
+}
+
+llvm::StringRef IdentifierTable::getString(Symbol symbol) const {
+    unsigned block, offset;
+    locate(symbol, block, offset);
+
+    return m_blocks[block].load(std::memory_order_acquire)[offset];
+}
+
+unsigned IdentifierTable::size() const {
+    return m_size.load(std::memory_order_acquire);
+}
@@ -0,0 +1,75 @@
+//
+// Created by 董宏昌 on 2017/2/24.
+//
+
+#ifndef PROJECT_IDENTIFIERTABLE_H
+#define PROJECT_IDENTIFIERTABLE_H
+
+
+#include <atomic>
+#include <mutex>
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Allocator.h"
+
+
+/// 标识符在 IdentifierTable 中的编号，从 0 开始连续分配
+typedef unsigned Symbol;
+
+
+/*
+ * 标识符表
+ * 每个标识符只在词法分析时查找一次，之后 AST 和代码生成都只使用 Symbol 编号，
+ * 字符串本身只在这里保存一份
+ * intern 可以被多个解析线程同时调用，getString 不加锁，可以和 intern 同时调用，
+ * 比如一个线程在生成代码时另一个线程在解析另一个源文件
+ */
+class IdentifierTable {
+private:
+    /// 第一块的大小，之后每块翻倍
+    static const unsigned kFirstBlockSize = 256;
+    /// 块数，足够容纳所有 32 位的编号
+    static const unsigned kBlockCount = 24;
+
+    /// 字符串到编号的映射，字符串保存在 StringMap 的节点里，地址不会改变
+    llvm::StringMap<Symbol, llvm::BumpPtrAllocator> m_symbols;
+    /// 编号到字符串的映射，分成大小依次翻倍的块，块分配后不再移动，读的时候不需要加锁
+    std::atomic<llvm::StringRef *> m_blocks[kBlockCount];
+    /// 已经分配的编号数量
+    std::atomic<unsigned> m_size;
+    std::mutex m_mutex;
+
+    /*
+     * 编号所在的块和块内的下标
+     */
+    static void locate(Symbol symbol, unsigned &block, unsigned &offset);
+
+public:
+    IdentifierTable();
+    ~IdentifierTable();
+    IdentifierTable(const IdentifierTable &) = delete;
+    IdentifierTable &operator=(const IdentifierTable &) = delete;
+
+    /*
+     * 返回字符串对应的编号，第一次出现时分配新的编号
+     */
+    Symbol intern(llvm::StringRef string);
+    /*
+     * 返回编号对应的字符串
+     */
+    llvm::StringRef getString(Symbol symbol) const;
+    /*
+     * 已经分配的编号数量，所有编号都小于这个值
+     */
+    unsigned size() const;
+};
+
+
+/// 空字符串的编号，顶层表达式生成的匿名函数使用它作为函数名
+static const Symbol kEmptySymbol = 0;
+
+/// 全局的标识符表
+extern IdentifierTable kIdentifierTable;
+
+
+#endif //PROJECT_IDENTIFIERTABLE_H
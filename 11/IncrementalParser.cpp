@@ -0,0 +1,251 @@
+//
+// Created by 董宏昌 on 2017/2/28.
+//
+
+#include "IncrementalParser.h"
+#include <algorithm>
+#include <cstdio>
+#include <unordered_map>
+#include "llvm/ADT/Hashing.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "CodeGenerator.h"
+#include "CodegenContext.h"
+#include "ParallelParser.h"
+
+
+IncrementalParser::IncrementalParser(CodegenContext &codegenContext)
+        : m_codegenContext(codegenContext), m_hashConsing(false), m_reusedCount(0), m_recompiledCount(0) {
+}
+
+void IncrementalParser::setHashConsing(bool enabled) {
+    m_hashConsing = enabled;
+}
+
+void IncrementalParser::discardChunk(const IncrementalChunk &chunk, bool removeNames) {
+    for (const auto &definition : chunk.m_definitions) {
+        if (definition.m_name == kEmptySymbol) {
+            // 匿名函数不会被调用，第一遍就直接删掉
+            if (!removeNames) {
+                m_codegenContext.eraseAnonymousFunction(definition.m_function);
+            }
+        } else if (removeNames) {
+            m_codegenContext.eraseFunction(definition.m_name);
+        } else {
+            m_codegenContext.deleteFunctionBody(definition.m_name);
+        }
+    }
+}
+
+void IncrementalParser::collectReferences(FunctionIndex function, std::vector<Symbol> &references) {
+    llvm::SmallVector<NodeIndex, 32> nodes;
+    if (m_flatAST.getFunction(function).m_body != kNoNode) {
+        nodes.push_back(m_flatAST.getFunction(function).m_body);
+    }
+
+    while (!nodes.empty()) {
+        NodeIndex node = nodes.back();
+        nodes.pop_back();
+
+        switch (m_flatAST.getKind(node)) {
+            case ast_number:
+            case ast_variable:
+                break;
+
+            case ast_unary: {
+                references.push_back(getOperatorSymbol(false, m_flatAST.getOperator(node)));
+                nodes.push_back(m_flatAST.getFirstChild(node));
+            } break;
+
+            case ast_binary: {
+                // 内建的运算符也记下来，以后自定义的运算符函数变化时不会漏掉
+                references.push_back(getOperatorSymbol(true, m_flatAST.getOperator(node)));
+                nodes.push_back(m_flatAST.getFirstChild(node));
+                nodes.push_back(m_flatAST.getSecondChild(node));
+            } break;
+
+            case ast_call: {
+                references.push_back(m_flatAST.getSymbol(node));
+                llvm::ArrayRef<NodeIndex> args = m_flatAST.getCallArgs(node);
+                nodes.insert(nodes.end(), args.begin(), args.end());
+            } break;
+
+            case ast_if: {
+                nodes.push_back(m_flatAST.getFirstChild(node));
+                nodes.push_back(m_flatAST.getSecondChild(node));
+                nodes.push_back(m_flatAST.getThirdChild(node));
+            } break;
+
+            case ast_for: {
+                nodes.push_back(m_flatAST.getSecondChild(node));
+                nodes.push_back(m_flatAST.getForEnd(node));
+                if (m_flatAST.getForStep(node) != kNoNode) {
+                    nodes.push_back(m_flatAST.getForStep(node));
+                }
+                nodes.push_back(m_flatAST.getForBody(node));
+            } break;
+
+            case ast_var: {
+                for (unsigned i = 0; i < m_flatAST.getVarCount(node); ++i) {
+                    if (m_flatAST.getVarInit(node, i) != kNoNode) {
+                        nodes.push_back(m_flatAST.getVarInit(node, i));
+                    }
+                }
+                nodes.push_back(m_flatAST.getThirdChild(node));
+            } break;
+        }
+    }
+
+    std::sort(references.begin(), references.end());
+    references.erase(std::unique(references.begin(), references.end()), references.end());
+}
+
+void IncrementalParser::compileChunk(ExprParser &parser, llvm::StringRef source, IncrementalChunk &chunk) {
+    std::vector<TopLevelItem> items;
+    parser.parseTopLevelItems(source, items);
+
+    chunk.m_complete = true;
+    for (const auto &item : items) {
+        if (!item.m_errors.empty()) {
+            fputs(item.m_errors.c_str(), stderr);
+            chunk.m_complete = false;
+        }
+
+        FunctionIndex function;
+        if (item.m_kind == TopLevelItem::item_extern) {
+            if (!item.m_prototype) {
+                continue;
+            }
+            function = m_flatAST.addPrototype(item.m_prototype);
+        } else {
+            if (!item.m_function) {
+                continue;
+            }
+            function = m_flatAST.addFunction(item.m_function);
+        }
+
+        ++m_recompiledCount;
+        llvm::Function *functionIR = ExprParser::emitFunction(m_codegenContext, m_flatAST, function);
+        if (!functionIR) {
+            chunk.m_complete = false;
+            continue;
+        }
+
+        IncrementalDefinition definition;
+        definition.m_name = m_flatAST.getFunction(function).m_name;
+        definition.m_isExtern = item.m_kind == TopLevelItem::item_extern;
+        definition.m_function = definition.m_name == kEmptySymbol ? functionIR : nullptr;
+        this->collectReferences(function, definition.m_references);
+        chunk.m_definitions.push_back(std::move(definition));
+    }
+}
+
+void IncrementalParser::parse(llvm::StringRef codeString) {
+    m_flatAST.clear();
+    m_reusedCount = 0;
+    m_recompiledCount = 0;
+
+    std::vector<llvm::StringRef> sources;
+    bool precedenceKnown;
+    if (!ParallelParser::splitTopLevel(codeString, m_codegenContext.getOperatorTable(), sources, precedenceKnown)) {
+        // ';' 被定义成了运算符，不能切分，整个输入作为一段
+        sources.assign(1, codeString);
+    }
+
+    // 按文本的 hash 与上一次提交的各段配对，同样的文本可以出现多次，每段旧的源码只能配对一次
+    std::unordered_multimap<uint64_t, unsigned> previousChunks;
+    for (unsigned i = 0; i < m_chunks.size(); ++i) {
+        if (m_chunks[i].m_complete) {
+            previousChunks.insert(std::make_pair(m_chunks[i].m_hash, i));
+        }
+    }
+
+    std::vector<IncrementalChunk> chunks(sources.size());
+    std::vector<int> matches(sources.size(), -1);
+    std::vector<bool> matched(m_chunks.size(), false);
+    for (size_t i = 0; i < sources.size(); ++i) {
+        chunks[i].m_hash = (uint64_t)llvm::hash_value(sources[i]);
+        auto range = previousChunks.equal_range(chunks[i].m_hash);
+        for (auto it = range.first; it != range.second; ++it) {
+            if (!matched[it->second]) {
+                matched[it->second] = true;
+                matches[i] = (int)it->second;
+                break;
+            }
+        }
+    }
+
+    // 没有配对上的旧定义已经变化或者被删掉
+    llvm::DenseSet<Symbol> changedNames;
+    for (unsigned i = 0; i < m_chunks.size(); ++i) {
+        if (matched[i]) {
+            continue;
+        }
+        for (const auto &definition : m_chunks[i].m_definitions) {
+            if (definition.m_name != kEmptySymbol) {
+                changedNames.insert(definition.m_name);
+            }
+        }
+    }
+
+    // 调用了这些函数的定义和同名的 extern 也要重新生成
+    // 重新生成一个定义不会改变它的声明，所以只需要看直接的调用
+    std::vector<bool> dependent(m_chunks.size(), false);
+    if (!changedNames.empty()) {
+        for (unsigned i = 0; i < m_chunks.size(); ++i) {
+            if (!matched[i]) {
+                continue;
+            }
+            for (const auto &definition : m_chunks[i].m_definitions) {
+                bool changed = definition.m_isExtern && changedNames.count(definition.m_name);
+                for (Symbol reference : definition.m_references) {
+                    changed = changed || changedNames.count(reference);
+                }
+                dependent[i] = dependent[i] || changed;
+            }
+        }
+    }
+
+    // 先丢掉所有要重新生成的实现，这时已经没有地方调用变化的函数，再把它们从模块中删掉
+    // 变化后的函数可能换了参数个数，所以要重新创建，不能沿用原来的声明
+    for (unsigned i = 0; i < m_chunks.size(); ++i) {
+        if (!matched[i] || dependent[i]) {
+            this->discardChunk(m_chunks[i], false);
+        }
+    }
+    for (unsigned i = 0; i < m_chunks.size(); ++i) {
+        if (!matched[i]) {
+            this->discardChunk(m_chunks[i], true);
+        }
+    }
+
+    // 按源码顺序处理，运算符函数生成代码时登记的优先级对之后的定义生效
+    ExprParser parser;
+    parser.setCodegenContext(&m_codegenContext);
+    parser.setHashConsing(m_hashConsing);
+    parser.setSourceStart(codeString.begin());
+    for (size_t i = 0; i < sources.size(); ++i) {
+        if (matches[i] >= 0 && !dependent[matches[i]]) {
+            chunks[i].m_complete = true;
+            chunks[i].m_definitions = std::move(m_chunks[matches[i]].m_definitions);
+            m_reusedCount += (unsigned)chunks[i].m_definitions.size();
+        } else {
+            this->compileChunk(parser, sources[i], chunks[i]);
+        }
+    }
+
+    m_chunks = std::move(chunks);
+}
+
+bool IncrementalParser::parseFile(const std::string &fileName) {
+    auto fileOrError = llvm::MemoryBuffer::getFile(fileName, -1, false);
+    if (!fileOrError) {
+        fprintf(stderr, "Could not open file %s: %s\n", fileName.c_str(), fileOrError.getError().message().c_str());
+
+        return false;
+    }
+
+    this->parse(fileOrError.get()->getBuffer());
+
+    return true;
+}
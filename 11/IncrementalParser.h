@@ -0,0 +1,105 @@
+//
+// Created by 董宏昌 on 2017/2/28.
+//
+
+#ifndef PROJECT_INCREMENTALPARSER_H
+#define PROJECT_INCREMENTALPARSER_H
+
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/StringRef.h"
+#include "ExprParser.h"
+#include "FlatAST.h"
+
+
+/*
+ * 上一次提交中的一个顶层定义
+ */
+struct IncrementalDefinition {
+    /// 函数名，顶层表达式是 kEmptySymbol
+    Symbol m_name;
+    bool m_isExtern;
+    /// 顶层表达式生成的匿名函数，不能按名字查找，所以记下来
+    llvm::Function *m_function;
+    /// 函数体中调用的函数和用到的运算符函数，这些函数变化后要重新生成这个定义
+    std::vector<Symbol> m_references;
+};
+
+/*
+ * 上一次提交中按顶层的 ';' 切出的一段源码
+ */
+struct IncrementalChunk {
+    /// 源码文本的 hash
+    uint64_t m_hash;
+    /// 解析和生成代码都没有出错，下次提交的文本相同时可以直接复用
+    bool m_complete;
+    /// 这段源码中生成成功的定义
+    std::vector<IncrementalDefinition> m_definitions;
+};
+
+
+/*
+ * 增量解析
+ * 同一个会话中反复提交修改后的整个源文件，只重新处理变化的部分
+ * 每次提交按顶层的 ';' 切分，以每段源码文本的 hash 为键和上一次提交对比：
+ * 文本没有变化的定义直接复用已经生成的 llvm IR，不再解析和生成代码；
+ * 变化或者删掉的定义先从模块中去掉原来的函数，调用了这些函数（包括运算符函数）的定义也要重新生成；
+ * 其余的段按源码顺序依次解析并生成代码
+ */
+class IncrementalParser {
+private:
+    /// 各次提交的代码都生成在这里，复用的定义就是其模块中已有的函数
+    CodegenContext &m_codegenContext;
+    /// 上一次提交的各段源码，按源码顺序排列
+    std::vector<IncrementalChunk> m_chunks;
+    /// 当前提交中重新解析的定义展开后的 AST，每次提交重新开始
+    FlatAST m_flatAST;
+    /// 解析时是否合并相同的子表达式，见 ExprParser::setHashConsing
+    bool m_hashConsing;
+    /// 最近一次提交复用和重新生成的定义个数
+    unsigned m_reusedCount;
+    unsigned m_recompiledCount;
+
+    /*
+     * 从模块中去掉一段源码原来生成的函数，removeNames 为 false 时只丢掉命名函数的实现
+     */
+    void discardChunk(const IncrementalChunk &chunk, bool removeNames);
+    /*
+     * 收集 m_flatAST 中 function 的函数体调用的函数和用到的运算符函数
+     */
+    void collectReferences(FunctionIndex function, std::vector<Symbol> &references);
+    /*
+     * 解析并生成一段源码，结果记录在 chunk 中
+     */
+    void compileChunk(ExprParser &parser, llvm::StringRef source, IncrementalChunk &chunk);
+
+public:
+    explicit IncrementalParser(CodegenContext &codegenContext);
+
+    /*
+     * 打开后解析时合并结构相同、没有副作用的子表达式
+     */
+    void setHashConsing(bool enabled);
+
+    /*
+     * 提交一次完整的源码，codeString 只在调用期间使用
+     */
+    void parse(llvm::StringRef codeString);
+    /*
+     * 读入源文件后提交，文件打不开时返回 false
+     */
+    bool parseFile(const std::string &fileName);
+
+    unsigned getReusedCount() const {
+        return m_reusedCount;
+    }
+    unsigned getRecompiledCount() const {
+        return m_recompiledCount;
+    }
+};
+
+
+#endif //PROJECT_INCREMENTALPARSER_H
@@ -3,8 +3,6 @@
 //
 
 #include "KaleidoscopeJIT.h"
-#include "llvm/Transforms/Scalar.h"
-#include "llvm/Transforms/Scalar/GVN.h"
 
 
 /// This will compile FnAST to IR, rename the function to add the given
@@ -12,7 +10,11 @@
 /// and then take ownership of the module that the function was compiled
 /// into.
 std::unique_ptr<llvm::Module>
-irgenAndTakeOwnership(FunctionAST &FnAST, const std::string &Suffix);
+irgenAndTakeOwnership(CodegenContext &context, FunctionAST &FnAST, llvm::StringRef Suffix);
+/// 同上，函数已经展开在 flatAST 中，比如从 .ksb 文件读入的函数
+std::unique_ptr<llvm::Module>
+irgenAndTakeOwnership(CodegenContext &context, const FlatAST &flatAST, FunctionIndex function,
+                      llvm::StringRef Suffix);
 
 
 KaleidoscopeJIT::KaleidoscopeJIT()
@@ -22,7 +24,8 @@ KaleidoscopeJIT::KaleidoscopeJIT()
   m_optimizeLayer(m_compileLayer, [this](std::unique_ptr<llvm::Module> M) {
       return this->optimizeModule(std::move(M));
   }),
-  m_compileCallbackMgr(llvm::orc::createLocalCompileCallbackManager(m_targetMachine->getTargetTriple(), 0))
+  m_compileCallbackMgr(llvm::orc::createLocalCompileCallbackManager(m_targetMachine->getTargetTriple(), 0)),
+  m_optimizationLevel(optimize_O2)
 {
     auto indirectStubsMgrBuilder = llvm::orc::createLocalIndirectStubsManagerBuilder(m_targetMachine->getTargetTriple());
     m_indirectStubsMgr = indirectStubsMgrBuilder();
@@ -37,7 +40,7 @@ llvm::TargetMachine& KaleidoscopeJIT::getTargetMachine() {
     return *m_targetMachine;
 }
 
-std::string KaleidoscopeJIT::mangle(const std::string &name) {
+std::string KaleidoscopeJIT::mangle(const llvm::Twine &name) {
     std::string mangledName;
     llvm::raw_string_ostream mangledNameStream(mangledName);
     llvm::Mangler::getNameWithPrefix(mangledNameStream, name, m_dataLayout);
@@ -53,6 +56,10 @@ KaleidoscopeJIT::ModuleHandleT KaleidoscopeJIT::addModule(std::unique_ptr<llvm::
     // Lambda 2: Search for external symbols in the host process.
     auto Resolver = llvm::orc::createLambdaResolver(
             [&](const std::string &aName) {
+                // 延迟编译的函数先找到它的 stub，没有内联的调用经过 stub 跳到实现
+                if (auto stub = m_indirectStubsMgr->findStub(aName, false)) {
+                    return llvm::RuntimeDyld::SymbolInfo(stub.getAddress(), stub.getFlags());
+                }
                 if (auto sym = m_optimizeLayer.findSymbol(aName, false)) {
                     return llvm::RuntimeDyld::SymbolInfo(sym.getAddress(), sym.getFlags());
                 }
@@ -80,7 +87,7 @@ void KaleidoscopeJIT::removeModule(KaleidoscopeJIT::ModuleHandleT aModule) {
     m_optimizeLayer.removeModuleSet(aModule);
 }
 
-llvm::orc::JITSymbol KaleidoscopeJIT::findSymbol(const std::string aName) {
+llvm::orc::JITSymbol KaleidoscopeJIT::findSymbol(const llvm::Twine &aName) {
     std::string mangledName;
     llvm::raw_string_ostream mangledNameStream(mangledName);
     llvm::Mangler::getNameWithPrefix(mangledNameStream, aName, m_dataLayout);
@@ -88,26 +95,16 @@ llvm::orc::JITSymbol KaleidoscopeJIT::findSymbol(const std::string aName) {
 }
 
 std::unique_ptr<llvm::Module> KaleidoscopeJIT::optimizeModule(std::unique_ptr<llvm::Module> module) {
-    // Create a function pass manager.
-    auto FPM = llvm::make_unique<llvm::legacy::FunctionPassManager>(module.get());
-
-    // Add some optimizations.
-    FPM->add(llvm::createInstructionCombiningPass());
-    FPM->add(llvm::createReassociatePass());
-    FPM->add(llvm::createGVNPass());
-    FPM->add(llvm::createCFGSimplificationPass());
-    FPM->doInitialization();
-
-    // Run the optimizations over all functions in the module being added to
-    // the JIT.
-    for (auto &F : *module) {
-        FPM->run(F);
-    }
+    // O2 以上按代价内联，其他模块中的函数体由 codegenInlineBodies 以 available_externally 的形式提供；
+    // 运算符函数标了 alwaysinline，各个级别都会内联；各个级别都会消除尾递归
+    ModuleOptimizer optimizer(*m_targetMachine);
+    optimizer.setOptimizationLevel(m_optimizationLevel);
+    optimizer.run(*module);
 
     return module;
 }
 
-llvm::Error KaleidoscopeJIT::addFunctionAST(std::unique_ptr<FunctionAST> functionAST) {
+llvm::Error KaleidoscopeJIT::addFunctionAST(FunctionAST *functionAST, std::shared_ptr<ASTContext> context) {
     // Create a CompileCallback - this is the re-entry point into the compiler
     // for functions that haven't been compiled yet.
     auto CCInfo = m_compileCallbackMgr->getCompileCallback();
@@ -124,10 +121,6 @@ llvm::Error KaleidoscopeJIT::addFunctionAST(std::unique_ptr<FunctionAST> functio
                                                 llvm::JITSymbolFlags::Exported))
         return Err;
 
-    // Move ownership of FnAST to a shared pointer - C++11 lambdas don't support
-    // capture-by-move, which is be required for unique_ptr.
-    auto SharedFnAST = std::shared_ptr<FunctionAST>(std::move(functionAST));
-
     // Set the action to compile our AST. This lambda will be run if/when
     // execution hits the compile callback (via the stub).
     //
@@ -145,14 +138,15 @@ llvm::Error KaleidoscopeJIT::addFunctionAST(std::unique_ptr<FunctionAST> functio
     //     this function as the address to continue at once it has reset the
     //     CPU state to what it was immediately before the call.
     CCInfo.setCompileAction(
-            [this, SharedFnAST]() {
-                auto M = irgenAndTakeOwnership(*SharedFnAST, "$impl");
+            [this, functionAST, context]() {
+                // functionAST 分配在 context 中，lambda 持有 context 保证它在编译前不会被释放
+                auto M = irgenAndTakeOwnership(m_codegenContext, *functionAST, "$impl");
                 addModule(std::move(M));
-                auto Sym = findSymbol(SharedFnAST->getName() + "$impl");
+                auto Sym = findSymbol(functionAST->getName() + "$impl");
                 assert(Sym && "Couldn't find compiled function?");
                 llvm::orc::TargetAddress SymAddr = Sym.getAddress();
                 if (auto Err =
-                        m_indirectStubsMgr->updatePointer(mangle(SharedFnAST->getName()),
+                        m_indirectStubsMgr->updatePointer(mangle(functionAST->getName()),
                                                         SymAddr)) {
                     logAllUnhandledErrors(std::move(Err), llvm::errs(),
                                           "Error updating function pointer: ");
@@ -164,3 +158,52 @@ llvm::Error KaleidoscopeJIT::addFunctionAST(std::unique_ptr<FunctionAST> functio
 
     return llvm::Error::success();
 }
+
+llvm::Error KaleidoscopeJIT::addFunctionAST(std::shared_ptr<const FlatAST> flatAST, FunctionIndex function) {
+    // 与上面的 addFunctionAST 相同，只是函数已经展开，编译时直接在 flatAST 上生成代码
+    Symbol symbol = flatAST->getFunction(function).m_name;
+    llvm::StringRef name = kIdentifierTable.getString(symbol);
+
+    // 同一个 flatAST 中的函数互相调用时按名字找到对方，换了 flatAST 时重新记录
+    if (flatAST != m_flatAST) {
+        m_flatAST = flatAST;
+        m_flatFunctions.clear();
+    }
+    auto inserted = m_flatFunctions.insert(std::make_pair(symbol, function));
+    if (!inserted.second && flatAST->getFunction(inserted.first->second).m_body == kNoNode) {
+        // 先写了 extern，之后的实现代替它
+        inserted.first->second = function;
+    }
+
+    auto CCInfo = m_compileCallbackMgr->getCompileCallback();
+    if (auto Err = m_indirectStubsMgr->createStub(this->mangle(name),
+                                                CCInfo.getAddress(),
+                                                llvm::JITSymbolFlags::Exported))
+        return Err;
+
+    CCInfo.setCompileAction(
+            [this, flatAST, function, name]() {
+                // 只有 m_flatFunctions 还是这个 flatAST 的函数时才能按名字查找
+                bool external = flatAST == m_flatAST;
+                if (external) {
+                    m_codegenContext.setExternalFunctions(flatAST.get(), &m_flatFunctions);
+                }
+                auto M = irgenAndTakeOwnership(m_codegenContext, *flatAST, function, "$impl");
+                if (external) {
+                    m_codegenContext.setExternalFunctions(nullptr, nullptr);
+                }
+                addModule(std::move(M));
+                auto Sym = findSymbol(name + "$impl");
+                assert(Sym && "Couldn't find compiled function?");
+                llvm::orc::TargetAddress SymAddr = Sym.getAddress();
+                if (auto Err = m_indirectStubsMgr->updatePointer(mangle(name), SymAddr)) {
+                    logAllUnhandledErrors(std::move(Err), llvm::errs(),
+                                          "Error updating function pointer: ");
+                    exit(1);
+                }
+
+                return SymAddr;
+            });
+
+    return llvm::Error::success();
+}
@@ -6,6 +6,7 @@
 #define PROJECT_KALEIDOSCOPEJIT_H
 
 
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/ExecutionEngine/ExecutionEngine.h"
 #include "llvm/ExecutionEngine/RTDyldMemoryManager.h"
 #include "llvm/ExecutionEngine/Orc/CompileUtils.h"
@@ -17,11 +18,17 @@
 #include "llvm/IR/Mangler.h"
 #include "llvm/Support/DynamicLibrary.h"
 #include "llvm/Support/Error.h"
+#include "ASTContext.h"
+#include "CodegenContext.h"
 #include "ExprAST.h"
+#include "FlatAST.h"
+#include "ModuleOptimizer.h"
 
 
 class KaleidoscopeJIT {
 private:
+    /// 延迟编译的函数在这里生成代码，编译出的模块属于它的 llvm 上下文，所以它要比各个层活得久
+    CodegenContext m_codegenContext;
     std::unique_ptr<llvm::TargetMachine> m_targetMachine;
     const llvm::DataLayout m_dataLayout;
     llvm::orc::ObjectLinkingLayer<> m_objectLayer;
@@ -34,9 +41,16 @@ private:
 
     std::unique_ptr<llvm::orc::JITCompileCallbackManager> m_compileCallbackMgr;
     std::unique_ptr<llvm::orc::IndirectStubsManager> m_indirectStubsMgr;
+    /// 每个模块载入前的优化级别，默认是 O2
+    OptimizationLevel m_optimizationLevel;
+
+    /// 最近一次 addFunctionAST 传入的 flatAST 和其中函数名到下标的映射，通常是整个读入的函数库
+    /// 编译其中的函数时用来声明被调用的函数，并生成运算符和小函数的函数体供内联，见 codegenInlineBodies
+    std::shared_ptr<const FlatAST> m_flatAST;
+    llvm::DenseMap<Symbol, FunctionIndex> m_flatFunctions;
 
 private:
-    std::string mangle(const std::string &name);
+    std::string mangle(const llvm::Twine &name);
 
 public:
     typedef decltype(m_optimizeLayer)::ModuleSetHandleT ModuleHandleT;
@@ -48,11 +62,26 @@ public:
     KaleidoscopeJIT::ModuleHandleT addModule(std::unique_ptr<llvm::Module> module);
     void removeModule(KaleidoscopeJIT::ModuleHandleT aModule);
 
-    llvm::orc::JITSymbol findSymbol(const std::string aName);
+    llvm::orc::JITSymbol findSymbol(const llvm::Twine &aName);
 
+    void setOptimizationLevel(OptimizationLevel level) {
+        m_optimizationLevel = level;
+    }
+    /*
+     * 按 m_optimizationLevel 优化，和输出目标文件时使用同样的 ModuleOptimizer
+     */
     std::unique_ptr<llvm::Module> optimizeModule(std::unique_ptr<llvm::Module> module);
 
-    llvm::Error addFunctionAST(std::unique_ptr<FunctionAST> functionAST);
+    /*
+     * 延迟编译一个函数，context 是 functionAST 所在的 ASTContext，
+     * 编译真正发生前 JIT 会一直持有它
+     */
+    llvm::Error addFunctionAST(FunctionAST *functionAST, std::shared_ptr<ASTContext> context);
+    /*
+     * 延迟编译 flatAST 中已经展开的一个函数，比如 BinaryAST::load 读入的库函数
+     * 编译真正发生前 JIT 会一直持有 flatAST
+     */
+    llvm::Error addFunctionAST(std::shared_ptr<const FlatAST> flatAST, FunctionIndex function);
 };
 
 
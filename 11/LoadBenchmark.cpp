@@ -0,0 +1,170 @@
+//
+// Created by 董宏昌 on 2017/2/28.
+//
+
+/*
+ * 函数库载入耗时的对比测试
+ * 生成含有很多函数定义的库，分别记录从源文件解析展开，和从 .ksb 文件读入得到同样的 FlatAST 的耗时
+ * 两种方式都从磁盘上的文件开始，都不生成代码
+ * 用法：llvmTest11LoadBenchmark [最大函数个数]，个数从 1000 开始每次乘 10，默认最大到 100000
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include "BinaryAST.h"
+#include "ExprParser.h"
+#include "Token.h"
+
+
+static double millisecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+/*
+ * 生成 count 个函数定义，每个函数调用前一个函数，用到 if for var 和各种运算
+ */
+static std::string buildLibrary(unsigned count) {
+    std::string source = "extern sin(x);\n";
+    char definition[256];
+    for (unsigned i = 0; i < count; ++i) {
+        if (i == 0) {
+            snprintf(definition, sizeof(definition), "def lib0(x y) sin(x) * y + 1;\n");
+        } else {
+            snprintf(definition, sizeof(definition),
+                     "def lib%u(x y) var a = x * %u + y, b in "
+                     "(for i = 1, a < i, 0.5 in b = b + lib%u(i, y - 1)) + "
+                     "(if a < y then a * (x + %u.25) else b - a);\n",
+                     i, i, i - 1, i);
+        }
+        source += definition;
+    }
+
+    return source;
+}
+
+static bool writeFile(const llvm::Twine &fileName, llvm::StringRef content) {
+    std::error_code errorCode;
+    llvm::raw_fd_ostream out(fileName.str(), errorCode, llvm::sys::fs::F_None);
+    if (errorCode) {
+        fprintf(stderr, "Could not open file %s: %s\n", fileName.str().c_str(), errorCode.message().c_str());
+        return false;
+    }
+    out << content;
+
+    return true;
+}
+
+static uint64_t getFileSize(const llvm::Twine &fileName) {
+    uint64_t size = 0;
+    llvm::sys::fs::file_size(fileName, size);
+
+    return size;
+}
+
+/*
+ * 读入源文件，只做语法分析和展开
+ */
+static bool loadText(const std::string &fileName, FlatAST &flatAST) {
+    auto fileOrError = llvm::MemoryBuffer::getFile(fileName, -1, false);
+    if (!fileOrError) {
+        return false;
+    }
+
+    ExprParser parser;
+    std::vector<TopLevelItem> items;
+    parser.parseTopLevelItems(fileOrError.get()->getBuffer(), items);
+    for (const auto &item : items) {
+        if (!item.m_errors.empty()) {
+            fputs(item.m_errors.c_str(), stderr);
+            return false;
+        }
+
+        if (item.m_function) {
+            flatAST.addFunction(item.m_function);
+        } else if (item.m_prototype) {
+            flatAST.addPrototype(item.m_prototype);
+        }
+    }
+
+    return true;
+}
+
+static bool runLibrary(unsigned count, const std::string &directory) {
+    std::string textFileName = directory + "/library.ks";
+    std::string binaryFileName = directory + "/library.ksb";
+    if (!writeFile(textFileName, buildLibrary(count))) {
+        return false;
+    }
+
+    FlatAST textAST;
+    auto textStart = std::chrono::steady_clock::now();
+    bool succeeded = loadText(textFileName, textAST);
+    double textTime = millisecondsSince(textStart);
+
+    if (!succeeded || !BinaryAST::save(textAST, kOperatorTable, binaryFileName)) {
+        return false;
+    }
+
+    FlatAST binaryAST;
+    auto binaryStart = std::chrono::steady_clock::now();
+    succeeded = BinaryAST::load(binaryFileName, binaryAST, kOperatorTable);
+    double binaryTime = millisecondsSince(binaryStart);
+
+    // 两种方式得到的 AST 应该完全相同
+    succeeded = succeeded && binaryAST.getNodeCount() == textAST.getNodeCount() &&
+                binaryAST.getFunctionCount() == textAST.getFunctionCount();
+
+    printf("%10u %12llu %12llu %12.2f %12.2f %9.1fx%s\n", count,
+           (unsigned long long)getFileSize(textFileName), (unsigned long long)getFileSize(binaryFileName),
+           textTime, binaryTime, binaryTime > 0 ? textTime / binaryTime : 0.0, succeeded ? "" : "  FAILED");
+    fflush(stdout);
+
+    llvm::sys::fs::remove(textFileName);
+    llvm::sys::fs::remove(binaryFileName);
+
+    return succeeded;
+}
+
+
+int main(int argc, char const *argv[]) {
+    unsigned maxCount = argc > 1 ? (unsigned)strtoul(argv[1], nullptr, 10) : 100000;
+
+    // 和 toy.cpp 中相同的运算符优先级
+    {
+        kOperatorTable.setBinaryPrecedence('=', 2);
+        kOperatorTable.setBinaryPrecedence(token_or, 5);
+        kOperatorTable.setBinaryPrecedence(token_and, 6);
+        kOperatorTable.setBinaryPrecedence(token_equal, 9);
+        kOperatorTable.setBinaryPrecedence(token_not_equal, 9);
+        kOperatorTable.setBinaryPrecedence('<', 10);
+        kOperatorTable.setBinaryPrecedence('>', 10);
+        kOperatorTable.setBinaryPrecedence(token_less_equal, 10);
+        kOperatorTable.setBinaryPrecedence(token_greater_equal, 10);
+        kOperatorTable.setBinaryPrecedence('+', 20);
+        kOperatorTable.setBinaryPrecedence('-', 30);
+        kOperatorTable.setBinaryPrecedence('*', 40);
+    }
+
+    llvm::SmallString<128> directory;
+    if (llvm::sys::fs::createUniqueDirectory("ksb-benchmark", directory)) {
+        fprintf(stderr, "Could not create temporary directory\n");
+        return 1;
+    }
+
+    printf("%10s %12s %12s %12s %12s %10s\n", "functions", "text(B)", "ksb(B)", "text(ms)", "ksb(ms)", "speedup");
+
+    bool succeeded = true;
+    for (unsigned long count = 1000; count <= maxCount; count *= 10) {
+        succeeded = runLibrary((unsigned)count, directory.str().str()) && succeeded;
+    }
+    llvm::sys::fs::remove(directory);
+
+    return succeeded ? 0 : 1;
+}
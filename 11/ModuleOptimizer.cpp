@@ -0,0 +1,234 @@
+//
+// Created by 董宏昌 on 2017/2/28.
+//
+
+#include "ModuleOptimizer.h"
+#include <algorithm>
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/IR/DiagnosticInfo.h"
+#include "llvm/IR/DiagnosticPrinter.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/Transforms/IPO.h"
+#include "llvm/Transforms/Scalar.h"
+#include "llvm/Transforms/IPO/PassManagerBuilder.h"
+
+
+/// 循环向量化的 pass 名，它的诊断信息都带这个名字
+static const char kLoopVectorizeName[] = "loop-vectorize";
+
+
+/*
+ * 循环回跳的分支上 llvm.loop 元数据中的源码位置，没有时返回 nullptr
+ */
+static const llvm::DILocation *getLoopLocation(const llvm::Instruction *terminator) {
+    llvm::MDNode *loopID = terminator ? terminator->getMetadata(llvm::LLVMContext::MD_loop) : nullptr;
+    if (!loopID) {
+        return nullptr;
+    }
+
+    for (unsigned i = 1; i < loopID->getNumOperands(); ++i) {
+        if (auto location = llvm::dyn_cast<llvm::DILocation>(loopID->getOperand(i))) {
+            return location;
+        }
+    }
+
+    return nullptr;
+}
+
+static bool compareLoops(const LoopReportEntry &lhs, const LoopReportEntry &rhs) {
+    return lhs.m_line != rhs.m_line ? lhs.m_line < rhs.m_line : lhs.m_column < rhs.m_column;
+}
+
+
+bool parseOptimizationLevel(llvm::StringRef flag, OptimizationLevel &level) {
+    static const OptimizationLevel levels[] = {optimize_O0, optimize_O1, optimize_O2, optimize_O3, optimize_Os};
+    for (OptimizationLevel candidate : levels) {
+        if (flag.startswith("-") && flag.substr(1) == getOptimizationLevelName(candidate)) {
+            level = candidate;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+const char *getOptimizationLevelName(OptimizationLevel level) {
+    switch (level) {
+        case optimize_O0: return "O0";
+        case optimize_O1: return "O1";
+        case optimize_O2: return "O2";
+        case optimize_O3: return "O3";
+        case optimize_Os: return "Os";
+    }
+
+    return "";
+}
+
+void addTailCallPasses(llvm::legacy::PassManagerBase &passManager) {
+    passManager.add(llvm::createPromoteMemoryToRegisterPass());
+    passManager.add(llvm::createCFGSimplificationPass());
+    passManager.add(llvm::createTailCallEliminationPass());
+}
+
+
+ModuleOptimizer::ModuleOptimizer(llvm::TargetMachine &targetMachine)
+        : m_targetMachine(targetMachine), m_level(optimize_O3), m_loopReport(false),
+          m_vectorLibrary(llvm::TargetLibraryInfoImpl::NoLibrary), m_previousHandler(nullptr),
+          m_previousContext(nullptr) {
+
+}
+
+void ModuleOptimizer::collectLoops(llvm::Module &module, bool afterOptimization) {
+    for (auto &function : module) {
+        for (auto &block : function) {
+            const llvm::DILocation *location = getLoopLocation(block.getTerminator());
+            if (!location) {
+                continue;
+            }
+
+            LoopReportEntry *entry = this->findLoop(location->getLine(), location->getColumn());
+            if (afterOptimization) {
+                if (entry) {
+                    entry->m_survived = true;
+                }
+            } else if (!entry) {
+                LoopReportEntry newEntry = {location->getLine(), location->getColumn(), false, false, std::string()};
+                m_loops.insert(std::upper_bound(m_loops.begin(), m_loops.end(), newEntry, compareLoops), newEntry);
+            }
+        }
+    }
+}
+
+LoopReportEntry *ModuleOptimizer::findLoop(unsigned line, unsigned column) {
+    LoopReportEntry key = {line, column, false, false, std::string()};
+    auto found = std::lower_bound(m_loops.begin(), m_loops.end(), key, compareLoops);
+    if (found == m_loops.end() || found->m_line != line || found->m_column != column) {
+        return nullptr;
+    }
+
+    return &*found;
+}
+
+void ModuleOptimizer::handleDiagnostic(const llvm::DiagnosticInfo &diagnostic, void *context) {
+    auto optimizer = static_cast<ModuleOptimizer *>(context);
+
+    // 强制向量化失败时的诊断信息没有 pass 名，按内容识别
+    auto remark = llvm::dyn_cast<llvm::DiagnosticInfoOptimizationBase>(&diagnostic);
+    std::string message = remark ? llvm::Twine(remark->getMsg()).str() : std::string();
+    if (!remark || (llvm::StringRef(remark->getPassName()) != kLoopVectorizeName &&
+                    !llvm::StringRef(message).startswith("loop not vectorized"))) {
+        if (optimizer->m_previousHandler) {
+            optimizer->m_previousHandler(diagnostic, optimizer->m_previousContext);
+        } else if (diagnostic.getSeverity() != llvm::DS_Remark) {
+            // 和 llvm 上下文默认的处理一样打印出来
+            llvm::DiagnosticPrinterRawOStream printer(llvm::errs());
+            diagnostic.print(printer);
+            llvm::errs() << '\n';
+        }
+        return;
+    }
+
+    llvm::StringRef fileName;
+    unsigned line = 0;
+    unsigned column = 0;
+    if (remark->isLocationAvailable()) {
+        remark->getLocation(&fileName, &line, &column);
+    }
+    bool vectorized = diagnostic.getKind() == llvm::DK_OptimizationRemark;
+    LoopReportEntry *entry = optimizer->findLoop(line, column);
+    if (!entry) {
+        if (!vectorized && optimizer->m_pendingReason.empty()) {
+            optimizer->m_pendingReason = message;
+        }
+        return;
+    }
+
+    std::string reason;
+    reason.swap(optimizer->m_pendingReason);
+    if (entry->m_vectorized) {
+        return;
+    }
+
+    // 同一个循环可能有好几条，第一条是具体的原因，之后的只是提示怎样看到原因
+    if (vectorized) {
+        entry->m_vectorized = true;
+        entry->m_message = message;
+    } else if (entry->m_message.empty()) {
+        entry->m_message = reason.empty() ? message : reason;
+    }
+}
+
+void ModuleOptimizer::run(llvm::Module &module) {
+    module.setTargetTriple(m_targetMachine.getTargetTriple().str());
+    module.setDataLayout(m_targetMachine.createDataLayout());
+
+    llvm::LLVMContext &llvmContext = module.getContext();
+    if (m_loopReport) {
+        m_loops.clear();
+        m_pendingReason.clear();
+        this->collectLoops(module, false);
+
+        // 不按 -pass-remarks 过滤，所有诊断信息都交给 handleDiagnostic
+        m_previousHandler = llvmContext.getDiagnosticHandler();
+        m_previousContext = llvmContext.getDiagnosticContext();
+        llvmContext.setDiagnosticHandler(&ModuleOptimizer::handleDiagnostic, this, false);
+    }
+
+    // 和 clang 一样，Os 是 O2 加上 SizeLevel 1，O2 以上才向量化
+    llvm::PassManagerBuilder builder;
+    builder.OptLevel = m_level == optimize_Os ? 2 : (unsigned)m_level;
+    builder.SizeLevel = m_level == optimize_Os ? 1 : 0;
+    builder.LoopVectorize = builder.OptLevel > 1;
+    builder.SLPVectorize = builder.OptLevel > 1;
+    // builder 负责释放 Inliner，运算符函数标了 alwaysinline，O2 以上其他函数按级别的阈值内联
+    if (builder.OptLevel > 1) {
+        builder.Inliner = llvm::createFunctionInliningPass(builder.OptLevel, builder.SizeLevel);
+    } else {
+        builder.Inliner = llvm::createAlwaysInlinerPass();
+    }
+    // builder 负责释放 LibraryInfo
+    auto libraryInfo = new llvm::TargetLibraryInfoImpl(m_targetMachine.getTargetTriple());
+    libraryInfo->addVectorizableFunctionsFromVecLib(m_vectorLibrary);
+    builder.LibraryInfo = libraryInfo;
+
+    llvm::legacy::FunctionPassManager functionPassManager(&module);
+    functionPassManager.add(llvm::createTargetTransformInfoWrapperPass(m_targetMachine.getTargetIRAnalysis()));
+    // O0 和 O1 的组合中没有 tailcallelim，各个级别都先加上，深的递归不会栈溢出
+    addTailCallPasses(functionPassManager);
+    builder.populateFunctionPassManager(functionPassManager);
+
+    llvm::legacy::PassManager passManager;
+    passManager.add(llvm::createTargetTransformInfoWrapperPass(m_targetMachine.getTargetIRAnalysis()));
+    builder.populateModulePassManager(passManager);
+
+    functionPassManager.doInitialization();
+    for (auto &function : module) {
+        functionPassManager.run(function);
+    }
+    functionPassManager.doFinalization();
+    passManager.run(module);
+
+    if (m_loopReport) {
+        llvmContext.setDiagnosticHandler(m_previousHandler, m_previousContext);
+        m_previousHandler = nullptr;
+        m_previousContext = nullptr;
+        this->collectLoops(module, true);
+    }
+}
+
+void ModuleOptimizer::printLoopReport(llvm::raw_ostream &out) const {
+    for (const auto &loop : m_loops) {
+        out << loop.m_line << ':' << loop.m_column << ": ";
+        if (!loop.m_message.empty()) {
+            out << loop.m_message;
+        } else if (!loop.m_survived) {
+            out << "loop not vectorized: removed by earlier optimizations, for example fully unrolled";
+        } else if (m_level < optimize_O2) {
+            out << "loop not vectorized: vectorization is disabled at " << getOptimizationLevelName(m_level);
+        } else {
+            out << "loop not vectorized: only innermost loops are vectorized";
+        }
+        out << '\n';
+    }
+}
@@ -0,0 +1,127 @@
+//
+// Created by 董宏昌 on 2017/2/28.
+//
+
+#ifndef PROJECT_MODULEOPTIMIZER_H
+#define PROJECT_MODULEOPTIMIZER_H
+
+
+#include <string>
+#include <vector>
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Analysis/TargetLibraryInfo.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+
+
+/*
+ * 一个 for 循环的向量化结果，按循环开始的源码位置对应到 for
+ */
+struct LoopReportEntry {
+    unsigned m_line;
+    unsigned m_column;
+    bool m_vectorized;
+    /// 优化之后循环是否还在，被完全展开或者删掉的循环不会经过向量化
+    bool m_survived;
+    /// loop-vectorize 给出的说明，向量化时是向量的宽度，否则是没有向量化的原因
+    std::string m_message;
+};
+
+
+/// 优化级别，对应命令行的 -O0 到 -O3 和 -Os，JIT 和输出目标文件时共用
+enum OptimizationLevel {
+    optimize_O0,
+    optimize_O1,
+    optimize_O2,
+    optimize_O3,
+    /// 和 O2 相同，但是内联和展开时优先考虑代码大小
+    optimize_Os,
+};
+
+/// 解析 -O0、-O1、-O2、-O3、-Os，不是优化级别时返回 false
+extern bool parseOptimizationLevel(llvm::StringRef flag, OptimizationLevel &level);
+/// 级别的名字，比如 "O2"
+extern const char *getOptimizationLevelName(OptimizationLevel level);
+
+
+/*
+ * 加入消除尾递归的 pass，JIT 和输出目标文件时共用
+ * 递归的尾调用和 n + f(n - 1) 这样可以用累加器改写的递归都变成循环，递归再深也只用一个栈帧
+ * 先用 mem2reg 把参数和变量从 alloca 提到寄存器，simplifycfg 把 if 合并处的 ret 提到各个分支中
+ * 累加器只能是满足结合律的运算，i64 的 + * 可以，浮点数的 + * 只在打开 fast-math 时可以
+ */
+void addTailCallPasses(llvm::legacy::PassManagerBase &passManager);
+
+
+/*
+ * 用 llvm 标准的 O0 到 O3、Os 的 pass 组合优化模块，默认是 O3，向量的宽度由 targetMachine 决定
+ * 各个级别都会先消除尾递归；O0、O1 只内联运算符这样标了 alwaysinline 的函数，O2 以上按代价内联并打开向量化
+ * 打开循环报告时，优化期间接管模块所在 llvm 上下文的诊断信息，
+ * 按 llvm.loop 元数据中的源码位置记下 loop-vectorize 对每个 for 的结论
+ */
+class ModuleOptimizer {
+private:
+    llvm::TargetMachine &m_targetMachine;
+    OptimizationLevel m_level;
+    bool m_loopReport;
+    /// 循环向量化时数学函数对应的向量版本所在的库
+    llvm::TargetLibraryInfoImpl::VectorLibrary m_vectorLibrary;
+    /// 按源码位置排序的循环
+    std::vector<LoopReportEntry> m_loops;
+    /// 优化之前 llvm 上下文的诊断处理函数，不是向量化的诊断信息仍然交给它
+    llvm::LLVMContext::DiagnosticHandlerTy m_previousHandler;
+    void *m_previousContext;
+    /// 没有向量化的具体原因按出问题的指令定位，对不上循环时先记在这里，交给紧接着按循环定位的那一条
+    std::string m_pendingReason;
+
+    static void handleDiagnostic(const llvm::DiagnosticInfo &diagnostic, void *context);
+    /*
+     * 记下模块中所有带源码位置的循环，优化之前调用时新建记录，之后调用时标记还在的循环
+     */
+    void collectLoops(llvm::Module &module, bool afterOptimization);
+    LoopReportEntry *findLoop(unsigned line, unsigned column);
+
+public:
+    explicit ModuleOptimizer(llvm::TargetMachine &targetMachine);
+
+    void setOptimizationLevel(OptimizationLevel level) {
+        m_level = level;
+    }
+    OptimizationLevel getOptimizationLevel() const {
+        return m_level;
+    }
+
+    /*
+     * 打开后 run 会记录每个循环的向量化结果，默认关闭
+     */
+    void setLoopReport(bool enabled) {
+        m_loopReport = enabled;
+    }
+
+    /*
+     * 设置向量数学库，循环中调用的数学函数可以换成库中一次处理一个向量的版本，默认没有
+     * llvm 目前只支持 Accelerate，其中只有 float 的版本，比如 sinf 对应 vsinf
+     */
+    void setVectorLibrary(llvm::TargetLibraryInfoImpl::VectorLibrary vectorLibrary) {
+        m_vectorLibrary = vectorLibrary;
+    }
+
+    /*
+     * 设置模块的目标平台并优化，模块中已有的函数都会被优化
+     */
+    void run(llvm::Module &module);
+
+    const std::vector<LoopReportEntry> &getLoops() const {
+        return m_loops;
+    }
+    /*
+     * 每个循环输出一行：行:列: 结论
+     */
+    void printLoopReport(llvm::raw_ostream &out) const;
+};
+
+
+#endif //PROJECT_MODULEOPTIMIZER_H
@@ -0,0 +1,227 @@
+//
+// Created by 董宏昌 on 2017/2/20.
+//
+
+#include "NumberLiteral.h"
+#include <cstdint>
+#include <cstdlib>
+#include "llvm/ADT/SmallString.h"
+
+
+/// 10 的 0~22 次方，都能被 double 精确表示
+static const double kExactPowersOf10[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+/// 尾数最多累计 19 位十进制数字，不会超过 uint64_t
+static const int kMaxMantissaDigits = 19;
+/// 指数的绝对值超过这个数时一定上溢或下溢，不必再累加
+static const int kMaxExponent = 100000;
+
+
+static inline bool isDigitChar(const char *ptr, const char *end) {
+    return ptr != end && *ptr >= '0' && *ptr <= '9';
+}
+
+static inline bool isHexDigitChar(const char *ptr, const char *end) {
+    return ptr != end && ((*ptr >= '0' && *ptr <= '9') || (*ptr >= 'a' && *ptr <= 'f') || (*ptr >= 'A' && *ptr <= 'F'));
+}
+
+static inline bool isLiteralTailChar(const char *ptr, const char *end) {
+    return ptr != end && ((*ptr >= '0' && *ptr <= '9') || (*ptr >= 'a' && *ptr <= 'z') || (*ptr >= 'A' && *ptr <= 'Z') || *ptr == '.');
+}
+
+/*
+ * 解析 [+-]?[0-9]+ 形式的指数，成功时 ptr 指向指数后的第一个字符
+ */
+static bool parseExponent(const char *&ptr, const char *end, int &exponent) {
+    bool negative = false;
+    if (ptr != end && (*ptr == '+' || *ptr == '-')) {
+        negative = *ptr == '-';
+        ++ptr;
+    }
+
+    if (!isDigitChar(ptr, end)) {
+        return false;
+    }
+
+    exponent = 0;
+    for (; isDigitChar(ptr, end); ++ptr) {
+        if (exponent < kMaxExponent) {
+            exponent = exponent * 10 + (*ptr - '0');
+        }
+    }
+    if (negative) {
+        exponent = -exponent;
+    }
+
+    return true;
+}
+
+/*
+ * 对已经检查过格式的常量做就近舍入的转换
+ * 输入缓冲区不一定以 '\0' 结尾，先拷贝到栈上的小缓冲里
+ */
+static double convertSlowPath(const char *begin, const char *end) {
+    llvm::SmallString<64> literal(begin, end);
+
+    return strtod(literal.c_str(), nullptr);
+}
+
+static inline unsigned hexDigitValue(char c) {
+    return c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10;
+}
+
+/*
+ * 十六进制常量 0x[0-9a-fA-F]*(.[0-9a-fA-F]*)?([pP][+-]?[0-9]+)?，至少要有一位数字
+ */
+static bool parseHexLiteral(const char *&ptr, const char *end, const char *begin, double &value,
+                            bool &isInteger, int64_t &integer) {
+    bool hasDigits = false;
+    // 整数部分超过 int64_t 时不再是整数常量
+    uint64_t digits = 0;
+    isInteger = true;
+    while (isHexDigitChar(ptr, end)) {
+        if (digits > (uint64_t)INT64_MAX >> 4) {
+            isInteger = false;
+        }
+        digits = digits << 4 | hexDigitValue(*ptr);
+        ++ptr;
+        hasDigits = true;
+    }
+    isInteger = isInteger && digits <= (uint64_t)INT64_MAX;
+    if (ptr != end && *ptr == '.') {
+        isInteger = false;
+        ++ptr;
+        while (isHexDigitChar(ptr, end)) {
+            ++ptr;
+            hasDigits = true;
+        }
+    }
+    if (!hasDigits) {
+        return false;
+    }
+
+    if (ptr != end && (*ptr == 'p' || *ptr == 'P')) {
+        isInteger = false;
+        ++ptr;
+        int exponent;
+        if (!parseExponent(ptr, end, exponent)) {
+            return false;
+        }
+    }
+
+    if (isLiteralTailChar(ptr, end)) {
+        return false;
+    }
+
+    // 十六进制到二进制没有精度问题，strtod 的结果就是精确舍入的
+    value = convertSlowPath(begin, ptr);
+    integer = (int64_t)digits;
+
+    return true;
+}
+
+bool parseNumberLiteral(const char *&ptr, const char *end, double &value) {
+    bool isInteger;
+    int64_t integer;
+
+    return parseNumberLiteral(ptr, end, value, isInteger, integer);
+}
+
+bool parseNumberLiteral(const char *&ptr, const char *end, double &value, bool &isInteger, int64_t &integer) {
+    const char *begin = ptr;
+    isInteger = false;
+
+    if (end - ptr >= 2 && ptr[0] == '0' && (ptr[1] == 'x' || ptr[1] == 'X')) {
+        ptr += 2;
+        if (parseHexLiteral(ptr, end, begin, value, isInteger, integer)) {
+            return true;
+        }
+        isInteger = false;
+    } else {
+        // 尾数的有效数字，以及它对应的十进制指数
+        uint64_t mantissa = 0;
+        int mantissaDigits = 0;
+        int exponent10 = 0;
+        // 超过 kMaxMantissaDigits 的部分里是否还有非零数字
+        bool truncated = false;
+        bool hasDigits = false;
+        // 有小数点或者指数的常量是 double
+        bool hasFraction = false;
+
+        for (; isDigitChar(ptr, end); ++ptr) {
+            hasDigits = true;
+            int digit = *ptr - '0';
+            if (mantissaDigits < kMaxMantissaDigits) {
+                // 前导的 0 不占用有效数字
+                if (mantissa != 0 || digit != 0) {
+                    mantissa = mantissa * 10 + digit;
+                    ++mantissaDigits;
+                }
+            } else {
+                ++exponent10;
+                truncated |= digit != 0;
+            }
+        }
+
+        if (ptr != end && *ptr == '.') {
+            hasFraction = true;
+            ++ptr;
+            for (; isDigitChar(ptr, end); ++ptr) {
+                hasDigits = true;
+                int digit = *ptr - '0';
+                if (mantissaDigits < kMaxMantissaDigits) {
+                    if (mantissa != 0 || digit != 0) {
+                        mantissa = mantissa * 10 + digit;
+                        ++mantissaDigits;
+                    }
+                    --exponent10;
+                } else {
+                    truncated |= digit != 0;
+                }
+            }
+        }
+
+        bool valid = hasDigits;
+        if (valid && ptr != end && (*ptr == 'e' || *ptr == 'E')) {
+            hasFraction = true;
+            ++ptr;
+            int exponent;
+            if (parseExponent(ptr, end, exponent)) {
+                exponent10 += exponent;
+            } else {
+                valid = false;
+            }
+        }
+
+        if (valid && !isLiteralTailChar(ptr, end)) {
+            // 超过 19 位有效数字时 exponent10 不为 0
+            if (!hasFraction && exponent10 == 0 && mantissa <= (uint64_t)INT64_MAX) {
+                isInteger = true;
+                integer = (int64_t)mantissa;
+            }
+
+            if (mantissa == 0) {
+                value = 0.0;
+            } else if (!truncated && mantissa <= (1ull << 53) && exponent10 >= -22 && exponent10 <= 22) {
+                // 尾数和 10 的幂都能被 double 精确表示，一次乘除只舍入一次，结果就是就近舍入的
+                double exactMantissa = (double)mantissa;
+                value = exponent10 >= 0 ? exactMantissa * kExactPowersOf10[exponent10]
+                                        : exactMantissa / kExactPowersOf10[-exponent10];
+            } else {
+                value = convertSlowPath(begin, ptr);
+            }
+
+            return true;
+        }
+    }
+
+    // 格式错误时跳过整段，避免把 1.2.3 的剩余部分当成新的 token
+    while (isLiteralTailChar(ptr, end)) {
+        ++ptr;
+    }
+
+    return false;
+}
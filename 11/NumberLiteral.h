@@ -0,0 +1,28 @@
+//
+// Created by 董宏昌 on 2017/2/20.
+//
+
+#ifndef PROJECT_NUMBERLITERAL_H
+#define PROJECT_NUMBERLITERAL_H
+
+
+#include <cstdint>
+
+/*
+ * 从 ptr 开始解析一个数字常量，结果写入 value
+ * 支持的写法：
+ *   十进制     123  1.5  .5  1.  1e-9  2.5E+3
+ *   十六进制   0x1F  0x1.8p3  0x.8p-1
+ * 成功时 ptr 指向常量后的第一个字符，返回 true
+ * 常量格式错误时（比如 1.2.3、1e、12abc）返回 false，ptr 跳过整段 [0-9a-zA-Z.] 以便继续解析
+ * 解析过程不分配内存，结果按 IEEE 就近舍入
+ */
+bool parseNumberLiteral(const char *&ptr, const char *end, double &value);
+/*
+ * 同上，另外判断常量是不是整数：没有小数点和指数，并且能被 int64_t 表示的十进制或十六进制常量，
+ * 这时 isInteger 为 true，integer 是它的精确值，value 仍然是就近舍入的 double
+ */
+bool parseNumberLiteral(const char *&ptr, const char *end, double &value, bool &isInteger, int64_t &integer);
+
+
+#endif //PROJECT_NUMBERLITERAL_H
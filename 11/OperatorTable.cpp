@@ -0,0 +1,45 @@
+//
+// Created by 董宏昌 on 2017/2/28.
+//
+
+#include "OperatorTable.h"
+#include "Token.h"
+
+
+OperatorTable kOperatorTable;
+
+
+OperatorTable::OperatorTable() {
+    for (unsigned i = 0; i < 256; ++i) {
+        m_prefix[i].store(i < 128 ? prefix_unary : prefix_none, std::memory_order_relaxed);
+        m_infix[i].store(0, std::memory_order_relaxed);
+    }
+
+    // '(' 是括号，',' 不能作为表达式的开头
+    m_prefix[indexOf('(')].store(prefix_paren, std::memory_order_relaxed);
+    m_prefix[indexOf(',')].store(prefix_none, std::memory_order_relaxed);
+
+    m_prefix[indexOf(token_identifier)].store(prefix_identifier, std::memory_order_relaxed);
+    m_prefix[indexOf(token_number)].store(prefix_number, std::memory_order_relaxed);
+    m_prefix[indexOf(token_if)].store(prefix_if, std::memory_order_relaxed);
+    m_prefix[indexOf(token_for)].store(prefix_for, std::memory_order_relaxed);
+    m_prefix[indexOf(token_var)].store(prefix_var, std::memory_order_relaxed);
+    m_prefix[indexOf(token_error)].store(prefix_error, std::memory_order_relaxed);
+}
+
+OperatorTable::OperatorTable(const OperatorTable &other) {
+    *this = other;
+}
+
+OperatorTable& OperatorTable::operator=(const OperatorTable &other) {
+    for (unsigned i = 0; i < 256; ++i) {
+        m_prefix[i].store(other.m_prefix[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        m_infix[i].store(other.m_infix[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+
+    return *this;
+}
+
+void OperatorTable::setBinaryPrecedence(int op, int precedence) {
+    m_infix[indexOf(op)].store((uint8_t)precedence, std::memory_order_relaxed);
+}
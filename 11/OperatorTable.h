@@ -0,0 +1,78 @@
+//
+// Created by 董宏昌 on 2017/2/28.
+//
+
+#ifndef PROJECT_OPERATORTABLE_H
+#define PROJECT_OPERATORTABLE_H
+
+
+#include <atomic>
+#include <cstdint>
+
+
+/// token 出现在表达式开头时的解析方式
+enum PrefixKind : uint8_t {
+    /// 不能作为表达式的开头
+    prefix_none,
+    /// 一元运算符，'(' 和 ',' 之外的 ascii 字符都是，没有定义的一元运算符在生成代码时报错
+    prefix_unary,
+    prefix_paren,
+    prefix_identifier,
+    prefix_number,
+    prefix_if,
+    prefix_for,
+    prefix_var,
+    /// 词法错误，错误信息已经输出过了
+    prefix_error,
+};
+
+
+/*
+ * Pratt 解析用的运算符表
+ * 前缀表决定 token 出现在表达式开头时怎样解析，中缀表记录二元运算符的优先级，
+ * 两个表都是 256 项的定长数组，按 token 直接取下标，不需要查找
+ * 表项都是原子的，def binary 生成代码时更新优先级，其他线程可以同时读取
+ * 拷贝一份就得到一个快照，快照不再变化，多个解析器可以共享同一个快照
+ */
+class OperatorTable {
+private:
+    std::atomic<uint8_t> m_prefix[256];
+    /// 二元运算符的优先级，0 表示不是二元运算符
+    std::atomic<uint8_t> m_infix[256];
+
+    /*
+     * token 在表中的下标，ascii 字符就是它自己，非 ascii 字符都对应 128，关键字是负数，排在 129 之后
+     */
+    static unsigned indexOf(int token) {
+        return token < 0 ? 128u - token : token < 128 ? (unsigned)token : 128u;
+    }
+
+public:
+    OperatorTable();
+    OperatorTable(const OperatorTable &other);
+    OperatorTable &operator=(const OperatorTable &other);
+
+    PrefixKind getPrefixKind(int token) const {
+        return (PrefixKind)m_prefix[indexOf(token)].load(std::memory_order_relaxed);
+    }
+
+    /*
+     * 返回二元运算符的优先级，不是二元运算符时返回 -1
+     */
+    int getBinaryPrecedence(int token) const {
+        int precedence = m_infix[indexOf(token)].load(std::memory_order_relaxed);
+        return precedence ? precedence : -1;
+    }
+
+    /*
+     * 定义二元运算符的优先级，op 是 ascii 字符或者两个字符的运算符的 token，precedence 在 1..255 之间
+     */
+    void setBinaryPrecedence(int op, int precedence);
+};
+
+
+/// 全局的运算符表，逐个解析时和生成代码共用
+extern OperatorTable kOperatorTable;
+
+
+#endif //PROJECT_OPERATORTABLE_H
@@ -0,0 +1,209 @@
+//
+// Created by 董宏昌 on 2017/2/28.
+//
+
+/*
+ * 各个优化级别的编译耗时和运行耗时
+ * 其他几个性能测试中的内核放在一起作为测试集：归约循环、标量和 vec4 的三维变换、线性递归、
+ * 调用小函数的循环和双重递归的 fib，每个级别都从头生成代码，按 ModuleOptimizer 优化后 JIT 编译成机器码
+ * 编译耗时包括生成 IR、优化和生成机器码，运行耗时是每个内核重复运行的平均值
+ * 用法：llvmTest11OptBenchmark [重复次数]，默认重复 5 次
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+#include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/ExecutionEngine/MCJIT.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Target/TargetMachine.h"
+#include "CodeGenerator.h"
+#include "CodegenContext.h"
+#include "ExprParser.h"
+#include "ModuleOptimizer.h"
+#include "Token.h"
+
+
+/// 测试集，入口函数都是 (n:i64) 返回 double
+static const char kCorpusSource[] =
+        "def reduce(n:i64 x) var s = 0.0 in (for i = 0, n < i in s = s + i * x) + s;\n"
+        "def testreduce(n:i64) reduce(n, 0.5);\n"
+        "def transforms(n:i64)\n"
+        "  var x = 1.0, y = 2.0, z = 3.0 in\n"
+        "    (for i = 1, n <= i in\n"
+        "      var nx = 0.36 * x + 0.48 * y - 0.8 * z + 0.1,\n"
+        "          ny = 0.6 * y - 0.8 * x + 0.2,\n"
+        "          nz = 0.48 * x + 0.64 * y + 0.6 * z + 0.3 in\n"
+        "        (x = nx) + (y = ny) + (z = nz))\n"
+        "    + x + y + z;\n"
+        "def transformv(n:i64 p:vec4 c0:vec4 c1:vec4 c2:vec4 c3:vec4):vec4\n"
+        "  (for i = 1, n <= i in p = c0 * lane(p, 0) + c1 * lane(p, 1) + c2 * lane(p, 2) + c3) + p;\n"
+        "def transformsv(n:i64)\n"
+        "  hsum(transformv(n, vec4(1, 2, 3, 0), vec4(0.36, 0 - 0.8, 0.48, 0), vec4(0.48, 0.6, 0.64, 0),\n"
+        "                  vec4(0 - 0.8, 0, 0.6, 0), vec4(0.1, 0.2, 0.3, 0)));\n"
+        "def sumdown(n:i64):i64 if n < 1 then 0 else n + sumdown(n - 1);\n"
+        "def testsum(n:i64) sumdown(n);\n"
+        "def square(x) x * x;\n"
+        "def sumsquares(n:i64) var s = 0.0 in (for i = 1, n < i in s = s + square(i * 0.001)) + s;\n"
+        "def fib(n:i64):i64 if n < 2 then n else fib(n - 1) + fib(n - 2);\n"
+        "def testfib(n:i64) fib(n);\n";
+
+
+/*
+ * 测试集中的一个内核，entry 是从 C++ 调用的函数，count 是传给它的参数
+ */
+struct CorpusKernel {
+    const char *m_label;
+    const char *m_entry;
+    int64_t m_count;
+};
+
+static const CorpusKernel kKernels[] = {
+        {"reduce", "testreduce", 10000000},
+        {"transform", "transforms", 2000000},
+        {"vec4", "transformsv", 2000000},
+        {"sumdown", "testsum", 10000000},
+        {"square", "sumsquares", 10000000},
+        {"fib", "testfib", 30},
+};
+
+static const OptimizationLevel kLevels[] = {optimize_O0, optimize_O1, optimize_O2, optimize_O3, optimize_Os};
+
+
+static double millisecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static bool parseSource(const std::string &source, ExprParser &parser, FlatAST &flatAST) {
+    std::vector<TopLevelItem> items;
+    parser.parseTopLevelItems(source, items);
+    for (const auto &item : items) {
+        if (!item.m_errors.empty()) {
+            fputs(item.m_errors.c_str(), stderr);
+            return false;
+        }
+
+        if (item.m_function) {
+            flatAST.addFunction(item.m_function);
+        } else if (item.m_prototype) {
+            flatAST.addPrototype(item.m_prototype);
+        }
+    }
+
+    return true;
+}
+
+
+int main(int argc, char const *argv[]) {
+    unsigned repeats = argc > 1 ? (unsigned)strtoul(argv[1], nullptr, 10) : 5;
+    repeats = std::max(1u, repeats);
+
+    // 和 toy.cpp 中相同的运算符优先级
+    {
+        kOperatorTable.setBinaryPrecedence('=', 2);
+        kOperatorTable.setBinaryPrecedence(token_or, 5);
+        kOperatorTable.setBinaryPrecedence(token_and, 6);
+        kOperatorTable.setBinaryPrecedence(token_equal, 9);
+        kOperatorTable.setBinaryPrecedence(token_not_equal, 9);
+        kOperatorTable.setBinaryPrecedence('<', 10);
+        kOperatorTable.setBinaryPrecedence('>', 10);
+        kOperatorTable.setBinaryPrecedence(token_less_equal, 10);
+        kOperatorTable.setBinaryPrecedence(token_greater_equal, 10);
+        kOperatorTable.setBinaryPrecedence('+', 20);
+        kOperatorTable.setBinaryPrecedence('-', 30);
+        kOperatorTable.setBinaryPrecedence('*', 40);
+    }
+
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+
+    // 解析只做一次，各个级别都在同一个 flatAST 上生成代码
+    ExprParser parser;
+    FlatAST flatAST;
+    if (!parseSource(kCorpusSource, parser, flatAST)) {
+        return 1;
+    }
+
+    const size_t kernelCount = sizeof(kKernels) / sizeof(kKernels[0]);
+    printf("%6s %12s", "level", "compile(ms)");
+    for (const auto &kernel : kKernels) {
+        printf(" %11s", kernel.m_label);
+    }
+    printf(" %12s\n", "run(ms)");
+
+    std::vector<double> firstResults;
+    for (OptimizationLevel level : kLevels) {
+        auto compileStart = std::chrono::steady_clock::now();
+
+        // 先声明 codegenContext，模块属于它的 llvm 上下文，要比 engine 活得久
+        CodegenContext codegenContext;
+        for (FunctionIndex function = 0; function < flatAST.getFunctionCount(); ++function) {
+            if (!CodeGenerator(codegenContext, flatAST).codegenFunction(function)) {
+                return 1;
+            }
+        }
+        std::unique_ptr<llvm::Module> module = codegenContext.takeModule();
+
+        std::string error;
+        llvm::EngineBuilder engineBuilder;
+        engineBuilder.setErrorStr(&error).setEngineKind(llvm::EngineKind::JIT).setMCPU(llvm::sys::getHostCPUName());
+        llvm::TargetMachine *targetMachine = engineBuilder.selectTarget();
+        if (!targetMachine) {
+            fprintf(stderr, "Could not select target: %s\n", error.c_str());
+            return 1;
+        }
+        ModuleOptimizer optimizer(*targetMachine);
+        optimizer.setOptimizationLevel(level);
+        optimizer.run(*module);
+
+        // engine 接管 module 和 targetMachine
+        std::unique_ptr<llvm::ExecutionEngine> engine(
+                llvm::EngineBuilder(std::move(module)).setErrorStr(&error).setEngineKind(llvm::EngineKind::JIT)
+                        .create(targetMachine));
+        if (!engine) {
+            fprintf(stderr, "Could not create JIT: %s\n", error.c_str());
+            return 1;
+        }
+        engine->finalizeObject();
+        double compileTime = millisecondsSince(compileStart);
+
+        printf("%6s %12.2f", getOptimizationLevelName(level), compileTime);
+        double totalRunTime = 0;
+        for (size_t i = 0; i < kernelCount; ++i) {
+            uint64_t address = engine->getFunctionAddress(kKernels[i].m_entry);
+            if (!address) {
+                fprintf(stderr, "Could not find %s\n", kKernels[i].m_entry);
+                return 1;
+            }
+
+            double result = 0;
+            auto runStart = std::chrono::steady_clock::now();
+            for (unsigned j = 0; j < repeats; ++j) {
+                result = ((double (*)(int64_t))address)(kKernels[i].m_count);
+            }
+            double runTime = millisecondsSince(runStart) / repeats;
+            totalRunTime += runTime;
+            printf(" %11.2f", runTime);
+
+            // 各个级别的结果只差浮点运算顺序带来的舍入误差
+            if (firstResults.size() < kernelCount) {
+                firstResults.push_back(result);
+            } else if (std::abs(result - firstResults[i]) > 1e-6 * std::abs(firstResults[i])) {
+                fprintf(stderr, "\n%s: result %.12g differs from %.12g at O0\n", kKernels[i].m_label, result,
+                        firstResults[i]);
+                return 1;
+            }
+        }
+        printf(" %12.2f\n", totalRunTime);
+        fflush(stdout);
+    }
+
+    return 0;
+}
@@ -0,0 +1,185 @@
+//
+// Created by 董宏昌 on 2017/2/28.
+//
+
+#include "ParallelCodegen.h"
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/Bitcode/ReaderWriter.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include "CodeGenerator.h"
+
+
+ParallelCodegen::ParallelCodegen(unsigned threadCount)
+        : m_threadCount(threadCount) {
+    if (m_threadCount == 0) {
+        m_threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+}
+
+bool ParallelCodegen::indexFunctions(const FlatAST &ast, std::vector<bool> &skipped) {
+    m_functions.clear();
+    skipped.assign(ast.getFunctionCount(), false);
+
+    bool redefined = false;
+    for (FunctionIndex function = 0; function < ast.getFunctionCount(); ++function) {
+        const FlatFunction &flatFunction = ast.getFunction(function);
+        if (flatFunction.m_name == kEmptySymbol) {
+            continue;
+        }
+
+        auto inserted = m_functions.insert(std::make_pair(flatFunction.m_name, function));
+        if (inserted.second || flatFunction.m_body == kNoNode) {
+            continue;
+        }
+
+        if (ast.getFunction(inserted.first->second).m_body == kNoNode) {
+            // 先写了 extern，之后的实现代替它
+            inserted.first->second = function;
+        } else {
+            // 和逐个生成时一样，同名函数只有第一个实现有效
+            fprintf(stderr, "LogErrorV: Function cannot be redefined\n");
+            skipped[function] = true;
+            redefined = true;
+        }
+    }
+
+    return redefined;
+}
+
+bool ParallelCodegen::generate(const FlatAST &ast, const OperatorTable &operatorTable, FloatMode floatMode) {
+    FunctionIndex functionCount = (FunctionIndex)ast.getFunctionCount();
+    m_modules.clear();
+    m_modules.resize(functionCount);
+    m_batchBegins.clear();
+
+    std::vector<bool> skipped;
+    bool succeeded = !this->indexFunctions(ast, skipped);
+
+    // 连续的几个函数分给同一个线程，按线程的顺序链接时函数在模块中的顺序和源码相同
+    size_t threadCount = std::max<size_t>(1, std::min<size_t>(m_threadCount, functionCount));
+    for (size_t batch = 0; batch <= threadCount; ++batch) {
+        m_batchBegins.push_back((FunctionIndex)(functionCount * batch / threadCount));
+    }
+    while (m_contexts.size() < threadCount) {
+        m_contexts.push_back(llvm::make_unique<CodegenContext>());
+    }
+
+    std::vector<char> batchSucceeded(threadCount, 1);
+    auto generateBatch = [&](size_t batch) {
+        CodegenContext &context = *m_contexts[batch];
+        context.getOperatorTable() = operatorTable;
+        context.setFloatMode(floatMode);
+        context.setExternalFunctions(&ast, &m_functions);
+
+        for (FunctionIndex function = m_batchBegins[batch]; function < m_batchBegins[batch + 1]; ++function) {
+            // extern 不需要模块，调用它的模块中会有声明
+            if (skipped[function] || ast.getFunction(function).m_body == kNoNode) {
+                continue;
+            }
+
+            bool generated = CodeGenerator(context, ast).codegenFunction(function) != nullptr;
+            // 失败时模块中只剩下声明，也一起丢掉
+            std::unique_ptr<llvm::Module> module = context.takeModule();
+            if (generated) {
+                m_modules[function] = std::move(module);
+            } else {
+                batchSucceeded[batch] = 0;
+            }
+        }
+
+        context.setExternalFunctions(nullptr, nullptr);
+    };
+
+    // 第一批在当前线程中生成
+    std::vector<std::thread> threads;
+    for (size_t batch = 1; batch < threadCount; ++batch) {
+        threads.push_back(std::thread(generateBatch, batch));
+    }
+    generateBatch(0);
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    for (char batch : batchSucceeded) {
+        succeeded = succeeded && batch;
+    }
+
+    return succeeded;
+}
+
+std::unique_ptr<llvm::Module> ParallelCodegen::takeModule(FunctionIndex function) {
+    if (function >= m_modules.size()) {
+        return nullptr;
+    }
+
+    return std::move(m_modules[function]);
+}
+
+bool ParallelCodegen::linkInto(llvm::Module &destination) {
+    size_t batchCount = m_batchBegins.empty() ? 0 : m_batchBegins.size() - 1;
+    std::vector<std::string> bitcodes(batchCount);
+    std::vector<char> batchSucceeded(batchCount, 1);
+
+    // 同一个上下文中的模块可以直接链接，每个线程把自己的模块合成一个，写成 bitcode
+    // 每次链接都要扫描一遍目标模块，所以相邻的模块两两合并，逐层向上，每一层的耗时和函数个数成正比
+    auto linkBatch = [&](size_t batch) {
+        std::vector<std::unique_ptr<llvm::Module>> modules;
+        modules.push_back(m_contexts[batch]->takeModule());
+        for (FunctionIndex function = m_batchBegins[batch]; function < m_batchBegins[batch + 1]; ++function) {
+            if (m_modules[function]) {
+                modules.push_back(std::move(m_modules[function]));
+            }
+        }
+
+        while (modules.size() > 1) {
+            size_t merged = 0;
+            for (size_t i = 0; i < modules.size(); i += 2) {
+                if (i + 1 < modules.size() && llvm::Linker::linkModules(*modules[i], std::move(modules[i + 1]))) {
+                    batchSucceeded[batch] = 0;
+                }
+                modules[merged++] = std::move(modules[i]);
+            }
+            modules.resize(merged);
+        }
+
+        llvm::raw_string_ostream out(bitcodes[batch]);
+        llvm::WriteBitcodeToFile(modules[0].get(), out);
+        out.flush();
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t batch = 1; batch < batchCount; ++batch) {
+        threads.push_back(std::thread(linkBatch, batch));
+    }
+    if (batchCount) {
+        linkBatch(0);
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    // 不同的上下文之间只能经过 bitcode，按线程的顺序读入 destination 的上下文后链接
+    bool succeeded = true;
+    for (size_t batch = 0; batch < batchCount; ++batch) {
+        succeeded = succeeded && batchSucceeded[batch];
+
+        auto moduleOrError = llvm::parseBitcodeFile(llvm::MemoryBufferRef(bitcodes[batch], "batch"),
+                                                    destination.getContext());
+        if (!moduleOrError) {
+            fprintf(stderr, "Could not read generated bitcode: %s\n", moduleOrError.getError().message().c_str());
+            succeeded = false;
+            continue;
+        }
+        if (llvm::Linker::linkModules(destination, std::move(moduleOrError.get()))) {
+            succeeded = false;
+        }
+    }
+
+    return succeeded;
+}
@@ -0,0 +1,67 @@
+//
+// Created by 董宏昌 on 2017/2/28.
+//
+
+#ifndef PROJECT_PARALLELCODEGEN_H
+#define PROJECT_PARALLELCODEGEN_H
+
+
+#include <memory>
+#include <vector>
+#include "llvm/ADT/DenseMap.h"
+#include "CodegenContext.h"
+#include "FlatAST.h"
+#include "OperatorTable.h"
+
+
+/*
+ * 多线程生成代码
+ * 每个有实现的函数生成在自己单独的模块中，和 ParallelParser 一样每个线程负责连续的一批函数，
+ * 每个线程有自己的 CodegenContext，线程之间除了只读的 FlatAST 之外不共享任何状态
+ * 函数之间的调用在调用方的模块中按原型声明，之后 linkInto 链接成一个模块，或者用 takeModule 逐个交给 JIT
+ * 生成的模块属于各个线程的 llvm 上下文，交给 JIT 时 ParallelCodegen 要比 JIT 活得久
+ */
+class ParallelCodegen {
+private:
+    /// 生成代码的线程数
+    unsigned m_threadCount;
+    /// 各个线程的 CodegenContext，生成的模块属于它们的 llvm 上下文
+    std::vector<std::unique_ptr<CodegenContext>> m_contexts;
+    /// 函数名到实现它的函数，extern 只在没有实现时记录
+    llvm::DenseMap<Symbol, FunctionIndex> m_functions;
+    /// 下标是 FunctionIndex，extern 和生成失败的函数是 nullptr
+    std::vector<std::unique_ptr<llvm::Module>> m_modules;
+    /// 每个线程负责的第一个函数，最后一项是函数个数
+    std::vector<FunctionIndex> m_batchBegins;
+
+    /*
+     * 按名字登记 ast 中的所有函数，重复定义的函数报错后记在 skipped 中不再生成，返回是否有重复定义
+     */
+    bool indexFunctions(const FlatAST &ast, std::vector<bool> &skipped);
+
+public:
+    /*
+     * threadCount 为 0 时使用机器的核数
+     */
+    explicit ParallelCodegen(unsigned threadCount = 0);
+
+    /*
+     * 把 ast 中每个有实现的函数生成到单独的模块中，operatorTable 是解析 ast 时使用的运算符表，
+     * floatMode 是整个模块的浮点精度，见 CodegenContext::setFloatMode
+     * 之前生成的模块都会被丢掉，所有函数都生成成功时返回 true
+     */
+    bool generate(const FlatAST &ast, const OperatorTable &operatorTable, FloatMode floatMode = float_double);
+
+    /*
+     * 取走一个函数的模块，没有时返回 nullptr
+     */
+    std::unique_ptr<llvm::Module> takeModule(FunctionIndex function);
+    /*
+     * 把还没有取走的模块都链接到 destination 中，有错误时返回 false
+     * 各个线程先在自己的上下文中把自己的模块链接成一个，再经过 bitcode 搬到 destination 的上下文中
+     */
+    bool linkInto(llvm::Module &destination);
+};
+
+
+#endif //PROJECT_PARALLELCODEGEN_H
@@ -0,0 +1,258 @@
+//
+// Created by 董宏昌 on 2017/2/27.
+//
+
+#include "ParallelParser.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <map>
+#include <thread>
+#include "llvm/ADT/STLExtras.h"
+#include "CodegenContext.h"
+#include "NumberLiteral.h"
+
+
+/// 每个线程至少分到这么多字节才值得多开一个线程
+static const size_t kMinBytesPerThread = 64 * 1024;
+/// 没有写优先级时二元运算符的默认优先级，与 ExprParser::parsePrototype 一致
+static const int kDefaultBinaryPrecedence = 30;
+
+
+static inline bool isSpaceChar(char c) {
+    return isspace((unsigned char)c) != 0;
+}
+
+static inline bool isAlphaChar(char c) {
+    return isalpha((unsigned char)c) != 0;
+}
+
+static inline bool isAlnumChar(char c) {
+    return isalnum((unsigned char)c) != 0;
+}
+
+/*
+ * 跳过空白和 # 注释
+ */
+static const char *skipSpacesAndComments(const char *ptr, const char *end) {
+    while (ptr != end) {
+        if (isSpaceChar(*ptr)) {
+            ++ptr;
+        } else if (*ptr == '#') {
+            while (ptr != end && *ptr != '\n' && *ptr != '\r') {
+                ++ptr;
+            }
+        } else {
+            break;
+        }
+    }
+
+    return ptr;
+}
+
+/*
+ * 读取 def binary 之后的运算符和优先级，格式错误时返回 false，交给解析器报错
+ */
+static bool scanBinaryDeclaration(const char *&ptr, const char *end, char &op, int &precedence) {
+    ptr = skipSpacesAndComments(ptr, end);
+    if (ptr == end || !isascii((unsigned char)*ptr) || isAlnumChar(*ptr) || *ptr == '.') {
+        return false;
+    }
+    op = *ptr++;
+
+    precedence = kDefaultBinaryPrecedence;
+    ptr = skipSpacesAndComments(ptr, end);
+    if (ptr != end && (isdigit((unsigned char)*ptr) || *ptr == '.')) {
+        double value;
+        if (!parseNumberLiteral(ptr, end, value) || value < 1 || value > 100) {
+            return false;
+        }
+        precedence = (unsigned)value;
+    }
+
+    return true;
+}
+
+bool ParallelParser::splitTopLevel(llvm::StringRef source, OperatorTable &operatorTable,
+                                   std::vector<llvm::StringRef> &chunks, bool &precedenceKnown) {
+    const char *ptr = source.begin();
+    const char *end = source.end();
+    const char *chunkStart = ptr;
+    // 上一个 token 是否是 def
+    bool afterDef = false;
+    std::map<char, int> declarations;
+    bool conflicted = false;
+
+    while (ptr != end) {
+        char c = *ptr;
+        if (isSpaceChar(c) || c == '#') {
+            ptr = skipSpacesAndComments(ptr, end);
+        } else if (c == ';') {
+            chunks.push_back(llvm::StringRef(chunkStart, ptr - chunkStart));
+            chunkStart = ++ptr;
+            afterDef = false;
+        } else if (isAlphaChar(c)) {
+            const char *identifierStart = ptr;
+            while (ptr != end && isAlnumChar(*ptr)) {
+                ++ptr;
+            }
+            llvm::StringRef identifier(identifierStart, ptr - identifierStart);
+
+            char op;
+            int precedence;
+            if (afterDef && identifier == "binary" && scanBinaryDeclaration(ptr, end, op, precedence)) {
+                if (op == ';') {
+                    return false;
+                }
+
+                auto declared = declarations.find(op);
+                int existing = operatorTable.getBinaryPrecedence(op);
+                if ((declared != declarations.end() && declared->second != precedence) ||
+                    (existing > 0 && existing != precedence)) {
+                    conflicted = true;
+                }
+                declarations[op] = precedence;
+            }
+            afterDef = identifier == "def";
+        } else if (isdigit((unsigned char)c) || c == '.') {
+            // 数字常量里的字母不是标识符
+            while (ptr != end && (isAlnumChar(*ptr) || *ptr == '.')) {
+                ++ptr;
+            }
+            afterDef = false;
+        } else {
+            ++ptr;
+            afterDef = false;
+        }
+    }
+    chunks.push_back(llvm::StringRef(chunkStart, end - chunkStart));
+
+    // 确定没有冲突后才登记
+    precedenceKnown = !conflicted;
+    if (precedenceKnown) {
+        for (const auto &declaration : declarations) {
+            operatorTable.setBinaryPrecedence(declaration.first, declaration.second);
+        }
+    }
+
+    return true;
+}
+
+
+ParallelParser::ParallelParser(CodegenContext &codegenContext, unsigned threadCount)
+        : m_codegenContext(codegenContext), m_threadCount(threadCount), m_hashConsing(false), m_deferCodegen(false) {
+    if (m_threadCount == 0) {
+        m_threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+}
+
+void ParallelParser::setHashConsing(bool enabled) {
+    m_hashConsing = enabled;
+}
+
+void ParallelParser::setDeferCodegen(bool enabled) {
+    m_deferCodegen = enabled;
+}
+
+bool ParallelParser::isCodegenDeferred() const {
+    return m_deferCodegen && !m_sequentialParser;
+}
+
+void ParallelParser::parse(llvm::StringRef codeString) {
+    m_contexts.clear();
+    m_flatAST.clear();
+    m_sequentialParser.reset();
+
+    std::vector<llvm::StringRef> chunks;
+    bool precedenceKnown;
+    if (!splitTopLevel(codeString, m_codegenContext.getOperatorTable(), chunks, precedenceKnown) || !precedenceKnown) {
+        m_sequentialParser = llvm::make_unique<ExprParser>();
+        m_sequentialParser->setCodegenContext(&m_codegenContext);
+        m_sequentialParser->setHashConsing(m_hashConsing);
+        m_sequentialParser->startParse(codeString);
+
+        return;
+    }
+
+    // 按字节数把连续的几段分给同一个线程，输入太小时不开线程
+    size_t threadCount = std::min<size_t>(m_threadCount, codeString.size() / kMinBytesPerThread);
+    threadCount = std::max<size_t>(1, std::min(threadCount, chunks.size()));
+    size_t bytesPerThread = codeString.size() / threadCount + 1;
+
+    std::vector<size_t> batchBegins;
+    size_t batchBytes = bytesPerThread;
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        if (batchBytes >= bytesPerThread) {
+            batchBegins.push_back(i);
+            batchBytes = 0;
+        }
+        // 加上被切掉的 ';'
+        batchBytes += chunks[i].size() + 1;
+    }
+    batchBegins.push_back(chunks.size());
+
+    size_t batchCount = batchBegins.size() - 1;
+    // 所有解析线程共享同一个运算符表的快照，生成代码时对运算符表的修改不会影响它们
+    OperatorTable operatorTable(m_codegenContext.getOperatorTable());
+    std::vector<std::vector<TopLevelItem>> batchItems(batchCount);
+    m_contexts.resize(batchCount);
+
+    auto parseBatch = [&](size_t batch) {
+        ExprParser parser;
+        parser.setOperatorTable(&operatorTable);
+        parser.setHashConsing(m_hashConsing);
+        parser.setSourceStart(codeString.begin());
+        for (size_t i = batchBegins[batch]; i < batchBegins[batch + 1]; ++i) {
+            parser.parseTopLevelItems(chunks[i], batchItems[batch]);
+        }
+        m_contexts[batch] = parser.getASTContext();
+    };
+
+    // 第一批在当前线程中解析
+    std::vector<std::thread> threads;
+    for (size_t batch = 1; batch < batchCount; ++batch) {
+        threads.push_back(std::thread(parseBatch, batch));
+    }
+    parseBatch(0);
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    // 按源码顺序生成代码，输出与逐个解析时相同
+    for (const auto &items : batchItems) {
+        for (const auto &item : items) {
+            if (!m_deferCodegen) {
+                ExprParser::emitTopLevelItem(m_codegenContext, m_flatAST, item);
+                continue;
+            }
+
+            if (!item.m_errors.empty()) {
+                fputs(item.m_errors.c_str(), stderr);
+            }
+            if (item.m_function) {
+                m_flatAST.addFunction(item.m_function);
+            } else if (item.m_prototype) {
+                m_flatAST.addPrototype(item.m_prototype);
+            }
+        }
+    }
+}
+
+bool ParallelParser::parseFile(const std::string &fileName) {
+    // 足够大的文件 MemoryBuffer 会直接 mmap，不会整体读入一份拷贝
+    auto fileOrError = llvm::MemoryBuffer::getFile(fileName, -1, false);
+    if (!fileOrError) {
+        fprintf(stderr, "Could not open file %s: %s\n", fileName.c_str(), fileOrError.getError().message().c_str());
+
+        return false;
+    }
+
+    m_fileBuffer = std::move(fileOrError.get());
+    this->parse(m_fileBuffer->getBuffer());
+
+    return true;
+}
+
+const FlatAST& ParallelParser::getFlatAST() {
+    return m_sequentialParser ? m_sequentialParser->getFlatAST() : m_flatAST;
+}
@@ -0,0 +1,87 @@
+//
+// Created by 董宏昌 on 2017/2/27.
+//
+
+#ifndef PROJECT_PARALLELPARSER_H
+#define PROJECT_PARALLELPARSER_H
+
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "ExprParser.h"
+
+
+/*
+ * 多线程解析整个源文件
+ * 先预扫描一遍输入，按顶层的 ';' 切成若干段，并登记所有 def binary 定义的运算符优先级，
+ * 然后各个线程分别解析连续的几段，最后按源码顺序依次生成代码
+ * 运算符优先级有冲突、不能提前确定时，退回到 ExprParser 逐个解析
+ */
+class ParallelParser {
+private:
+    /// 生成代码使用的 CodegenContext，预扫描出的运算符优先级也登记在它的运算符表中
+    CodegenContext &m_codegenContext;
+    /// 解析线程数
+    unsigned m_threadCount;
+    /// 解析时是否合并相同的子表达式，见 ExprParser::setHashConsing
+    bool m_hashConsing;
+    /// 并行解析时只展开不生成代码，留给调用方，见 setDeferCodegen
+    bool m_deferCodegen;
+    /// 通过 parseFile 映射进内存的源文件
+    std::unique_ptr<llvm::MemoryBuffer> m_fileBuffer;
+    /// 各个线程的 AST 节点所在的内存池
+    std::vector<std::shared_ptr<ASTContext>> m_contexts;
+    /// 合并后展开的 AST
+    FlatAST m_flatAST;
+    /// 不能并行解析时使用的解析器
+    std::unique_ptr<ExprParser> m_sequentialParser;
+
+public:
+    /*
+     * threadCount 为 0 时使用机器的核数
+     */
+    explicit ParallelParser(CodegenContext &codegenContext, unsigned threadCount = 0);
+
+    /*
+     * 预扫描，按顶层的 ';' 切分 source，依次追加到 chunks
+     * 解析器在每个定义结束后会吃掉一个 ';'，所以分段解析和整体解析的结果相同
+     * ';' 被定义成了运算符时不能切分，返回 false
+     * 同时收集 def binary 定义的运算符优先级，没有冲突时提前登记到 operatorTable，precedenceKnown 为 true；
+     * 同一个运算符前后有不同的优先级，或者与已经登记的不同时不登记，precedenceKnown 为 false
+     */
+    static bool splitTopLevel(llvm::StringRef source, OperatorTable &operatorTable, std::vector<llvm::StringRef> &chunks,
+                              bool &precedenceKnown);
+
+    /*
+     * 打开后每个解析线程内部合并结构相同、没有副作用的子表达式
+     */
+    void setHashConsing(bool enabled);
+    /*
+     * 打开后并行解析的结果只展开到 getFlatAST，不生成代码，比如之后交给 ParallelCodegen
+     * 退回到逐个解析时仍然边解析边生成代码，这时 isCodegenDeferred 返回 false
+     */
+    void setDeferCodegen(bool enabled);
+    /*
+     * 最近一次解析是否把代码生成留给了调用方
+     */
+    bool isCodegenDeferred() const;
+
+    /*
+     * 解析一段代码并生成代码，codeString 由调用方持有，解析结束前不能释放
+     */
+    void parse(llvm::StringRef codeString);
+    /*
+     * 将源文件映射进内存后解析，文件打不开时返回 false
+     */
+    bool parseFile(const std::string &fileName);
+    /*
+     * 已经展开的所有函数
+     */
+    const FlatAST &getFlatAST();
+};
+
+
+#endif //PROJECT_PARALLELPARSER_H
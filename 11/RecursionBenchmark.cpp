@@ -0,0 +1,217 @@
+//
+// Created by 董宏昌 on 2017/2/28.
+//
+
+/*
+ * 消除尾递归的测试
+ * 三个线性递归的函数按 addTailCallPasses 优化后 JIT 运行，递归深度默认是 10^7，
+ * 在只有 kStackSize 大小栈的线程中运行，每层递归都占一个栈帧的话早就栈溢出了
+ * sumdown 的递归调用之后还要加 n，用累加器改写；countdown 和 approach 的递归调用本身就在尾部位置
+ * 输出每个函数中剩下的递归调用个数、耗时和结果，还有递归调用没有消除时不运行，返回 1
+ * 用法：llvmTest11RecursionBenchmark [递归深度]
+ */
+
+#include <pthread.h>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+#include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/ExecutionEngine/MCJIT.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/Support/TargetSelect.h"
+#include "CodeGenerator.h"
+#include "CodegenContext.h"
+#include "ExprParser.h"
+#include "ModuleOptimizer.h"
+#include "Token.h"
+
+
+/// 被测的递归函数，入口函数都是 (n:i64) 返回 double，方便从 C++ 调用
+static const char kRecursionSource[] =
+        "def sumdown(n:i64):i64 if n < 1 then 0 else n + sumdown(n - 1);\n"
+        "def countdown(n:i64 acc:i64):i64 if n < 1 then acc else countdown(n - 1, acc + n);\n"
+        "def approach(x n:i64) if n < 1 then x else approach(x + (1 - x) * 0.5, n - 1);\n"
+        "def testsum(n:i64) sumdown(n);\n"
+        "def testcount(n:i64) countdown(n, 0);\n"
+        "def testapproach(n:i64) approach(0, n);\n";
+
+/// 运行递归函数的线程的栈大小
+static const size_t kStackSize = 1 << 20;
+
+
+/*
+ * 一个被测的递归函数，entry 是从 C++ 调用的函数，kernel 是其中递归的函数
+ */
+struct RecursionKernel {
+    const char *m_entry;
+    const char *m_kernel;
+};
+
+static const RecursionKernel kKernels[] = {
+        {"testsum", "sumdown"},
+        {"testcount", "countdown"},
+        {"testapproach", "approach"},
+};
+
+
+/*
+ * 在栈大小受限的线程中运行一次入口函数
+ */
+struct RecursionRun {
+    uint64_t m_address;
+    int64_t m_depth;
+    double m_result;
+};
+
+static void *runKernel(void *argument) {
+    auto run = static_cast<RecursionRun *>(argument);
+    run->m_result = ((double (*)(int64_t))run->m_address)(run->m_depth);
+
+    return nullptr;
+}
+
+
+static double millisecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static bool parseSource(const std::string &source, ExprParser &parser, FlatAST &flatAST) {
+    std::vector<TopLevelItem> items;
+    parser.parseTopLevelItems(source, items);
+    for (const auto &item : items) {
+        if (!item.m_errors.empty()) {
+            fputs(item.m_errors.c_str(), stderr);
+            return false;
+        }
+
+        if (item.m_function) {
+            flatAST.addFunction(item.m_function);
+        } else if (item.m_prototype) {
+            flatAST.addPrototype(item.m_prototype);
+        }
+    }
+
+    return true;
+}
+
+/*
+ * 函数中调用自己的次数
+ */
+static unsigned countRecursiveCalls(llvm::Function *function) {
+    unsigned count = 0;
+    for (auto &block : *function) {
+        for (auto &instruction : block) {
+            auto call = llvm::dyn_cast<llvm::CallInst>(&instruction);
+            if (call && call->getCalledFunction() == function) {
+                ++count;
+            }
+        }
+    }
+
+    return count;
+}
+
+
+int main(int argc, char const *argv[]) {
+    int64_t depth = argc > 1 ? strtoll(argv[1], nullptr, 10) : 10000000;
+
+    // 和 toy.cpp 中相同的运算符优先级
+    {
+        kOperatorTable.setBinaryPrecedence('=', 2);
+        kOperatorTable.setBinaryPrecedence(token_or, 5);
+        kOperatorTable.setBinaryPrecedence(token_and, 6);
+        kOperatorTable.setBinaryPrecedence(token_equal, 9);
+        kOperatorTable.setBinaryPrecedence(token_not_equal, 9);
+        kOperatorTable.setBinaryPrecedence('<', 10);
+        kOperatorTable.setBinaryPrecedence('>', 10);
+        kOperatorTable.setBinaryPrecedence(token_less_equal, 10);
+        kOperatorTable.setBinaryPrecedence(token_greater_equal, 10);
+        kOperatorTable.setBinaryPrecedence('+', 20);
+        kOperatorTable.setBinaryPrecedence('-', 30);
+        kOperatorTable.setBinaryPrecedence('*', 40);
+    }
+
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+
+    ExprParser parser;
+    FlatAST flatAST;
+    if (!parseSource(kRecursionSource, parser, flatAST)) {
+        return 1;
+    }
+
+    // 先声明 codegenContext，模块属于它的 llvm 上下文，要比 engine 活得久
+    CodegenContext codegenContext;
+    for (FunctionIndex function = 0; function < flatAST.getFunctionCount(); ++function) {
+        if (!CodeGenerator(codegenContext, flatAST).codegenFunction(function)) {
+            return 1;
+        }
+    }
+    std::unique_ptr<llvm::Module> module = codegenContext.takeModule();
+
+    // 和 JIT 中一样只加消除尾递归的 pass
+    {
+        llvm::legacy::FunctionPassManager functionPassManager(module.get());
+        addTailCallPasses(functionPassManager);
+        functionPassManager.doInitialization();
+        for (auto &function : *module) {
+            functionPassManager.run(function);
+        }
+        functionPassManager.doFinalization();
+    }
+
+    unsigned calls[3];
+    bool eliminated = true;
+    for (unsigned i = 0; i < 3; ++i) {
+        calls[i] = countRecursiveCalls(module->getFunction(kKernels[i].m_kernel));
+        eliminated = eliminated && calls[i] == 0;
+    }
+
+    std::string error;
+    std::unique_ptr<llvm::ExecutionEngine> engine(
+            llvm::EngineBuilder(std::move(module)).setErrorStr(&error).setEngineKind(llvm::EngineKind::JIT).create());
+    if (!engine) {
+        fprintf(stderr, "Could not create JIT: %s\n", error.c_str());
+        return 1;
+    }
+    engine->finalizeObject();
+
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    pthread_attr_setstacksize(&attributes, kStackSize);
+
+    printf("%12s %10s %8s %12s %20s\n", "kernel", "depth", "calls", "run(ms)", "result");
+    for (unsigned i = 0; i < 3; ++i) {
+        if (calls[i] != 0) {
+            printf("%12s %10lld %8u %12s %20s\n", kKernels[i].m_kernel, (long long)depth, calls[i], "-", "-");
+            continue;
+        }
+
+        RecursionRun run = {engine->getFunctionAddress(kKernels[i].m_entry), depth, 0};
+        if (!run.m_address) {
+            fprintf(stderr, "Could not find %s\n", kKernels[i].m_entry);
+            return 1;
+        }
+
+        pthread_t thread;
+        auto runStart = std::chrono::steady_clock::now();
+        if (pthread_create(&thread, &attributes, runKernel, &run) != 0) {
+            fprintf(stderr, "Could not create thread\n");
+            return 1;
+        }
+        pthread_join(thread, nullptr);
+        double runTime = millisecondsSince(runStart);
+
+        printf("%12s %10lld %8u %12.2f %20.12g\n", kKernels[i].m_kernel, (long long)depth, calls[i], runTime,
+               run.m_result);
+        fflush(stdout);
+    }
+    pthread_attr_destroy(&attributes);
+
+    return eliminated ? 0 : 1;
+}
@@ -0,0 +1,92 @@
+//
+// Created by 董宏昌 on 2017/2/25.
+//
+
+#include "ScopedSymbolTable.h"
+#include <algorithm>
+#include <cassert>
+
+
+/// 索引的初始槽数，一般的函数里不同名字的变量不会超过这个数
+static const unsigned kInitialIndexSize = 16;
+
+
+static inline unsigned hashSymbol(Symbol name) {
+    // 编号是连续分配的，乘一个奇数把相邻的编号打散到不同的槽
+    return name * 2654435761u;
+}
+
+
+ScopedSymbolTable::ScopedSymbolTable()
+        : m_index(kInitialIndexSize, IndexSlot{kEmptySymbol, kNoBinding}), m_indexUsed(0) {
+}
+
+void ScopedSymbolTable::clear() {
+    m_bindings.clear();
+    m_scopes.clear();
+    std::fill(m_index.begin(), m_index.end(), IndexSlot{kEmptySymbol, kNoBinding});
+    m_indexUsed = 0;
+}
+
+void ScopedSymbolTable::pushScope() {
+    m_scopes.push_back((unsigned)m_bindings.size());
+}
+
+void ScopedSymbolTable::popScope() {
+    assert(!m_scopes.empty() && "popScope without pushScope");
+
+    unsigned scopeBegin = m_scopes.back();
+    m_scopes.pop_back();
+
+    // 逆序弹出，同一个作用域里重复定义的名字也能一层层恢复
+    while (m_bindings.size() > scopeBegin) {
+        const Binding &binding = m_bindings.back();
+        findSlot(binding.m_name).m_binding = binding.m_shadowed;
+        m_bindings.pop_back();
+    }
+}
+
+void ScopedSymbolTable::bind(Symbol name, llvm::AllocaInst *value) {
+    IndexSlot *slot = &findSlot(name);
+    if (slot->m_name == kEmptySymbol) {
+        if ((m_indexUsed + 1) * 4 > m_index.size() * 3) {
+            growIndex();
+            slot = &findSlot(name);
+        }
+        slot->m_name = name;
+        ++m_indexUsed;
+    }
+
+    m_bindings.push_back(Binding{name, value, slot->m_binding});
+    slot->m_binding = (unsigned)m_bindings.size() - 1;
+}
+
+llvm::AllocaInst *ScopedSymbolTable::lookup(Symbol name) {
+    const IndexSlot &slot = findSlot(name);
+    if (slot.m_binding == kNoBinding) {
+        return nullptr;
+    }
+
+    return m_bindings[slot.m_binding].m_value;
+}
+
+ScopedSymbolTable::IndexSlot &ScopedSymbolTable::findSlot(Symbol name) {
+    unsigned mask = (unsigned)m_index.size() - 1;
+    unsigned position = hashSymbol(name) & mask;
+    while (m_index[position].m_name != name && m_index[position].m_name != kEmptySymbol) {
+        position = (position + 1) & mask;
+    }
+
+    return m_index[position];
+}
+
+void ScopedSymbolTable::growIndex() {
+    std::vector<IndexSlot> oldIndex(m_index.size() * 2, IndexSlot{kEmptySymbol, kNoBinding});
+    oldIndex.swap(m_index);
+
+    for (const IndexSlot &slot : oldIndex) {
+        if (slot.m_name != kEmptySymbol) {
+            findSlot(slot.m_name) = slot;
+        }
+    }
+}
@@ -0,0 +1,86 @@
+//
+// Created by 董宏昌 on 2017/2/25.
+//
+
+#ifndef PROJECT_SCOPEDSYMBOLTABLE_H
+#define PROJECT_SCOPEDSYMBOLTABLE_H
+
+
+#include <vector>
+#include "IdentifierTable.h"
+
+namespace llvm {
+    class AllocaInst;
+}
+
+
+/*
+ * 代码生成时的局部变量表
+ * 所有绑定按定义顺序连续地保存在一个数组里，每个作用域只记录它开始时数组的长度，
+ * 同名变量的外层绑定由内层绑定记住，离开作用域时逆序弹出就能恢复
+ * 另外用一个开放寻址的哈希索引记录每个名字当前最内层的绑定，查找不需要遍历数组
+ */
+class ScopedSymbolTable {
+private:
+    /// 没有绑定时使用的下标
+    static const unsigned kNoBinding = ~0u;
+
+    struct Binding {
+        Symbol m_name;
+        llvm::AllocaInst *m_value;
+        /// 被这个绑定覆盖的同名外层绑定的下标
+        unsigned m_shadowed;
+    };
+
+    struct IndexSlot {
+        /// kEmptySymbol 表示空槽，变量名不会是空字符串
+        Symbol m_name;
+        /// 当前最内层绑定的下标，变量离开作用域后是 kNoBinding，但槽不会被删除
+        unsigned m_binding;
+    };
+
+    /// 按定义顺序保存的所有绑定
+    std::vector<Binding> m_bindings;
+    /// 每个作用域开始时 m_bindings 的长度
+    std::vector<unsigned> m_scopes;
+    /// 名字到最内层绑定的索引，长度是 2 的幂，线性探测
+    std::vector<IndexSlot> m_index;
+    /// m_index 中已经使用的槽数
+    unsigned m_indexUsed;
+
+    /*
+     * 返回 name 所在的槽，没有时返回应该插入的空槽
+     */
+    IndexSlot &findSlot(Symbol name);
+    /*
+     * 把索引扩大一倍
+     */
+    void growIndex();
+
+public:
+    ScopedSymbolTable();
+
+    /*
+     * 开始生成一个新函数时清空所有绑定
+     */
+    void clear();
+    /*
+     * 进入一个新的作用域
+     */
+    void pushScope();
+    /*
+     * 离开当前作用域，恢复被它覆盖的外层绑定
+     */
+    void popScope();
+    /*
+     * 在当前作用域中绑定变量，同名的外层变量会被覆盖到当前作用域结束
+     */
+    void bind(Symbol name, llvm::AllocaInst *value);
+    /*
+     * 查找变量当前的绑定，没有时返回 nullptr
+     */
+    llvm::AllocaInst *lookup(Symbol name);
+};
+
+
+#endif //PROJECT_SCOPEDSYMBOLTABLE_H
@@ -0,0 +1,46 @@
+//
+// Created by 董宏昌 on 2017/2/28.
+//
+
+#ifndef PROJECT_TOKEN_H
+#define PROJECT_TOKEN_H
+
+
+/// 解析的 token 类型枚举，这里都是负数，token 如果不是这里的类型，会返回 0-255 返回的 ascii 码
+enum Token {
+    token_eof = -1,
+    token_def = -2,
+    token_extern = -3,
+    token_identifier = -4,
+    token_number = -5,
+
+    // 控制流关键字
+    token_if = -6,
+    token_then = -7,
+    token_else = -8,
+
+    // 循环控制关键字
+    token_for = -9,
+    token_in = -10,
+
+    // 用户自定义运算符的关键字
+    token_binary = -11, // 二元
+    token_unary = -12,  // 一元
+
+    // 用户定义变量关键字
+    token_var = -13,
+
+    // 词法错误，比如格式错误的数字常量，错误信息已经在词法分析时输出
+    token_error = -14,
+
+    // 两个字符的内建运算符，在 AST 中的 m_op 是 (char)token，不是 ascii 字符，不会和自定义运算符冲突
+    token_less_equal = -15,     // <=
+    token_greater_equal = -16,  // >=
+    token_equal = -17,          // ==
+    token_not_equal = -18,      // !=
+    token_and = -19,            // &&
+    token_or = -20,             // ||
+};
+
+
+#endif //PROJECT_TOKEN_H
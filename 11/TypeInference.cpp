@@ -0,0 +1,406 @@
+//
+// Created by 董宏昌 on 2017/2/28.
+//
+
+#include "TypeInference.h"
+#include "CodeGenerator.h"
+#include "Token.h"
+
+
+/*
+ * 二元运算和 if 的两边都是 i64 时结果才是 i64，有一边是向量时是向量，否则 i64 的一边转换成 double
+ */
+static inline ValueType commonType(ValueType lhs, ValueType rhs) {
+    if (getVectorWidth(lhs)) {
+        return lhs;
+    }
+    if (getVectorWidth(rhs)) {
+        return rhs;
+    }
+    return lhs == type_i64 && rhs == type_i64 ? type_i64 : type_double;
+}
+
+
+TypeInference::TypeInference(const FlatAST &ast)
+        : m_ast(ast), m_returnTypeOf(nullptr), m_changed(false) {
+
+}
+
+void TypeInference::pushScope() {
+    m_scopeBegins.push_back(m_shadowed.size());
+}
+
+void TypeInference::popScope() {
+    size_t scopeBegin = m_scopeBegins.back();
+    m_scopeBegins.pop_back();
+
+    while (m_shadowed.size() > scopeBegin) {
+        m_scope[m_shadowed.back().first] = m_shadowed.back().second;
+        m_shadowed.pop_back();
+    }
+}
+
+void TypeInference::bind(Symbol name, unsigned binding) {
+    auto inserted = m_scope.insert(std::make_pair(name, binding));
+    unsigned shadowed = kNoBinding;
+    if (!inserted.second) {
+        shadowed = inserted.first->second;
+        inserted.first->second = binding;
+    }
+    m_shadowed.push_back(std::make_pair(name, shadowed));
+}
+
+unsigned TypeInference::lookup(Symbol name) {
+    auto found = m_scope.find(name);
+    return found != m_scope.end() ? found->second : kNoBinding;
+}
+
+unsigned TypeInference::getFirstBinding(NodeIndex node, unsigned count) {
+    auto inserted = m_firstBindings.insert(std::make_pair(node, (unsigned)m_bindingTypes.size()));
+    if (inserted.second) {
+        for (unsigned i = 0; i < count; ++i) {
+            // 写了类型的变量不需要推断，其余的先假设是 i64
+            ValueType declared = m_ast.getKind(node) == ast_var ? m_ast.getVarType(node, i) : type_auto;
+            m_bindingTypes.push_back(declared == type_auto ? type_i64 : declared);
+            m_bindingInferred.push_back(declared == type_auto);
+        }
+    }
+
+    return inserted.first->second;
+}
+
+void TypeInference::assign(unsigned binding, ValueType type) {
+    if (binding == kNoBinding || !m_bindingInferred[binding]) {
+        return;
+    }
+
+    // 只会按 i64、double、向量的方向改变，已经是向量时不再改变，宽度不同的向量在生成代码时报错
+    ValueType current = m_bindingTypes[binding];
+    ValueType widened = getVectorWidth(current) ? current : commonType(current, type);
+    if (widened != current) {
+        m_bindingTypes[binding] = widened;
+        m_changed = true;
+    }
+}
+
+void TypeInference::inferFunction(FunctionIndex function, llvm::function_ref<ValueType(Symbol)> returnTypeOf) {
+    m_returnTypeOf = &returnTypeOf;
+    m_firstBindings.clear();
+    m_bindingTypes.clear();
+    m_bindingInferred.clear();
+
+    const FlatFunction &prototype = m_ast.getFunction(function);
+    llvm::ArrayRef<Symbol> argNames = m_ast.getArgs(function);
+    for (unsigned i = 0; i < argNames.size(); ++i) {
+        m_bindingTypes.push_back(m_ast.getArgType(function, i));
+        m_bindingInferred.push_back(false);
+    }
+
+    // 每一遍只会把变量从 i64 改成 double 或向量、从 double 改成向量，没有变化时就是最终的结果
+    do {
+        m_changed = false;
+        m_scope.clear();
+        m_shadowed.clear();
+        m_scopeBegins.clear();
+        for (unsigned i = 0; i < argNames.size(); ++i) {
+            this->bind(argNames[i], i);
+        }
+
+        if (prototype.m_body != kNoNode) {
+            this->inferExpression(prototype.m_body);
+        }
+    } while (m_changed);
+
+    m_returnTypeOf = nullptr;
+}
+
+ValueType TypeInference::getBindingType(NodeIndex node, unsigned i) const {
+    auto found = m_firstBindings.find(node);
+    if (found == m_firstBindings.end()) {
+        return type_double;
+    }
+
+    return m_bindingTypes[found->second + i];
+}
+
+ValueType TypeInference::inferExpression(NodeIndex root) {
+    // 和 CodeGenerator::codegen 的结构相同，需要子节点的类型时先把子节点交出来
+    size_t frameBase = m_frames.size();
+    NodeIndex node = root;
+    ValueType type = type_double;
+
+    while (1) {
+        if (node != kNoNode) {
+            switch (m_ast.getKind(node)) {
+                case ast_number: {
+                    type = m_ast.getNumberType(node);
+                } break;
+
+                case ast_variable: {
+                    // 不认识的变量在生成代码时报错
+                    unsigned binding = this->lookup(m_ast.getSymbol(node));
+                    type = binding != kNoBinding ? m_bindingTypes[binding] : type_double;
+                } break;
+
+                default: {
+                    m_frames.push_back(InferenceFrame(node));
+                } break;
+            }
+            node = kNoNode;
+        }
+
+        if (m_frames.size() == frameBase) {
+            return type;
+        }
+
+        InferenceFrame &frame = m_frames.back();
+        bool finished = true;
+        switch (m_ast.getKind(frame.m_node)) {
+            case ast_unary: {
+                finished = this->inferUnary(frame, type, node);
+            } break;
+
+            case ast_binary: {
+                finished = this->inferBinary(frame, type, node);
+            } break;
+
+            case ast_call: {
+                finished = this->inferCall(frame, type, node);
+            } break;
+
+            case ast_if: {
+                finished = this->inferIf(frame, type, node);
+            } break;
+
+            case ast_for: {
+                finished = this->inferFor(frame, type, node);
+            } break;
+
+            case ast_var: {
+                finished = this->inferVar(frame, type, node);
+            } break;
+
+            default: {
+                type = type_double;
+            } break;
+        }
+
+        if (finished) {
+            m_frames.pop_back();
+        }
+    }
+}
+
+bool TypeInference::inferUnary(InferenceFrame &frame, ValueType &type, NodeIndex &child) {
+    if (frame.m_stage == 0) {
+        frame.m_stage = 1;
+        child = m_ast.getFirstChild(frame.m_node);
+        return false;
+    }
+
+    // 没有定义 unary! 时是内建的 !，类型和运算对象相同
+    char op = m_ast.getOperator(frame.m_node);
+    ValueType returnType = (*m_returnTypeOf)(getOperatorSymbol(false, op));
+    if (returnType != type_auto) {
+        type = returnType;
+    } else if (op != '!') {
+        type = type_double;
+    }
+    return true;
+}
+
+bool TypeInference::inferBinary(InferenceFrame &frame, ValueType &type, NodeIndex &child) {
+    NodeIndex node = frame.m_node;
+    NodeIndex lhs = m_ast.getFirstChild(node);
+    switch (frame.m_stage) {
+        case 0: {
+            frame.m_stage = 1;
+            child = lhs;
+        } return false;
+
+        case 1: {
+            frame.m_types[0] = type;
+            frame.m_stage = 2;
+            child = m_ast.getSecondChild(node);
+        } return false;
+
+        default:
+            break;
+    }
+
+    char op = m_ast.getOperator(node);
+    switch (op) {
+        case '=': {
+            // 赋值的值是转换成变量类型之后的右值
+            unsigned binding = m_ast.getKind(lhs) == ast_variable ? this->lookup(m_ast.getSymbol(lhs)) : kNoBinding;
+            this->assign(binding, type);
+            type = binding != kNoBinding ? m_bindingTypes[binding] : type_double;
+        } break;
+
+        case '+':
+        case '-':
+        case '*':
+        case '<':
+        case (char)token_less_equal:
+        case (char)token_greater_equal:
+        case (char)token_equal:
+        case (char)token_not_equal:
+        case (char)token_and:
+        case (char)token_or: {
+            type = commonType(frame.m_types[0], type);
+        } break;
+
+        default: {
+            // 没有定义 binary> 时是内建的 >
+            ValueType returnType = (*m_returnTypeOf)(getOperatorSymbol(true, op));
+            if (returnType != type_auto) {
+                type = returnType;
+            } else {
+                type = op == '>' ? commonType(frame.m_types[0], type) : type_double;
+            }
+        } break;
+    }
+
+    return true;
+}
+
+bool TypeInference::inferCall(InferenceFrame &frame, ValueType &type, NodeIndex &child) {
+    NodeIndex node = frame.m_node;
+    llvm::ArrayRef<NodeIndex> args = m_ast.getCallArgs(node);
+
+    // 参数转换成被调用函数的参数类型，不影响调用的类型，只有 setlane 的类型和第一个参数相同
+    if (frame.m_stage < args.size()) {
+        if (frame.m_stage == 1) {
+            frame.m_types[0] = type;
+        }
+        child = args[frame.m_stage++];
+        return false;
+    }
+
+    // 没有这个函数时是内建函数，不认识的函数在生成代码时报错
+    type = (*m_returnTypeOf)(m_ast.getSymbol(node));
+    if (type == type_auto) {
+        switch (getBuiltinFunction(m_ast.getSymbol(node))) {
+            case builtin_vec2: type = type_vec2; break;
+            case builtin_vec4: type = type_vec4; break;
+            case builtin_setlane: type = frame.m_types[0]; break;
+            default: type = type_double; break;
+        }
+    }
+    return true;
+}
+
+bool TypeInference::inferIf(InferenceFrame &frame, ValueType &type, NodeIndex &child) {
+    NodeIndex node = frame.m_node;
+    switch (frame.m_stage) {
+        case 0: {
+            frame.m_stage = 1;
+            child = m_ast.getFirstChild(node);
+        } return false;
+
+        case 1: {
+            frame.m_stage = 2;
+            child = m_ast.getSecondChild(node);
+        } return false;
+
+        case 2: {
+            frame.m_types[0] = type;
+            frame.m_stage = 3;
+            child = m_ast.getThirdChild(node);
+        } return false;
+
+        default:
+            break;
+    }
+
+    type = commonType(frame.m_types[0], type);
+    return true;
+}
+
+bool TypeInference::inferFor(InferenceFrame &frame, ValueType &type, NodeIndex &child) {
+    NodeIndex node = frame.m_node;
+    unsigned binding = this->getFirstBinding(node, 1);
+    // 顺序和 CodeGenerator::codegenFor 相同：初值在循环变量的作用域之外，循环体、步进、结束条件在作用域之内
+    switch (frame.m_stage) {
+        case 0: {
+            frame.m_stage = 1;
+            child = m_ast.getSecondChild(node);
+        } return false;
+
+        case 1: {
+            // 循环变量只能是标量，向量的初值和步进在生成代码时报错
+            this->assign(binding, getVectorWidth(type) ? type_double : type);
+            this->pushScope();
+            this->bind(m_ast.getSymbol(node), binding);
+
+            frame.m_stage = 2;
+            child = m_ast.getForBody(node);
+        } return false;
+
+        case 2: {
+            NodeIndex step = m_ast.getForStep(node);
+            if (step != kNoNode) {
+                frame.m_stage = 3;
+                child = step;
+                return false;
+            }
+
+            // 没有写步进时是整数 1
+            frame.m_stage = 4;
+            child = m_ast.getForEnd(node);
+        } return false;
+
+        case 3: {
+            this->assign(binding, getVectorWidth(type) ? type_double : type);
+            frame.m_stage = 4;
+            child = m_ast.getForEnd(node);
+        } return false;
+
+        default:
+            break;
+    }
+
+    this->popScope();
+
+    // for 循环作为表达式，整体对外的值永远是 0.0
+    type = type_double;
+    return true;
+}
+
+bool TypeInference::inferVar(InferenceFrame &frame, ValueType &type, NodeIndex &child) {
+    NodeIndex node = frame.m_node;
+    unsigned count = m_ast.getVarCount(node);
+    unsigned firstBinding = this->getFirstBinding(node, count);
+    // 和 CodeGenerator::codegenVar 一样，m_stage 为 i + 1 时正在等第 i 个变量的初值，为 count + 1 时正在等 body
+    unsigned next;
+
+    if (frame.m_stage == 0) {
+        this->pushScope();
+        next = 0;
+    } else if (frame.m_stage <= count) {
+        unsigned binding = firstBinding + frame.m_stage - 1;
+        this->assign(binding, type);
+        this->bind(m_ast.getVarName(node, frame.m_stage - 1), binding);
+        next = frame.m_stage;
+    } else {
+        // body 的类型就是整个 var 的类型
+        this->popScope();
+        return true;
+    }
+
+    for (; next < count; ++next) {
+        NodeIndex init = m_ast.getVarInit(node, next);
+        if (init != kNoNode) {
+            frame.m_stage = next + 1;
+            child = init;
+            return false;
+        }
+
+        // 没有写初值时是 0，两种类型都可以
+        this->bind(m_ast.getVarName(node, next), firstBinding + next);
+    }
+
+    frame.m_stage = count + 1;
+    child = m_ast.getThirdChild(node);
+    return false;
+}
@@ -0,0 +1,113 @@
+//
+// Created by 董宏昌 on 2017/2/28.
+//
+
+#ifndef PROJECT_TYPEINFERENCE_H
+#define PROJECT_TYPEINFERENCE_H
+
+
+#include <utility>
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallVector.h"
+#include "FlatAST.h"
+
+
+/*
+ * TypeInference 显式栈上一个还没有推断完的节点
+ */
+struct InferenceFrame {
+    NodeIndex m_node;
+    /// 当前节点已经走到了第几步，每两步之间推断一个子节点
+    unsigned m_stage;
+    /// 已经推断出的子节点的类型，含义由节点类型决定
+    ValueType m_types[2];
+
+    explicit InferenceFrame(NodeIndex node)
+            : m_node(node), m_stage(0), m_types{type_double, type_double} {
+    }
+};
+
+
+/*
+ * 函数内局部变量的类型推断
+ * 参数和返回值的类型由原型决定，var 中没有写类型的变量和 for 的循环变量需要推断：
+ * 初值、每次赋值以及 for 的步进都是 i64 时变量是 i64，有向量时是向量（for 的循环变量除外），否则是 double
+ * 表达式的类型自底向上决定：整数常量是 i64，内建的算术、比较和逻辑运算两边都是 i64 时是 i64，有一边是向量时是向量，
+ * ! 和运算对象相同，if 的两个分支同样处理，函数调用和自定义运算符是被调用函数的返回值类型，内建函数见 inferCall
+ * 变量的类型又会影响表达式的类型，所以先假设所有待推断的变量都是 i64，遍历函数体，
+ * 发现某个变量被赋了更宽的类型就把它改成那个类型后重新遍历，变量只会按 i64、double、向量的方向变化，
+ * 最多遍历变量个数的两倍加一次
+ * 和 CodeGenerator 一样不使用递归，共享节点在每个引用它的地方重新推断，因为同一个变量名在不同的地方可能是不同的变量
+ */
+class TypeInference {
+private:
+    /// 没有变量时使用的下标
+    static const unsigned kNoBinding = ~0u;
+
+    const FlatAST &m_ast;
+    /// 查找被调用函数的返回值类型，只在 inferFunction 中有效
+    const llvm::function_ref<ValueType(Symbol)> *m_returnTypeOf;
+    /// var 和 for 的节点到它定义的第一个变量在 m_bindingTypes 中的下标，这两种节点不会被共享
+    llvm::DenseMap<NodeIndex, unsigned> m_firstBindings;
+    /// 每个变量现在的类型，参数在最前面
+    llvm::SmallVector<ValueType, 16> m_bindingTypes;
+    /// 每个变量是否需要推断，参数和写了类型的变量不需要
+    llvm::SmallVector<bool, 16> m_bindingInferred;
+    /// 这一遍是否有变量改成了更宽的类型
+    bool m_changed;
+
+    /// 当前作用域中变量名到变量的下标
+    llvm::SmallDenseMap<Symbol, unsigned, 16> m_scope;
+    /// 被内层变量覆盖的外层变量，离开作用域时逆序恢复
+    llvm::SmallVector<std::pair<Symbol, unsigned>, 16> m_shadowed;
+    /// 每个作用域开始时 m_shadowed 的长度
+    llvm::SmallVector<size_t, 8> m_scopeBegins;
+    /// 还没有推断完的节点
+    llvm::SmallVector<InferenceFrame, 32> m_frames;
+
+    void pushScope();
+    void popScope();
+    void bind(Symbol name, unsigned binding);
+    unsigned lookup(Symbol name);
+
+    /*
+     * 返回 var 或 for 节点定义的第一个变量的下标，第一次遇到时为它的 count 个变量分配下标
+     */
+    unsigned getFirstBinding(NodeIndex node, unsigned count);
+    /*
+     * 变量被赋了一个 type 类型的值，需要推断的变量改成两者中更宽的类型
+     */
+    void assign(unsigned binding, ValueType type);
+
+    /*
+     * 推断表达式的类型，同时推断其中变量的类型
+     */
+    ValueType inferExpression(NodeIndex root);
+    /*
+     * 推断有子节点的节点的下一步，type 是上一步交出的子节点的类型
+     * 返回 false 时需要先推断 child，返回 true 时节点推断完毕，type 是它的类型
+     */
+    bool inferUnary(InferenceFrame &frame, ValueType &type, NodeIndex &child);
+    bool inferBinary(InferenceFrame &frame, ValueType &type, NodeIndex &child);
+    bool inferCall(InferenceFrame &frame, ValueType &type, NodeIndex &child);
+    bool inferIf(InferenceFrame &frame, ValueType &type, NodeIndex &child);
+    bool inferFor(InferenceFrame &frame, ValueType &type, NodeIndex &child);
+    bool inferVar(InferenceFrame &frame, ValueType &type, NodeIndex &child);
+
+public:
+    explicit TypeInference(const FlatAST &ast);
+
+    /*
+     * 推断函数中所有局部变量的类型，returnTypeOf 按函数名返回被调用函数的返回值类型，没有这个函数时返回 type_auto
+     */
+    void inferFunction(FunctionIndex function, llvm::function_ref<ValueType(Symbol)> returnTypeOf);
+
+    /*
+     * var 节点定义的第 i 个变量，或者 for 节点的循环变量（i 为 0）推断出的类型，for 的循环变量不会是向量
+     */
+    ValueType getBindingType(NodeIndex node, unsigned i) const;
+};
+
+
+#endif //PROJECT_TYPEINFERENCE_H
@@ -0,0 +1,193 @@
+//
+// Created by 董宏昌 on 2017/2/28.
+//
+
+/*
+ * 向量类型的性能测试
+ * 同一个三维仿射变换（旋转加平移）对一个点反复做 n 次，分别用三个 double 标量和一个 vec4 写成，
+ * 按 O3 优化后 JIT 运行，记录每个内核中浮点乘法一次处理的元素个数和耗时
+ * 标量版本每次是 9 个 fmul 和 9 个 fadd，向量版本是 3 个 <4 x double> 的 fmul 和 3 个 fadd
+ * 两个版本的加法顺序不同，结果只差舍入误差
+ * 用法：llvmTest11VectorBenchmark [变换次数] [重复次数]，默认变换 10000000 次，重复 10 次
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+#include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/ExecutionEngine/MCJIT.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Target/TargetMachine.h"
+#include "CodeGenerator.h"
+#include "CodegenContext.h"
+#include "ExprParser.h"
+#include "ModuleOptimizer.h"
+#include "Token.h"
+
+
+/// 被测的两个内核，变换的列依次是 c0 c1 c2 和平移 c3，点的第 4 个分量始终是 0
+/// 标量版本的循环体用 + 把三个赋值连起来，循环体的值不会被用到
+static const char kTransformSource[] =
+        "def transforms(n:i64)\n"
+        "  var x = 1.0, y = 2.0, z = 3.0 in\n"
+        "    (for i = 1, n <= i in\n"
+        "      var nx = 0.36 * x + 0.48 * y - 0.8 * z + 0.1,\n"
+        "          ny = 0.6 * y - 0.8 * x + 0.2,\n"
+        "          nz = 0.48 * x + 0.64 * y + 0.6 * z + 0.3 in\n"
+        "        (x = nx) + (y = ny) + (z = nz))\n"
+        "    + x + y + z;\n"
+        "def transformv(n:i64 p:vec4 c0:vec4 c1:vec4 c2:vec4 c3:vec4):vec4\n"
+        "  (for i = 1, n <= i in p = c0 * lane(p, 0) + c1 * lane(p, 1) + c2 * lane(p, 2) + c3) + p;\n"
+        "def transformsv(n:i64)\n"
+        "  hsum(transformv(n, vec4(1, 2, 3, 0), vec4(0.36, 0 - 0.8, 0.48, 0), vec4(0.48, 0.6, 0.64, 0),\n"
+        "                  vec4(0 - 0.8, 0, 0.6, 0), vec4(0.1, 0.2, 0.3, 0)));\n";
+
+
+/*
+ * 一个被测的内核，entry 是从 C++ 调用的函数，kernel 是其中做变换的函数
+ */
+struct TransformKernel {
+    const char *m_label;
+    const char *m_entry;
+    const char *m_kernel;
+};
+
+static const TransformKernel kKernels[] = {
+        {"scalar", "transforms", "transforms"},
+        {"vec4", "transformsv", "transformv"},
+};
+
+
+static double millisecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static bool parseSource(const std::string &source, ExprParser &parser, FlatAST &flatAST) {
+    std::vector<TopLevelItem> items;
+    parser.parseTopLevelItems(source, items);
+    for (const auto &item : items) {
+        if (!item.m_errors.empty()) {
+            fputs(item.m_errors.c_str(), stderr);
+            return false;
+        }
+
+        if (item.m_function) {
+            flatAST.addFunction(item.m_function);
+        } else if (item.m_prototype) {
+            flatAST.addPrototype(item.m_prototype);
+        }
+    }
+
+    return true;
+}
+
+/*
+ * 函数中浮点乘法一次处理的最多元素个数，没有向量运算时是 1
+ */
+static unsigned getVectorWidth(llvm::Function *function) {
+    unsigned width = 1;
+    for (auto &block : *function) {
+        for (auto &instruction : block) {
+            if (instruction.getOpcode() == llvm::Instruction::FMul && instruction.getType()->isVectorTy()) {
+                width = std::max(width, instruction.getType()->getVectorNumElements());
+            }
+        }
+    }
+
+    return width;
+}
+
+
+int main(int argc, char const *argv[]) {
+    int64_t count = argc > 1 ? strtoll(argv[1], nullptr, 10) : 10000000;
+    unsigned repeats = argc > 2 ? (unsigned)strtoul(argv[2], nullptr, 10) : 10;
+    repeats = std::max(1u, repeats);
+
+    // 和 toy.cpp 中相同的运算符优先级
+    {
+        kOperatorTable.setBinaryPrecedence('=', 2);
+        kOperatorTable.setBinaryPrecedence(token_or, 5);
+        kOperatorTable.setBinaryPrecedence(token_and, 6);
+        kOperatorTable.setBinaryPrecedence(token_equal, 9);
+        kOperatorTable.setBinaryPrecedence(token_not_equal, 9);
+        kOperatorTable.setBinaryPrecedence('<', 10);
+        kOperatorTable.setBinaryPrecedence('>', 10);
+        kOperatorTable.setBinaryPrecedence(token_less_equal, 10);
+        kOperatorTable.setBinaryPrecedence(token_greater_equal, 10);
+        kOperatorTable.setBinaryPrecedence('+', 20);
+        kOperatorTable.setBinaryPrecedence('-', 30);
+        kOperatorTable.setBinaryPrecedence('*', 40);
+    }
+
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+
+    ExprParser parser;
+    FlatAST flatAST;
+    if (!parseSource(kTransformSource, parser, flatAST)) {
+        return 1;
+    }
+
+    // 先声明 codegenContext，模块属于它的 llvm 上下文，要比 engine 活得久
+    CodegenContext codegenContext;
+    for (FunctionIndex function = 0; function < flatAST.getFunctionCount(); ++function) {
+        if (!CodeGenerator(codegenContext, flatAST).codegenFunction(function)) {
+            return 1;
+        }
+    }
+    std::unique_ptr<llvm::Module> module = codegenContext.takeModule();
+
+    // 按本机的 CPU 生成代码，<4 x double> 才能放进一个向量寄存器
+    std::string error;
+    llvm::EngineBuilder engineBuilder;
+    engineBuilder.setErrorStr(&error).setEngineKind(llvm::EngineKind::JIT).setMCPU(llvm::sys::getHostCPUName());
+    llvm::TargetMachine *targetMachine = engineBuilder.selectTarget();
+    if (!targetMachine) {
+        fprintf(stderr, "Could not select target: %s\n", error.c_str());
+        return 1;
+    }
+    ModuleOptimizer(*targetMachine).run(*module);
+
+    unsigned widths[2];
+    for (unsigned i = 0; i < 2; ++i) {
+        widths[i] = getVectorWidth(module->getFunction(kKernels[i].m_kernel));
+    }
+
+    // engine 接管 module 和 targetMachine
+    std::unique_ptr<llvm::ExecutionEngine> engine(
+            llvm::EngineBuilder(std::move(module)).setErrorStr(&error).setEngineKind(llvm::EngineKind::JIT)
+                    .create(targetMachine));
+    if (!engine) {
+        fprintf(stderr, "Could not create JIT: %s\n", error.c_str());
+        return 1;
+    }
+    engine->finalizeObject();
+
+    printf("%8s %10s %8s %12s %20s\n", "kernel", "count", "lanes", "run(ms)", "result");
+    for (unsigned i = 0; i < 2; ++i) {
+        uint64_t address = engine->getFunctionAddress(kKernels[i].m_entry);
+        if (!address) {
+            fprintf(stderr, "Could not find %s\n", kKernels[i].m_entry);
+            return 1;
+        }
+
+        // 两个入口的参数和返回值都是标量，不依赖向量参数的调用约定
+        double result = 0;
+        auto runStart = std::chrono::steady_clock::now();
+        for (unsigned j = 0; j < repeats; ++j) {
+            result = ((double (*)(int64_t))address)(count);
+        }
+        double runTime = millisecondsSince(runStart) / repeats;
+
+        printf("%8s %10lld %8u %12.2f %20.12g\n", kKernels[i].m_label, (long long)count, widths[i], runTime, result);
+        fflush(stdout);
+    }
+
+    return 0;
+}
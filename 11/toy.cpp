@@ -1,11 +1,15 @@
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <string>
 #include <vector>
 #include <map>
 #include <iostream>
 #include <sstream>
+#include "BinaryAST.h"
 #include "ExprAST.h"
+#include "CodeGenerator.h"
+#include "CodegenContext.h"
 #include "llvm/ADT/STLExtras.h"
 #include "llvm/IR/Function.h"
 #include "llvm/Support/TargetRegistry.h"
@@ -14,6 +18,11 @@
 #include "llvm/Target/TargetMachine.h"
 #include "llvm/Support/TargetSelect.h"
 #include "ExprParser.h"
+#include "IncrementalParser.h"
+#include "ModuleOptimizer.h"
+#include "ParallelCodegen.h"
+#include "ParallelParser.h"
+#include "Token.h"
 
 
 int main(int argc, char const *argv[]) {
@@ -30,30 +39,143 @@ int main(int argc, char const *argv[]) {
 
     // 规定各个操作符的优先级
     {
-        kBinaryOPPrecedence['='] = 2;
-        kBinaryOPPrecedence['<'] = 10;
-        kBinaryOPPrecedence['+'] = 20;
-        kBinaryOPPrecedence['-'] = 30;
-        kBinaryOPPrecedence['*'] = 40;
+        kOperatorTable.setBinaryPrecedence('=', 2);
+        kOperatorTable.setBinaryPrecedence(token_or, 5);
+        kOperatorTable.setBinaryPrecedence(token_and, 6);
+        kOperatorTable.setBinaryPrecedence(token_equal, 9);
+        kOperatorTable.setBinaryPrecedence(token_not_equal, 9);
+        kOperatorTable.setBinaryPrecedence('<', 10);
+        kOperatorTable.setBinaryPrecedence('>', 10);
+        kOperatorTable.setBinaryPrecedence(token_less_equal, 10);
+        kOperatorTable.setBinaryPrecedence(token_greater_equal, 10);
+        kOperatorTable.setBinaryPrecedence('+', 20);
+        kOperatorTable.setBinaryPrecedence('-', 30);
+        kOperatorTable.setBinaryPrecedence('*', 40);
     }
 
-    // 初始化 llvm 环境
-    initLLVMContext();
-    auto parser = ExprParser();
+    // 初始化 llvm 环境，运算符表从上面的 kOperatorTable 拷贝
+    CodegenContext codegenContext;
 
-    std::string inputString;
-    // 写上初始的提示文本
-    fprintf(stderr, "ready> ");
-    std::getline(std::cin, inputString);
-    while (inputString != "~") {
-        parser.startParse(inputString);
+    // 命令行参数：-dag 打开 hash consing，合并相同的子表达式
+    // -emit-ksb 文件名：解析完后把所有函数写成 .ksb 文件，之后可以直接读入而不用重新解析
+    // -incremental：编译源文件后等待输入，每次回车重新读入源文件，只重新编译变化的定义，输入 ~ 结束
+    // -parallel-codegen：源文件或者 .ksb 中的每个函数在线程池中生成到单独的模块，最后链接成一个模块
+    // -float：没有写精度的函数都按单精度生成，extern 调用 C 库中带 f 后缀的版本
+    // -O0、-O1、-O2、-O3、-Os：输出目标文件之前的优化级别，默认是 O0，打开 -loop-report 或者 -veclib 时默认是 O3
+    // -loop-report：在 stderr 中按 for 的源码位置报告每个循环是否被向量化
+    // -veclib Accelerate：循环中的数学函数向量化时调用 Accelerate 库中的向量版本
+    // 其余的参数是源文件，.ksb 结尾的是预先编译好的二进制 AST
+    bool hashConsing = false;
+    bool incremental = false;
+    bool parallelCodegen = false;
+    bool loopReport = false;
+    bool hasOptimizationLevel = false;
+    OptimizationLevel optimizationLevel = optimize_O0;
+    auto vectorLibrary = llvm::TargetLibraryInfoImpl::NoLibrary;
+    const char *sourceFileName = nullptr;
+    const char *binaryOutputFileName = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-dag") == 0) {
+            hashConsing = true;
+        } else if (strcmp(argv[i], "-incremental") == 0) {
+            incremental = true;
+        } else if (strcmp(argv[i], "-parallel-codegen") == 0) {
+            parallelCodegen = true;
+        } else if (parseOptimizationLevel(argv[i], optimizationLevel)) {
+            hasOptimizationLevel = true;
+        } else if (strcmp(argv[i], "-loop-report") == 0) {
+            loopReport = true;
+        } else if (strcmp(argv[i], "-veclib") == 0 && i + 1 < argc) {
+            if (strcmp(argv[++i], "Accelerate") != 0) {
+                fprintf(stderr, "Unknown vector library %s, expected Accelerate\n", argv[i]);
+                return 1;
+            }
+            vectorLibrary = llvm::TargetLibraryInfoImpl::Accelerate;
+        } else if (strcmp(argv[i], "-float") == 0) {
+            codegenContext.setFloatMode(float_single);
+        } else if (strcmp(argv[i], "-emit-ksb") == 0 && i + 1 < argc) {
+            binaryOutputFileName = argv[++i];
+        } else {
+            sourceFileName = argv[i];
+        }
+    }
+
+    if (sourceFileName && llvm::StringRef(sourceFileName).endswith(".ksb")) {
+        // 二进制 AST 不需要解析，读入后直接生成代码
+        FlatAST flatAST;
+        if (!BinaryAST::load(sourceFileName, flatAST, codegenContext.getOperatorTable())) {
+            return 1;
+        }
+        if (parallelCodegen) {
+            ParallelCodegen codegen;
+            codegen.generate(flatAST, codegenContext.getOperatorTable(), codegenContext.getFloatMode());
+            if (!codegen.linkInto(*codegenContext.getModule())) {
+                return 1;
+            }
+        } else {
+            for (FunctionIndex function = 0; function < flatAST.getFunctionCount(); ++function) {
+                ExprParser::emitFunction(codegenContext, flatAST, function);
+            }
+        }
+        if (binaryOutputFileName && !BinaryAST::save(flatAST, codegenContext.getOperatorTable(), binaryOutputFileName)) {
+            return 1;
+        }
+    } else if (sourceFileName && incremental) {
+        IncrementalParser parser(codegenContext);
+        parser.setHashConsing(hashConsing);
+
+        std::string inputString;
+        do {
+            if (!parser.parseFile(sourceFileName)) {
+                return 1;
+            }
+            fprintf(stderr, "Reused %u definitions, recompiled %u\n", parser.getReusedCount(),
+                    parser.getRecompiledCount());
 
+            fprintf(stderr, "ready> ");
+            std::getline(std::cin, inputString);
+        } while (inputString != "~" && std::cin);
+    } else if (sourceFileName) {
+        // 给出了源文件时，直接把整个文件映射进内存，多线程解析
+        ParallelParser parser(codegenContext);
+        parser.setHashConsing(hashConsing);
+        parser.setDeferCodegen(parallelCodegen);
+        if (!parser.parseFile(sourceFileName)) {
+            return 1;
+        }
+        if (parser.isCodegenDeferred()) {
+            // 每个函数生成在单独的模块中，再链接到 codegenContext 的模块里，之后和逐个生成时一样输出
+            ParallelCodegen codegen;
+            codegen.generate(parser.getFlatAST(), codegenContext.getOperatorTable(), codegenContext.getFloatMode());
+            if (!codegen.linkInto(*codegenContext.getModule())) {
+                return 1;
+            }
+        }
+        if (binaryOutputFileName && !BinaryAST::save(parser.getFlatAST(), codegenContext.getOperatorTable(), binaryOutputFileName)) {
+            return 1;
+        }
+    } else {
+        auto parser = ExprParser();
+        parser.setCodegenContext(&codegenContext);
+        parser.setHashConsing(hashConsing);
+
+        std::string inputString;
+        // 写上初始的提示文本
         fprintf(stderr, "ready> ");
         std::getline(std::cin, inputString);
+        while (inputString != "~") {
+            parser.startParse(inputString);
+
+            fprintf(stderr, "ready> ");
+            std::getline(std::cin, inputString);
+        }
+        if (binaryOutputFileName && !BinaryAST::save(parser.getFlatAST(), codegenContext.getOperatorTable(), binaryOutputFileName)) {
+            return 1;
+        }
     }
 
     // dump 出当前 llvm IR 中已经生成的所有代码
-    llvm::Module *module = dumpLLVMContext();
+    llvm::Module *module = codegenContext.dumpModule();
 
     // 初始化
     llvm::InitializeNativeTarget();
@@ -77,6 +199,21 @@ int main(int argc, char const *argv[]) {
     auto targetMachine = target->createTargetMachine(targetTriple, CPU, features, options, rm);
     module->setDataLayout(targetMachine->createDataLayout());
 
+    // 循环报告和向量数学库只在向量化时有意义，没有写级别时按 O3
+    if (!hasOptimizationLevel && (loopReport || vectorLibrary != llvm::TargetLibraryInfoImpl::NoLibrary)) {
+        optimizationLevel = optimize_O3;
+    }
+    {
+        ModuleOptimizer optimizer(*targetMachine);
+        optimizer.setOptimizationLevel(optimizationLevel);
+        optimizer.setLoopReport(loopReport);
+        optimizer.setVectorLibrary(vectorLibrary);
+        optimizer.run(*module);
+        if (loopReport) {
+            optimizer.printLoopReport(llvm::errs());
+        }
+    }
+
     // 打开要输出的文件
     auto fileName = "output.o";
     std::error_code error_code;